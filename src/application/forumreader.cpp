@@ -50,11 +50,50 @@ void dumpFutureObj(QFuture<T> future, QString name)
 	Q_UNUSED(name);
 #endif
 }
+
+// NOTE: times are converted to milliseconds, as QML is not interested in the microsecond precision
+double toMs(qint64 us) { return (us >= 0) ? static_cast<double>(us) / 1000.0 : -1.0; }
+
+QVariantMap histogramToVariant(const TimingHistogram &histogram) {
+
+	QVariantList buckets;
+	for (const quint64 bucketCount : histogram.buckets())
+		buckets << bucketCount;
+
+	QVariantMap result;
+	result["count"] = histogram.count();
+	result["minMs"] = toMs(histogram.minUs());
+	result["meanMs"] = toMs(histogram.meanUs());
+	result["p50Ms"] = toMs(histogram.percentileUs(50));
+	result["p95Ms"] = toMs(histogram.percentileUs(95));
+	result["p99Ms"] = toMs(histogram.percentileUs(99));
+	result["maxMs"] = toMs(histogram.maxUs());
+	// NOTE: bucket i counts the values in range [2^i, 2^(i+1)) microseconds
+	result["buckets"] = buckets;
+	return result;
+}
+
+QVariantMap timingToVariant(const TransferTiming &timing) {
+
+	QVariantMap result;
+	result["url"] = timing.m_url;
+	result["ok"] = timing.m_ok;
+	result["httpCode"] = timing.m_httpCode;
+	result["reusedConnection"] = timing.m_reusedConnection;
+	for (int i = 0; i < static_cast<int>(TransferTiming::Phase::Count); ++i) {
+		const auto phase = static_cast<TransferTiming::Phase>(i);
+		result[QString(TransferTiming::phaseName(phase)) + "Ms"] = toMs(timing.phaseUs(phase));
+	}
+	result["bytesReceived"] = timing.m_bytesReceived;
+	result["bytesDecoded"] = timing.m_bytesDecoded;
+	return result;
+}
 }
 
 ForumReader::ForumReader()
 	: m_pendingTaskCount(0)
-	, m_timeToExit(false) {
+	, m_timeToExit(false)
+	, m_pageParseToken() {
 	connect(&ForumThreadPool::globalInstance(), &ForumThreadPool::downloadProgress, this,
 		&ForumReader::onForumPageDownloadProgress);
 	connect(&ForumThreadPool::globalInstance(), &ForumThreadPool::threadParseProgress, this,
@@ -70,6 +109,13 @@ ForumReader::ForumReader()
 		while (!m_timeToExit.load(std::memory_order_acquire)) {
 			// NOTE: without timeout queue will wait for new item forever, and thread will never finish!
 			if (m_tasks.wait_dequeue_timed(task, std::chrono::milliseconds(100))) {
+				// NOTE: superseded task is dropped before it consumes the bandwidth or parser time
+				if (task.token().isCancelled()) {
+					SystemLogger->info("Skipping cancelled task");
+					m_pendingTaskCount.fetch_add(-1, std::memory_order_release);
+					continue;
+				}
+
 				// Process task
 				SystemLogger->info("Processing task");
 
@@ -83,11 +129,12 @@ ForumReader::ForumReader()
 						break;
 					}
 					case BfrTask::Action::ParseForumThreadPagePosts: {
+						// NOTE: result of the cancelled task is not emitted
 						int pageCount = -1;
-						result = pool.getForumThreadPageCount(task.url(), pageCount);
+						result = pool.getForumThreadPageCount(task.url(), pageCount, task.token());
 						if (result_code::succeeded(result)) {
 							bfr::PostList posts;
-							result = pool.getForumPagePosts(task.url(), task.pageNo(), posts);
+							result = pool.getForumPagePosts(task.url(), task.pageNo(), posts, task.token());
 							if (result_code::succeeded(result)) {
 								QVariantList postsVrnt;
 								for (const auto &post : posts) {
@@ -131,6 +178,10 @@ ForumReader::ForumReader()
 						}
 						break;
 					}
+					case BfrTask::Action::WarmUpConnection: {
+						result = pool.warmUpConnection();
+						break;
+					}
 					default: {
 						SystemLogger->error("Invalid task action got: {}", static_cast<int>(task.action()));
 						break;
@@ -143,11 +194,19 @@ ForumReader::ForumReader()
 
 		SystemLogger->info("Producer thread finished");
 	});
+
+	// NOTE: the connection must be opened by the producer thread, because it downloads the pages;
+	//       warm-up task is the first one in the queue, so it's done while user is choosing the forum thread
+	SystemLogger->info("Enqueue forum host connection warm-up task");
+	m_pendingTaskCount.fetch_add(1, std::memory_order_release);
+	m_tasks.enqueue(BfrTask(BfrTask::Action::WarmUpConnection, ForumThreadUrlData()));
 }
 
 ForumReader::~ForumReader() {
 	SystemLogger->info("ForumReader dtor started");
 
+	// NOTE: page download in progress would delay the exit
+	m_pageParseToken.cancel();
 	m_timeToExit = true;
 	m_producerThread.join();
 
@@ -163,6 +222,31 @@ QString ForumReader::applicationDirPath() const {
 
 QUrl ForumReader::convertToUrl(QString urlStr) const { return QUrl(urlStr); }
 
+QVariantMap ForumReader::networkMetrics() const {
+
+	const TransferMetricsSnapshot metrics = FileDownloader::transferMetrics();
+
+	QVariantMap phases;
+	for (int i = 0; i < static_cast<int>(TransferTiming::Phase::Count); ++i)
+		phases[TransferTiming::phaseName(static_cast<TransferTiming::Phase>(i))] = histogramToVariant(metrics.m_phases[i]);
+
+	QVariantList recent;
+	for (const auto &timing : metrics.m_recent)
+		recent << timingToVariant(timing);
+
+	QVariantMap result;
+	result["transferCount"] = metrics.m_transferCount;
+	result["failedCount"] = metrics.m_failedCount;
+	result["bytesReceived"] = metrics.m_bytesReceived;
+	result["bytesDecoded"] = metrics.m_bytesDecoded;
+	result["phases"] = phases;
+	result["parse"] = histogramToVariant(metrics.m_parse);
+	result["recent"] = recent;
+	return result;
+}
+
+void ForumReader::resetNetworkMetrics() { FileDownloader::resetTransferMetrics(); }
+
 void ForumReader::startPageCountAsync(ForumThreadUrl *url) {
 	SystemLogger->info("Enqueue forum thread page count parse task");
 	m_pendingTaskCount.fetch_add(1, std::memory_order_release);
@@ -171,8 +255,10 @@ void ForumReader::startPageCountAsync(ForumThreadUrl *url) {
 
 void ForumReader::startPageParseAsync(ForumThreadUrl *url, int pageNo) {
 	SystemLogger->info("Enqueue forum thread page posts parse task");
+	m_pageParseToken.cancel();
+	m_pageParseToken = CancellationToken::create();
 	m_pendingTaskCount.fetch_add(1, std::memory_order_release);
-	m_tasks.enqueue(BfrTask(BfrTask::Action::ParseForumThreadPagePosts, url->data(), pageNo));
+	m_tasks.enqueue(BfrTask(BfrTask::Action::ParseForumThreadPagePosts, url->data(), pageNo, m_pageParseToken));
 
 	// FIXME: a better way? server don't return Content-Length header;
 	//        a HTML page size is unknown, and the only way to get it - download the entire page;
@@ -190,18 +276,20 @@ void ForumReader::startThreadUsersParseAsync(ForumThreadUrl *url) {
 
 //---------------------------------------------------------------------------------------------------------------------------------------------------
 
-void ForumReader::onForumPageDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+void ForumReader::onForumPageDownloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded)
 {
 #ifdef BFR_PRINT_DEBUG_OUTPUT
-	SystemLogger->info("{}: {} bytes received, from {} bytes total", Q_FUNC_INFO, bytesReceived, bytesTotal);
+	SystemLogger->info("{}: {} bytes received, from {} bytes total, {} bytes decoded", Q_FUNC_INFO, bytesReceived, bytesTotal, bytesDecoded);
 #endif
 
 	// NOTE: this field is unreliable source of data length, often it is just -1
 	//Q_ASSERT(bytesTotal <= 0);
 	Q_UNUSED(bytesTotal);
+	Q_UNUSED(bytesReceived);
 
-	// NOTE: HTML page size should not exceed 2^32 bytes, i hope :)
-	emit pageContentParseProgress((int)bytesReceived);
+	// NOTE: progress range is the average decompressed page size, so compressed bytes count can't be used here;
+	//       HTML page size should not exceed 2^32 bytes, i hope :)
+	emit pageContentParseProgress((int)bytesDecoded);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------------------
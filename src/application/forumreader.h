@@ -40,6 +40,9 @@ class ForumReader : public QObject {
 	std::atomic<int> m_pendingTaskCount;
 	std::thread m_producerThread;
 	std::atomic<bool> m_timeToExit;
+	// Token of the latest page parse task: user can flip the pages faster than they are downloaded,
+	// so the previous page task is cancelled as soon as the new one is requested
+	CancellationToken m_pageParseToken;
 
 public:
 	ForumReader();
@@ -54,6 +57,11 @@ public:
 	Q_INVOKABLE void startPageParseAsync(ForumThreadUrl *url, int pageNo);
 	Q_INVOKABLE void startThreadUsersParseAsync(ForumThreadUrl *url);
 
+	// Network diagnostics: request timing histograms (DNS, connect, TLS, TTFB, transfer, total),
+	// page parse time histogram, and the timing breakdown of the latest requests
+	Q_INVOKABLE QVariantMap networkMetrics() const;
+	Q_INVOKABLE void resetNetworkMetrics();
+
 signals:
 	// Forum parser signals
 	void pageCountParsed(int pageCount);
@@ -68,7 +76,7 @@ signals:
 
 private slots:
 	// Forum page downloader slots
-	void onForumPageDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+	void onForumPageDownloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded);
 };
 
 #endif // __BFR_FORUMREADER_H__
@@ -52,7 +52,7 @@ bool initLogLibrary() {
 #elif defined(Q_OS_UNIX)
 		/*auto console =*/spdlog::stdout_color_mt("system");
 #else
-		auto sink = std::make_shared<spdlog::sinks::windebug_sink_st>();
+		auto sink = std::make_shared<spdlog::sinks::windebug_sink_mt>();
 		auto logger = std::make_shared<spdlog::logger>("system", sink);
 		spdlog::register_logger(logger);
 #endif
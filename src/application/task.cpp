@@ -26,17 +26,27 @@
 BfrTask::BfrTask()
 	: m_action(Action::Invalid)
 	, m_url()
-	, m_pageNo(INVALID_PAGENO) { }
+	, m_pageNo(INVALID_PAGENO)
+	, m_token() { }
 
 BfrTask::BfrTask(const BfrTask::Action action, const ForumThreadUrlData &url)
 	: m_action(action)
 	, m_url(url)
-	, m_pageNo(INVALID_PAGENO) { }
+	, m_pageNo(INVALID_PAGENO)
+	, m_token() { }
 
 BfrTask::BfrTask(const BfrTask::Action action, const ForumThreadUrlData &url, const int pageNo)
 	: m_action(action)
 	, m_url(url)
-	, m_pageNo(pageNo) { }
+	, m_pageNo(pageNo)
+	, m_token() { }
+
+BfrTask::BfrTask(
+	const BfrTask::Action action, const ForumThreadUrlData &url, const int pageNo, const CancellationToken &token)
+	: m_action(action)
+	, m_url(url)
+	, m_pageNo(pageNo)
+	, m_token(token) { }
 
 bool BfrTask::isValid() const {
 	// TODO: implement and use
@@ -48,3 +58,5 @@ BfrTask::Action BfrTask::action() const { return m_action; }
 const ForumThreadUrlData &BfrTask::url() const { return m_url; }
 
 int BfrTask::pageNo() const { return m_pageNo; }
+
+const CancellationToken &BfrTask::token() const { return m_token; }
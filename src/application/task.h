@@ -25,6 +25,7 @@
 #define __BFR_TASK_H__
 
 #include <common/forumthreadurl.h>
+#include <common/cancellationtoken.h>
 
 class BfrTask
 {
@@ -34,6 +35,7 @@ public:
 		ParseForumThreadPageCount, // Input: URL           | Output: URL, int
 		ParseForumThreadPagePosts, // Input: URL, pageNo   | Output: URL, PostList
 		ExtractForumThreadUsers, // Input: URL           | Output: URL, UserList
+		WarmUpConnection, // Input: none          | Output: none
 		// AnalyzeForumThreadUsers,    // Input: URL, UserList | Output: URL, UserList
 		Count
 	};
@@ -45,6 +47,8 @@ private:
 	Action m_action;
 	ForumThreadUrlData m_url;
 	int m_pageNo;
+	// Task is skipped or aborted when its result becomes obsolete
+	CancellationToken m_token;
 
 	// Output data
 	// int m_pageCount; // Action: ParseForumThreadPageCount
@@ -55,12 +59,14 @@ public:
 	BfrTask();
 	BfrTask(const Action action, const ForumThreadUrlData &url);
 	BfrTask(const Action action, const ForumThreadUrlData &url, const int pageNo);
+	BfrTask(const Action action, const ForumThreadUrlData &url, const int pageNo, const CancellationToken &token);
 	~BfrTask() = default;
 
 	bool isValid() const;
 	Action action() const;
 	const ForumThreadUrlData &url() const;
 	int pageNo() const;
+	const CancellationToken &token() const;
 };
 
 #endif // __BFR_TASK_H__
@@ -0,0 +1,41 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "cancellationtoken.h"
+
+CancellationToken CancellationToken::create() {
+
+	CancellationToken result;
+	result.m_cancelled = std::make_shared<std::atomic<bool>>(false);
+	return result;
+}
+
+bool CancellationToken::isNull() const { return !m_cancelled; }
+
+bool CancellationToken::isCancelled() const { return m_cancelled && m_cancelled->load(std::memory_order_acquire); }
+
+void CancellationToken::cancel() {
+
+	if (m_cancelled)
+		m_cancelled->store(true, std::memory_order_release);
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_CANCELLATIONTOKEN_H__
+#define __BFR_CANCELLATIONTOKEN_H__
+
+#include <atomic>
+#include <memory>
+
+// Cooperative cancellation of the long operations, e.g. page downloads and parsing:
+// the requester keeps a copy of the token and cancels it when the result becomes obsolete,
+// and the worker checks the token at the convenient points and stops as soon as possible.
+// All the copies share the same state; default constructed token is null, i.e. it is never cancelled
+class CancellationToken {
+public:
+	CancellationToken() = default;
+
+	// The new token which can be cancelled
+	static CancellationToken create();
+
+	bool isNull() const;
+	bool isCancelled() const;
+	// NOTE: cancellation is not reversible; does nothing for the null token
+	void cancel();
+
+private:
+	std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
+
+#endif // __BFR_CANCELLATIONTOKEN_H__
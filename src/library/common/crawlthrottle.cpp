@@ -0,0 +1,247 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "crawlthrottle.h"
+
+#include <common/logger.h>
+
+#include <QtCore/QThread>
+
+#include <cmath>
+
+// TokenBucket ////////////////////////////////////////////////////////////////
+
+TokenBucket::TokenBucket(double rate, double burst)
+	: m_rate(rate)
+	, m_burst(burst)
+	, m_tokens(burst)
+	, m_lastRefillMs(-1) { }
+
+double TokenBucket::rate() const { return m_rate; }
+
+double TokenBucket::burst() const { return m_burst; }
+
+void TokenBucket::setRate(double rate, double burst) {
+
+	Q_ASSERT(rate > 0.0 && burst >= 1.0);
+	m_rate = rate;
+	m_burst = burst;
+	m_tokens = qMin(m_tokens, m_burst);
+}
+
+void TokenBucket::refill(qint64 nowMs) {
+
+	if (m_lastRefillMs >= 0 && nowMs > m_lastRefillMs)
+		m_tokens = qMin(m_burst, m_tokens + m_rate * static_cast<double>(nowMs - m_lastRefillMs) / 1000.0);
+	m_lastRefillMs = nowMs;
+}
+
+qint64 TokenBucket::tryAcquire(qint64 nowMs) {
+
+	refill(nowMs);
+	if (m_tokens >= 1.0) {
+		m_tokens -= 1.0;
+		return 0;
+	}
+
+	return qMax<qint64>(1, static_cast<qint64>(std::ceil((1.0 - m_tokens) * 1000.0 / m_rate)));
+}
+
+void TokenBucket::drain(qint64 nowMs) {
+
+	refill(nowMs);
+	m_tokens = 0.0;
+}
+
+// AimdController /////////////////////////////////////////////////////////////
+
+namespace {
+// Weight of the new latency sample in the moving average
+const double LatencyEwmaWeight = 0.2;
+}
+
+AimdController::AimdController()
+	: m_window(InitialWindow)
+	, m_latencyMs(0.0)
+	, m_baselineLatencyMs(0.0)
+	, m_requestsSinceDecrease(InitialWindow) { }
+
+int AimdController::window() const { return static_cast<int>(m_window); }
+
+double AimdController::latencyMs() const { return m_latencyMs; }
+
+void AimdController::onSuccess(qint64 latencyMs) {
+
+	m_requestsSinceDecrease++;
+
+	const double sample = static_cast<double>(qMax<qint64>(latencyMs, 1));
+	m_latencyMs = (m_latencyMs <= 0.0) ? sample : (m_latencyMs * (1.0 - LatencyEwmaWeight) + sample * LatencyEwmaWeight);
+	if ((m_baselineLatencyMs <= 0.0) || (m_latencyMs < m_baselineLatencyMs))
+		m_baselineLatencyMs = m_latencyMs;
+
+	if (m_latencyMs > m_baselineLatencyMs * LatencyRiseFactor) {
+		decrease();
+		return;
+	}
+
+	// NOTE: +1 per window of successful requests, i.e. per "round trip" of the whole window
+	m_window = qMin<double>(MaxWindow, m_window + 1.0 / m_window);
+}
+
+void AimdController::onCongestion() {
+
+	m_requestsSinceDecrease++;
+	decrease();
+}
+
+void AimdController::decrease() {
+
+	// NOTE: the requests sent before the previous decrease report the same congestion
+	if (m_requestsSinceDecrease < window())
+		return;
+
+	m_window = qMax<double>(MinWindow, std::floor(m_window / 2.0));
+	m_requestsSinceDecrease = 0;
+	// Let the latency baseline to adapt to the new conditions
+	m_baselineLatencyMs = m_latencyMs;
+}
+
+// CrawlThrottle //////////////////////////////////////////////////////////////
+
+CrawlThrottle::CrawlThrottle()
+	: m_mutex()
+	, m_hosts()
+	, m_clock()
+	, m_enabled(true) {
+
+	m_clock.start();
+}
+
+CrawlThrottle &CrawlThrottle::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created, it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static CrawlThrottle instance;
+	return instance;
+}
+
+bool CrawlThrottle::isEnabled() const {
+
+	QMutexLocker locker(&m_mutex);
+	return m_enabled;
+}
+
+void CrawlThrottle::setEnabled(bool enabled) {
+
+	QMutexLocker locker(&m_mutex);
+	m_enabled = enabled;
+}
+
+CrawlThrottle::HostState &CrawlThrottle::hostState(const QUrl &url) { return m_hosts[url.host()]; }
+
+void CrawlThrottle::setHostRate(const QString &host, double rate, double burst) {
+
+	QMutexLocker locker(&m_mutex);
+	m_hosts[host].m_bucket.setRate(rate, burst);
+}
+
+qint64 CrawlThrottle::acquire(const QUrl &url) {
+
+	QMutexLocker locker(&m_mutex);
+	if (!m_enabled)
+		return 0;
+
+	HostState &state = hostState(url);
+	const qint64 waitMs = state.m_bucket.tryAcquire(m_clock.elapsed());
+	if (waitMs > 0)
+		state.m_delayedCount++;
+	return waitMs;
+}
+
+bool CrawlThrottle::waitForSlot(const QUrl &url, const CancellationToken &token) {
+
+	while (!token.isCancelled()) {
+		const qint64 waitMs = acquire(url);
+		if (waitMs <= 0)
+			return true;
+
+		QThread::msleep(static_cast<unsigned long>(qMin(waitMs, WaitStepMs)));
+	}
+	return false;
+}
+
+int CrawlThrottle::window(const QUrl &url) {
+
+	QMutexLocker locker(&m_mutex);
+	if (!m_enabled)
+		return AimdController::MaxWindow;
+
+	return hostState(url).m_controller.window();
+}
+
+void CrawlThrottle::reportResult(const QUrl &url, bool ok, int httpCode, qint64 latencyMs) {
+
+	QMutexLocker locker(&m_mutex);
+
+	HostState &state = hostState(url);
+	state.m_requestCount++;
+
+	// NOTE: network errors other than server overload (e.g. DNS failure) say nothing about the server load
+	const bool congestion = (httpCode == 429) || (httpCode >= 500);
+	if (congestion) {
+		state.m_congestionCount++;
+		state.m_controller.onCongestion();
+		// Stop the bursts until the server recovers
+		state.m_bucket.drain(m_clock.elapsed());
+
+		SystemLogger->debug("Host '{}' is overloaded (HTTP {}), parallel requests: {}", url.host(), httpCode,
+			state.m_controller.window());
+	} else if (ok) {
+		const int oldWindow = state.m_controller.window();
+		state.m_controller.onSuccess(latencyMs);
+		if (state.m_controller.window() < oldWindow)
+			state.m_congestionCount++;
+	}
+}
+
+CrawlThrottle::Metrics CrawlThrottle::metrics(const QString &host) const {
+
+	QMutexLocker locker(&m_mutex);
+
+	Metrics result;
+	const auto it = m_hosts.constFind(host);
+	if (it == m_hosts.constEnd()) {
+		const HostState defaultState;
+		result.m_rate = defaultState.m_bucket.rate();
+		result.m_window = defaultState.m_controller.window();
+		return result;
+	}
+
+	result.m_rate = it->m_bucket.rate();
+	result.m_window = it->m_controller.window();
+	result.m_latencyMs = it->m_controller.latencyMs();
+	result.m_requestCount = it->m_requestCount;
+	result.m_congestionCount = it->m_congestionCount;
+	result.m_delayedCount = it->m_delayedCount;
+	return result;
+}
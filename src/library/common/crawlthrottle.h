@@ -0,0 +1,160 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_CRAWLTHROTTLE_H__
+#define __BFR_CRAWLTHROTTLE_H__
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QUrl>
+
+#include <common/cancellationtoken.h>
+
+// Request rate limiter: the bucket is refilled with `rate` tokens per second, up to `burst` tokens,
+// and every request takes one token
+class TokenBucket {
+public:
+	TokenBucket(double rate, double burst);
+
+	double rate() const;
+	double burst() const;
+	void setRate(double rate, double burst);
+
+	// Take the token if it's available at the specified time, and return 0;
+	// otherwise return the time in ms to wait for the next token
+	qint64 tryAcquire(qint64 nowMs);
+	// Drop all the accumulated tokens, e.g. after the server asked to slow down
+	void drain(qint64 nowMs);
+
+private:
+	void refill(qint64 nowMs);
+
+	double m_rate;
+	double m_burst;
+	double m_tokens;
+	qint64 m_lastRefillMs;
+};
+
+// AIMD (additive increase, multiplicative decrease) controller of the parallel requests count:
+// - window grows by one after every window-sized series of successful requests, while the latency is stable;
+// - window is halved on the server overload signs: 429/5xx response codes or latency rise,
+//   but not more often than once per window of requests, because all of them were already in flight
+class AimdController {
+public:
+	static const int MinWindow = 1;
+	static const int MaxWindow = 16;
+	static const int InitialWindow = 4;
+	// Request latency is considered as rising if it exceeds the baseline latency this number of times
+	static const int LatencyRiseFactor = 3;
+
+	AimdController();
+
+	int window() const;
+	double latencyMs() const;
+
+	void onSuccess(qint64 latencyMs);
+	void onCongestion();
+
+private:
+	void decrease();
+
+	double m_window;
+	// Exponentially weighted moving average of request latency, and its minimum seen
+	double m_latencyMs;
+	double m_baselineLatencyMs;
+	int m_requestsSinceDecrease;
+};
+
+// Politeness and throughput manager of the crawling: token bucket and AIMD controller per host;
+// FileDownloader asks it before every request and reports every response back
+class CrawlThrottle {
+	// Delete copy and move constructors and assign operators
+	CrawlThrottle(CrawlThrottle const &) = delete; // Copy construct
+	CrawlThrottle(CrawlThrottle &&) = delete; // Move construct
+	CrawlThrottle &operator=(CrawlThrottle const &) = delete; // Copy assign
+	CrawlThrottle &operator=(CrawlThrottle &&) = delete; // Move assign
+
+public:
+	static constexpr double DefaultRate = 8.0;
+	static constexpr double DefaultBurst = 8.0;
+	// Maximum sleep between the cancellation checks of waitForSlot()
+	static const qint64 WaitStepMs = 50;
+
+	struct Metrics {
+		// Allowed requests per second
+		double m_rate = 0.0;
+		// Current count of the parallel requests allowed
+		int m_window = 0;
+		double m_latencyMs = 0.0;
+		quint64 m_requestCount = 0;
+		// Count of 429/5xx responses and latency rises
+		quint64 m_congestionCount = 0;
+		// Count of the requests delayed by the rate limiter
+		quint64 m_delayedCount = 0;
+	};
+
+protected:
+	struct HostState {
+		TokenBucket m_bucket { DefaultRate, DefaultBurst };
+		AimdController m_controller;
+		quint64 m_requestCount = 0;
+		quint64 m_congestionCount = 0;
+		quint64 m_delayedCount = 0;
+	};
+
+	mutable QMutex m_mutex;
+	QHash<QString /*host*/, HostState> m_hosts;
+	QElapsedTimer m_clock;
+	bool m_enabled;
+
+	CrawlThrottle();
+	~CrawlThrottle() = default;
+
+	HostState &hostState(const QUrl &url);
+
+public:
+	static CrawlThrottle &globalInstance();
+
+public:
+	bool isEnabled() const;
+	void setEnabled(bool enabled);
+
+	void setHostRate(const QString &host, double rate, double burst);
+
+	// Time in ms to wait before sending the request; 0 means the request can be sent now
+	qint64 acquire(const QUrl &url);
+	// Same as acquire, but blocks the calling thread until the request can be sent;
+	// token is checked on every wait step, so the cancelled request neither waits nor takes the token.
+	// Returns false if the request was cancelled
+	bool waitForSlot(const QUrl &url, const CancellationToken &token = CancellationToken());
+	// Count of the parallel requests allowed for the host
+	int window(const QUrl &url);
+	// ok is false for the network errors; httpCode is 0 if there was no response at all
+	void reportResult(const QUrl &url, bool ok, int httpCode, qint64 latencyMs);
+
+	Metrics metrics(const QString &host) const;
+};
+
+#endif // __BFR_CRAWLTHROTTLE_H__
@@ -0,0 +1,204 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "curlsocketloop.h"
+
+#ifndef USE_QT_NAM
+#include "downloadsession.h"
+
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#include <common/resultcode.h>
+#include <common/logger.h>
+
+CurlSocketLoop::CurlSocketLoop(QObject *parent)
+	: QObject(parent)
+	, m_multi(curl_multi_init())
+	, m_timer()
+	, m_transfers()
+	, m_sockets() {
+
+	if (!m_multi) {
+		SystemLogger->error("curl_multi_init() failed");
+		return;
+	}
+
+	curl_multi_setopt(m_multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+	curl_multi_setopt(m_multi, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(m_multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+	curl_multi_setopt(m_multi, CURLMOPT_TIMERDATA, this);
+
+	m_timer.setSingleShot(true);
+	connect(&m_timer, &QTimer::timeout, this, &CurlSocketLoop::onTimeout);
+}
+
+CurlSocketLoop::~CurlSocketLoop() {
+
+	if (!m_multi)
+		return;
+
+	// NOTE: easy handles belong to the callers, so they are only detached here;
+	//       socket notifiers are the children of this object
+	for (auto it = m_transfers.cbegin(); it != m_transfers.cend(); ++it)
+		curl_multi_remove_handle(m_multi, it.key());
+	m_transfers.clear();
+
+	curl_multi_cleanup(m_multi);
+}
+
+bool CurlSocketLoop::isValid() const { return (m_multi != nullptr); }
+
+bool CurlSocketLoop::addTransfer(CURL *curl, FinishedCallback finishedCb) {
+
+	BFR_RETURN_VALUE_IF(!curl, false, "Invalid easy handle");
+	if (!m_multi)
+		return false;
+
+	// HTTP/2: all the transfers to the same host are the streams of one connection
+	const bool http2 = DownloadSession::globalInstance().http2Enabled();
+	curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+
+	m_transfers.insert(curl, finishedCb);
+	const CURLMcode result = curl_multi_add_handle(m_multi, curl);
+	if (result != CURLM_OK) {
+		SystemLogger->error("curl_multi_add_handle() failed");
+		SystemLogger->error("Error code: {}", result);
+		SystemLogger->error("Error string: {}", curl_multi_strerror(result));
+
+		m_transfers.remove(curl);
+		return false;
+	}
+	// NOTE: libcurl sets the zero timeout by the timer callback, so the transfer is started by the next loop iteration
+	return true;
+}
+
+void CurlSocketLoop::removeTransfer(CURL *curl) {
+
+	if (!m_transfers.remove(curl))
+		return;
+
+	// NOTE: socket callback is called here for the sockets which are not needed anymore
+	curl_multi_remove_handle(m_multi, curl);
+}
+
+int CurlSocketLoop::transferCount() const { return m_transfers.size(); }
+
+int CurlSocketLoop::socketCallback(CURL *curl, curl_socket_t socket, int what, void *userData, void *socketData) {
+
+	Q_UNUSED(curl);
+	Q_UNUSED(socketData);
+
+	CurlSocketLoop *loop = static_cast<CurlSocketLoop *>(userData);
+	if (what == CURL_POLL_REMOVE)
+		loop->unwatchSocket(socket);
+	else
+		loop->watchSocket(socket, what);
+	return 0;
+}
+
+// NOTE: libcurl must not be called from its own callback, so the timeout action is always done by the timer
+int CurlSocketLoop::timerCallback(CURLM *multi, long timeoutMs, void *userData) {
+
+	Q_UNUSED(multi);
+
+	CurlSocketLoop *loop = static_cast<CurlSocketLoop *>(userData);
+	if (timeoutMs < 0)
+		loop->m_timer.stop();
+	else
+		loop->m_timer.start(static_cast<int>(timeoutMs));
+	return 0;
+}
+
+void CurlSocketLoop::watchSocket(curl_socket_t socket, int what) {
+
+	SocketNotifiers &notifiers = m_sockets[socket];
+	if (!notifiers.m_read) {
+		notifiers.m_read = new QSocketNotifier(static_cast<qintptr>(socket), QSocketNotifier::Read, this);
+		connect(notifiers.m_read, SIGNAL(activated(int)), this, SLOT(onSocketReadable(int)));
+	}
+	if (!notifiers.m_write) {
+		notifiers.m_write = new QSocketNotifier(static_cast<qintptr>(socket), QSocketNotifier::Write, this);
+		connect(notifiers.m_write, SIGNAL(activated(int)), this, SLOT(onSocketWritable(int)));
+	}
+
+	notifiers.m_read->setEnabled((what == CURL_POLL_IN) || (what == CURL_POLL_INOUT));
+	notifiers.m_write->setEnabled((what == CURL_POLL_OUT) || (what == CURL_POLL_INOUT));
+}
+
+void CurlSocketLoop::unwatchSocket(curl_socket_t socket) {
+
+	const SocketNotifiers notifiers = m_sockets.take(socket);
+
+	// NOTE: notifier could be the signal sender now, so it can't be deleted immediately
+	for (QSocketNotifier *notifier : { notifiers.m_read, notifiers.m_write }) {
+		if (!notifier)
+			continue;
+
+		notifier->setEnabled(false);
+		notifier->deleteLater();
+	}
+}
+
+void CurlSocketLoop::socketAction(curl_socket_t socket, int eventMask) {
+
+	int runningCount = 0;
+	const CURLMcode result = curl_multi_socket_action(m_multi, socket, eventMask, &runningCount);
+	if (result != CURLM_OK) {
+		SystemLogger->error("curl_multi_socket_action() failed");
+		SystemLogger->error("Error code: {}", result);
+		SystemLogger->error("Error string: {}", curl_multi_strerror(result));
+	}
+
+	processMessages();
+}
+
+void CurlSocketLoop::processMessages() {
+
+	// NOTE: finished callbacks can add and remove the transfers,
+	//       so all the messages are collected first; message is invalidated by curl_multi_remove_handle call
+	QVector<QPair<CURL *, CURLcode>> finished;
+	int messagesLeft = 0;
+	while (CURLMsg *message = curl_multi_info_read(m_multi, &messagesLeft)) {
+		if (message->msg == CURLMSG_DONE)
+			finished.append(qMakePair(message->easy_handle, message->data.result));
+	}
+
+	for (const auto &transfer : qAsConst(finished)) {
+		// NOTE: transfer could be removed by the previous finished callback
+		if (!m_transfers.contains(transfer.first))
+			continue;
+
+		const FinishedCallback finishedCb = m_transfers.take(transfer.first);
+		curl_multi_remove_handle(m_multi, transfer.first);
+		if (finishedCb)
+			finishedCb(transfer.first, transfer.second);
+	}
+}
+
+void CurlSocketLoop::onSocketReadable(int socket) { socketAction(static_cast<curl_socket_t>(socket), CURL_CSELECT_IN); }
+
+void CurlSocketLoop::onSocketWritable(int socket) { socketAction(static_cast<curl_socket_t>(socket), CURL_CSELECT_OUT); }
+
+void CurlSocketLoop::onTimeout() { socketAction(CURL_SOCKET_TIMEOUT, 0); }
+#endif
@@ -0,0 +1,94 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_CURLSOCKETLOOP_H__
+#define __BFR_CURLSOCKETLOOP_H__
+
+#ifndef USE_QT_NAM
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QTimer>
+
+#include <curl/curl.h>
+
+#include <functional>
+
+// Runs any number of libcurl transfers on the owner thread without blocking it:
+// multi handle is driven by curl_multi_socket_action from the Qt event loop,
+// using QSocketNotifier for the socket readiness and QTimer for the libcurl timeouts.
+// NOTE: object is thread-affine, i.e. all the methods must be called from the owner thread,
+//       and the thread must run the Qt event loop; see DownloadSession::threadSocketLoop()
+class CurlSocketLoop : public QObject {
+	Q_OBJECT
+
+	// Delete copy and move constructors and assign operators
+	CurlSocketLoop(CurlSocketLoop const &) = delete; // Copy construct
+	CurlSocketLoop(CurlSocketLoop &&) = delete; // Move construct
+	CurlSocketLoop &operator=(CurlSocketLoop const &) = delete; // Copy assign
+	CurlSocketLoop &operator=(CurlSocketLoop &&) = delete; // Move assign
+
+public:
+	// Called on the owner thread when the transfer is finished;
+	// easy handle is already removed from the loop, and belongs to the caller again
+	using FinishedCallback = std::function<void(CURL * /*curl*/, CURLcode /*result*/)>;
+
+	explicit CurlSocketLoop(QObject *parent = nullptr);
+	~CurlSocketLoop();
+
+	bool isValid() const;
+
+	// Start the transfer of the configured easy handle; returns immediately
+	bool addTransfer(CURL *curl, FinishedCallback finishedCb);
+	// Abort the transfer, finished callback will not be called
+	void removeTransfer(CURL *curl);
+	int transferCount() const;
+
+private:
+	struct SocketNotifiers {
+		QSocketNotifier *m_read = nullptr;
+		QSocketNotifier *m_write = nullptr;
+	};
+
+	CURLM *m_multi;
+	QTimer m_timer;
+	QHash<CURL *, FinishedCallback> m_transfers;
+	QHash<curl_socket_t, SocketNotifiers> m_sockets;
+
+	static int socketCallback(CURL *curl, curl_socket_t socket, int what, void *userData, void *socketData);
+	static int timerCallback(CURLM *multi, long timeoutMs, void *userData);
+
+	void watchSocket(curl_socket_t socket, int what);
+	void unwatchSocket(curl_socket_t socket);
+	void socketAction(curl_socket_t socket, int eventMask);
+	void processMessages();
+
+private slots:
+	// NOTE: QSocketNotifier::activated is overloaded in Qt 5.15, so the old-style connection is used
+	void onSocketReadable(int socket);
+	void onSocketWritable(int socket);
+	void onTimeout();
+};
+#endif
+
+#endif // __BFR_CURLSOCKETLOOP_H__
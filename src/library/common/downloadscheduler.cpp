@@ -0,0 +1,176 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "downloadscheduler.h"
+#include "downloadsession.h"
+#include "crawlthrottle.h"
+
+#include <common/logger.h>
+
+#include <QtCore/QUrl>
+
+DownloadScheduler::DownloadScheduler(const QStringList &urlStrs, int maxParallel)
+	: m_urlStrs(urlStrs)
+	, m_maxParallel(maxParallel)
+	, m_retryPolicy(DownloadSession::globalInstance().retryPolicy())
+	, m_hedgeDelayMs(DownloadSession::globalInstance().hedgeDelayMs())
+	, m_states(urlStrs.size())
+	, m_nextIndex(0)
+	, m_retryQueue()
+	, m_runningCount(0)
+	, m_doneCount(0)
+	, m_allSucceeded(true)
+	, m_clock() {
+
+	m_clock.start();
+}
+
+bool DownloadScheduler::isFinished() const { return m_doneCount >= m_urlStrs.size(); }
+
+bool DownloadScheduler::allSucceeded() const { return m_allSucceeded; }
+
+int DownloadScheduler::runningCount() const { return m_runningCount; }
+
+bool DownloadScheduler::isDone(int index) const { return m_states[index].m_done; }
+
+bool DownloadScheduler::findHedgeCandidate(qint64 nowMs, int &index, qint64 &waitMs) const {
+
+	if (m_hedgeDelayMs < 0)
+		return false;
+
+	for (int i = 0; i < m_states.size(); ++i) {
+		const UrlState &state = m_states[i];
+		if (state.m_done || state.m_hedged || (state.m_inFlight != 1))
+			continue;
+
+		const qint64 remainingMs = state.m_startedMs + m_hedgeDelayMs - nowMs;
+		if (remainingMs <= 0) {
+			index = i;
+			return true;
+		}
+		waitMs = (waitMs < 0) ? remainingMs : qMin(waitMs, remainingMs);
+	}
+	return false;
+}
+
+bool DownloadScheduler::nextRequest(Request &request, qint64 &waitMs) {
+
+	waitMs = -1;
+	if (isFinished() || (m_runningCount >= m_maxParallel))
+		return false;
+
+	const qint64 nowMs = m_clock.elapsed();
+
+	// Retries first, then the new requests, then hedges of the slow ones
+	int index = -1;
+	bool hedge = false;
+	if (!m_retryQueue.isEmpty() && (m_retryQueue.firstKey() <= nowMs)) {
+		index = m_retryQueue.first();
+	} else if (m_nextIndex < m_urlStrs.size()) {
+		index = m_nextIndex;
+	} else {
+		if (!m_retryQueue.isEmpty())
+			waitMs = m_retryQueue.firstKey() - nowMs;
+		hedge = findHedgeCandidate(nowMs, index, waitMs);
+		if (!hedge)
+			return false;
+	}
+
+	CrawlThrottle &throttle = CrawlThrottle::globalInstance();
+	const QUrl url(m_urlStrs[index]);
+	if (m_runningCount >= throttle.window(url))
+		return false;
+	const qint64 throttleWaitMs = throttle.acquire(url);
+	if (throttleWaitMs > 0) {
+		waitMs = throttleWaitMs;
+		return false;
+	}
+
+	UrlState &state = m_states[index];
+	if (hedge) {
+		state.m_hedged = true;
+		DownloadSession::globalInstance().registerHedge();
+		SystemLogger->debug("Hedging slow request of URL '{}' after {} ms", m_urlStrs[index], nowMs - state.m_startedMs);
+	} else {
+		if (index == m_nextIndex)
+			m_nextIndex++;
+		else
+			m_retryQueue.erase(m_retryQueue.begin());
+
+		state.m_attempts++;
+		state.m_startedMs = nowMs;
+	}
+	state.m_inFlight++;
+	m_runningCount++;
+
+	request.m_index = index;
+	request.m_attempt = state.m_attempts;
+	request.m_hedge = hedge;
+	request.m_startedMs = nowMs;
+	return true;
+}
+
+DownloadScheduler::Outcome DownloadScheduler::onFinished(const Request &request, bool ok, bool transient) {
+
+	Q_ASSERT(request.m_index >= 0 && request.m_index < m_states.size());
+
+	const qint64 nowMs = m_clock.elapsed();
+	UrlState &state = m_states[request.m_index];
+	state.m_inFlight--;
+	m_runningCount--;
+
+	if (state.m_done)
+		return Outcome::Discarded;
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	if (ok) {
+		state.m_done = true;
+		m_doneCount++;
+
+		session.addLatencySample(nowMs - request.m_startedMs);
+		if (request.m_hedge)
+			session.registerHedgeWin();
+		return Outcome::Succeeded;
+	}
+
+	// Another copy of the request is still running
+	if (state.m_inFlight > 0)
+		return Outcome::Discarded;
+
+	if (transient && (state.m_attempts < m_retryPolicy.m_maxAttempts)) {
+		const qint64 delayMs = m_retryPolicy.backoffDelayMs(state.m_attempts);
+		m_retryQueue.insert(nowMs + delayMs, request.m_index);
+		// NOTE: retried request may be hedged again
+		state.m_hedged = false;
+		session.registerRetry();
+
+		SystemLogger->info("Retrying download of URL '{}' in {} ms (attempt {} of {})", m_urlStrs[request.m_index],
+			delayMs, state.m_attempts + 1, m_retryPolicy.m_maxAttempts);
+		return Outcome::Retry;
+	}
+
+	state.m_done = true;
+	m_doneCount++;
+	m_allSucceeded = false;
+	return Outcome::Failed;
+}
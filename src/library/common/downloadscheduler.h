@@ -0,0 +1,104 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_DOWNLOADSCHEDULER_H__
+#define __BFR_DOWNLOADSCHEDULER_H__
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMultiMap>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <common/retrypolicy.h>
+
+// Network-library-independent scheduling of the batch download requests:
+// - new requests are started as far as the crawl throttle allows;
+// - transiently failed requests are retried after the jittered exponential backoff delay;
+// - hedging (optional): if a request is not finished within the p95 latency,
+//   the duplicate one is sent, and the first received response wins
+class DownloadScheduler {
+	// Delete copy and move constructors and assign operators
+	DownloadScheduler(DownloadScheduler const &) = delete; // Copy construct
+	DownloadScheduler(DownloadScheduler &&) = delete; // Move construct
+	DownloadScheduler &operator=(DownloadScheduler const &) = delete; // Copy assign
+	DownloadScheduler &operator=(DownloadScheduler &&) = delete; // Move assign
+
+public:
+	struct Request {
+		int m_index = -1;
+		int m_attempt = 0;
+		bool m_hedge = false;
+		qint64 m_startedMs = -1;
+	};
+
+	enum class Outcome {
+		Invalid = -1,
+		// URL download is finished, the response must be passed to the caller
+		Succeeded = 0,
+		Failed,
+		// Request will be repeated later
+		Retry,
+		// Response must be dropped: another copy of the request won or is still running
+		Discarded,
+		Count
+	};
+
+	DownloadScheduler(const QStringList &urlStrs, int maxParallel);
+
+	bool isFinished() const;
+	bool allSucceeded() const;
+	int runningCount() const;
+
+	// Returns true if the request must be started right now;
+	// otherwise waitMs is the time to call this method again, or -1 to wait for the running requests
+	bool nextRequest(Request &request, qint64 &waitMs);
+	Outcome onFinished(const Request &request, bool ok, bool transient);
+	// Whether the URL download is finished; if so, still running copies of its request should be cancelled
+	bool isDone(int index) const;
+
+private:
+	struct UrlState {
+		int m_attempts = 0;
+		int m_inFlight = 0;
+		bool m_done = false;
+		bool m_hedged = false;
+		qint64 m_startedMs = -1;
+	};
+
+	bool findHedgeCandidate(qint64 nowMs, int &index, qint64 &waitMs) const;
+
+	QStringList m_urlStrs;
+	int m_maxParallel;
+	RetryPolicy m_retryPolicy;
+	qint64 m_hedgeDelayMs;
+
+	QVector<UrlState> m_states;
+	int m_nextIndex;
+	QMultiMap<qint64 /*dueMs*/, int /*index*/> m_retryQueue;
+	int m_runningCount;
+	int m_doneCount;
+	bool m_allSucceeded;
+	QElapsedTimer m_clock;
+};
+
+#endif // __BFR_DOWNLOADSCHEDULER_H__
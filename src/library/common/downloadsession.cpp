@@ -0,0 +1,447 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "downloadsession.h"
+#include "httpcache.h"
+#ifndef USE_QT_NAM
+#include "curlsocketloop.h"
+#else
+#include <QtNetwork/QNetworkDiskCache>
+#endif
+
+#include <common/logger.h>
+
+#ifdef USE_QT_NAM
+// Disk cache common for all the thread managers.
+// QNetworkDiskCache is not thread-safe, so every call is serialized with the mutex
+class SharedNetworkCache {
+public:
+	QMutex m_mutex;
+	QNetworkDiskCache m_cache;
+};
+
+namespace {
+// Cache set to the thread manager: the manager takes the ownership of its cache,
+// so every manager gets its own proxy, which forwards the calls to the shared cache
+class SharedNetworkCacheProxy : public QAbstractNetworkCache {
+
+	std::shared_ptr<SharedNetworkCache> m_shared;
+
+public:
+	explicit SharedNetworkCacheProxy(const std::shared_ptr<SharedNetworkCache> &shared, QObject *parent = nullptr)
+		: QAbstractNetworkCache(parent), m_shared(shared) {}
+
+	QNetworkCacheMetaData metaData(const QUrl &url) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		return m_shared->m_cache.metaData(url);
+	}
+
+	void updateMetaData(const QNetworkCacheMetaData &metaData) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		m_shared->m_cache.updateMetaData(metaData);
+	}
+
+	// NOTE: returned device is owned by the caller, so it can be read without the lock
+	QIODevice *data(const QUrl &url) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		return m_shared->m_cache.data(url);
+	}
+
+	bool remove(const QUrl &url) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		return m_shared->m_cache.remove(url);
+	}
+
+	qint64 cacheSize() const override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		return m_shared->m_cache.cacheSize();
+	}
+
+	// NOTE: prepared device is written by the single reply only, until it's inserted or removed
+	QIODevice *prepare(const QNetworkCacheMetaData &metaData) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		return m_shared->m_cache.prepare(metaData);
+	}
+
+	void insert(QIODevice *device) override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		m_shared->m_cache.insert(device);
+	}
+
+	void clear() override {
+
+		QMutexLocker locker(&m_shared->m_mutex);
+		m_shared->m_cache.clear();
+	}
+};
+}
+#endif
+
+DownloadSession::DownloadSession()
+#ifndef USE_QT_NAM
+	: m_curlInitialized(false)
+	, m_threadHandles()
+	, m_share(nullptr)
+	, m_socketLoops()
+	, m_http2Enabled(true)
+#else
+	: m_threadManagers()
+	, m_networkCacheMutex()
+	, m_networkCache()
+	, m_http2Enabled(true)
+#endif
+	, m_connectionsOpened(0)
+	, m_connectionsReused(0)
+	, m_http2Transfers(0)
+	, m_retryMutex()
+	, m_retryPolicy()
+	, m_latencyTracker()
+	, m_hedgingEnabled(false)
+	, m_retryCount(0)
+	, m_hedgeCount(0)
+	, m_hedgeWinCount(0) {
+
+#ifndef USE_QT_NAM
+#ifdef BFR_PRINT_DEBUG_OUTPUT
+	SystemLogger->info("libcurl version: {}", LIBCURL_VERSION);
+#endif
+
+	// NOTE: curl_global_init is not thread-safe, so it must be called exactly once
+	//       before any other thread will use libcurl; C++11 guarantees what the
+	//       singleton constructor below will be executed only once
+	CURLcode result = curl_global_init(CURL_GLOBAL_ALL);
+	if (result != CURLE_OK) {
+		SystemLogger->error("curl_global_init() failed");
+		SystemLogger->error("Error code: {}", result);
+		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+		return;
+	}
+	m_curlInitialized = true;
+
+	if (!http2Supported())
+		SystemLogger->warn("libcurl was built without HTTP/2 support, HTTP/1.1 will be used");
+
+	// NOTE: downloads work without the share handle too, just without sharing caches between threads
+	m_share = curl_share_init();
+	if (!m_share) {
+		SystemLogger->error("curl_share_init() failed");
+		return;
+	}
+	curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+DownloadSession::~DownloadSession() {
+
+#ifndef USE_QT_NAM
+	// NOTE: handles of the other threads are cleaned up on their exit,
+	//       and the current thread ones are released here, before the share handle;
+	//       QThreadStorage does not delete the data of the current thread on its own destruction
+	if (m_socketLoops.hasLocalData())
+		m_socketLoops.setLocalData(nullptr);
+	if (m_threadHandles.hasLocalData())
+		m_threadHandles.setLocalData(nullptr);
+
+	// NOTE: share handle can be cleaned up only after all the easy handles using it
+	if (m_share)
+		curl_share_cleanup(m_share);
+
+	if (m_curlInitialized)
+		curl_global_cleanup();
+#endif
+}
+
+DownloadSession &DownloadSession::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created, it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static DownloadSession instance;
+	return instance;
+}
+
+bool DownloadSession::isValid() const {
+
+#ifndef USE_QT_NAM
+	return m_curlInitialized;
+#else
+	return true;
+#endif
+}
+
+bool DownloadSession::http2Supported() const {
+
+#ifndef USE_QT_NAM
+	const curl_version_info_data *versionInfo = curl_version_info(CURLVERSION_NOW);
+	return versionInfo && (versionInfo->features & CURL_VERSION_HTTP2);
+#else
+	// NOTE: Qt Network negotiates HTTP/2 using ALPN and falls back to HTTP/1.1 by itself
+	return true;
+#endif
+}
+
+bool DownloadSession::http2Enabled() const { return m_http2Enabled.load(std::memory_order_relaxed) && http2Supported(); }
+
+void DownloadSession::setHttp2Enabled(bool enabled) { m_http2Enabled.store(enabled, std::memory_order_relaxed); }
+
+#ifndef USE_QT_NAM
+DownloadSession::ThreadHandles::~ThreadHandles() {
+
+	for (CURL *curl : qAsConst(m_transfers))
+		curl_easy_cleanup(curl);
+	if (m_multi)
+		curl_multi_cleanup(m_multi);
+	if (m_easy)
+		curl_easy_cleanup(m_easy);
+}
+
+DownloadSession::ThreadHandles &DownloadSession::threadHandles() {
+
+	// NOTE: QThreadStorage owns the handles, and deletes them when the thread exits
+	if (!m_threadHandles.hasLocalData())
+		m_threadHandles.setLocalData(new ThreadHandles);
+	return *m_threadHandles.localData();
+}
+
+CURL *DownloadSession::threadHandle() {
+
+	if (!m_curlInitialized)
+		return nullptr;
+
+	ThreadHandles &handles = threadHandles();
+	if (handles.m_easy) {
+		// NOTE: live connections, DNS and TLS session caches are preserved by reset
+		curl_easy_reset(handles.m_easy);
+		return handles.m_easy;
+	}
+
+	handles.m_easy = curl_easy_init();
+	if (!handles.m_easy)
+		SystemLogger->error("curl_easy_init() failed");
+	return handles.m_easy;
+}
+
+CURLM *DownloadSession::threadMultiHandle() {
+
+	if (!m_curlInitialized)
+		return nullptr;
+
+	ThreadHandles &handles = threadHandles();
+	if (handles.m_multi)
+		return handles.m_multi;
+
+	handles.m_multi = curl_multi_init();
+	if (!handles.m_multi)
+		SystemLogger->error("curl_multi_init() failed");
+	return handles.m_multi;
+}
+
+CURL *DownloadSession::acquireTransferHandle() {
+
+	if (!m_curlInitialized)
+		return nullptr;
+
+	ThreadHandles &handles = threadHandles();
+	if (!handles.m_transfers.isEmpty()) {
+		CURL *curl = handles.m_transfers.takeLast();
+		curl_easy_reset(curl);
+		return curl;
+	}
+
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		SystemLogger->error("curl_easy_init() failed");
+	return curl;
+}
+
+void DownloadSession::releaseTransferHandle(CURL *curl) {
+
+	Q_ASSERT(curl);
+	if (!curl)
+		return;
+
+	threadHandles().m_transfers.append(curl);
+}
+
+void DownloadSession::lockShare(CURL *curl, curl_lock_data data, curl_lock_access access, void *userData) {
+
+	Q_UNUSED(curl);
+	Q_UNUSED(access);
+
+	Q_ASSERT(data >= 0 && data < CURL_LOCK_DATA_LAST);
+	static_cast<DownloadSession *>(userData)->m_shareMutexes[data].lock();
+}
+
+void DownloadSession::unlockShare(CURL *curl, curl_lock_data data, void *userData) {
+
+	Q_UNUSED(curl);
+
+	Q_ASSERT(data >= 0 && data < CURL_LOCK_DATA_LAST);
+	static_cast<DownloadSession *>(userData)->m_shareMutexes[data].unlock();
+}
+
+CURLSH *DownloadSession::shareHandle() const { return m_share; }
+
+CurlSocketLoop *DownloadSession::threadSocketLoop() {
+
+	if (!m_curlInitialized)
+		return nullptr;
+
+	// NOTE: QThreadStorage owns the loop, and deletes it when the thread exits
+	if (!m_socketLoops.hasLocalData())
+		m_socketLoops.setLocalData(new CurlSocketLoop);
+	return m_socketLoops.localData();
+}
+
+void DownloadSession::registerTransfer(CURL *curl) {
+
+	Q_ASSERT(curl);
+	if (!curl)
+		return;
+
+	long connectCount = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connectCount) != CURLE_OK)
+		return;
+
+	if (connectCount > 0)
+		m_connectionsOpened.fetch_add(static_cast<quint64>(connectCount), std::memory_order_relaxed);
+	else
+		m_connectionsReused.fetch_add(1, std::memory_order_relaxed);
+
+	long httpVersion = CURL_HTTP_VERSION_NONE;
+	if ((curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpVersion) == CURLE_OK)
+		&& (httpVersion == CURL_HTTP_VERSION_2_0))
+		m_http2Transfers.fetch_add(1, std::memory_order_relaxed);
+}
+#else
+QNetworkAccessManager *DownloadSession::threadNetworkAccessManager() {
+
+	// NOTE: QThreadStorage owns the manager, and deletes it when the thread exits
+	if (m_threadManagers.hasLocalData())
+		return m_threadManagers.localData();
+
+	QNetworkAccessManager *manager = new QNetworkAccessManager;
+	// NOTE: Qt does not follow redirects by default, unlike libcurl with CURLOPT_FOLLOWLOCATION
+	manager->setRedirectPolicy(QNetworkRequest::NoLessSafeRedirectPolicy);
+
+	// NOTE: disk cache sends the conditional requests and serves 304 responses itself;
+	//       the single cache directory and size limit are shared by all the threads,
+	//       so the cached pages are found regardless of the thread which downloaded them
+	HttpCache &httpCache = HttpCache::globalInstance();
+	if (httpCache.isEnabled()) {
+		QMutexLocker locker(&m_networkCacheMutex);
+		if (!m_networkCache) {
+			m_networkCache = std::make_shared<SharedNetworkCache>();
+			m_networkCache->m_cache.setCacheDirectory(httpCache.cacheDirectory() + "/network");
+			m_networkCache->m_cache.setMaximumCacheSize(NetworkCacheMaxSize);
+		}
+		manager->setCache(new SharedNetworkCacheProxy(m_networkCache, manager));
+	}
+
+	m_threadManagers.setLocalData(manager);
+	return manager;
+}
+#endif
+
+void DownloadSession::registerConnection(bool reused, bool http2) {
+
+	if (reused)
+		m_connectionsReused.fetch_add(1, std::memory_order_relaxed);
+	else
+		m_connectionsOpened.fetch_add(1, std::memory_order_relaxed);
+
+	if (http2)
+		m_http2Transfers.fetch_add(1, std::memory_order_relaxed);
+}
+
+quint64 DownloadSession::connectionsOpened() const { return m_connectionsOpened.load(std::memory_order_relaxed); }
+
+quint64 DownloadSession::connectionsReused() const { return m_connectionsReused.load(std::memory_order_relaxed); }
+
+quint64 DownloadSession::http2Transfers() const { return m_http2Transfers.load(std::memory_order_relaxed); }
+
+void DownloadSession::resetStatistics() {
+
+	m_connectionsOpened.store(0, std::memory_order_relaxed);
+	m_connectionsReused.store(0, std::memory_order_relaxed);
+	m_http2Transfers.store(0, std::memory_order_relaxed);
+	m_retryCount.store(0, std::memory_order_relaxed);
+	m_hedgeCount.store(0, std::memory_order_relaxed);
+	m_hedgeWinCount.store(0, std::memory_order_relaxed);
+}
+
+RetryPolicy DownloadSession::retryPolicy() const {
+
+	QMutexLocker locker(&m_retryMutex);
+	return m_retryPolicy;
+}
+
+void DownloadSession::setRetryPolicy(const RetryPolicy &policy) {
+
+	Q_ASSERT(policy.m_maxAttempts >= 1);
+
+	QMutexLocker locker(&m_retryMutex);
+	m_retryPolicy = policy;
+}
+
+bool DownloadSession::hedgingEnabled() const { return m_hedgingEnabled.load(std::memory_order_relaxed); }
+
+void DownloadSession::setHedgingEnabled(bool enabled) { m_hedgingEnabled.store(enabled, std::memory_order_relaxed); }
+
+void DownloadSession::addLatencySample(qint64 latencyMs) {
+
+	QMutexLocker locker(&m_retryMutex);
+	m_latencyTracker.addSample(latencyMs);
+}
+
+qint64 DownloadSession::hedgeDelayMs() const {
+
+	if (!hedgingEnabled())
+		return -1;
+
+	QMutexLocker locker(&m_retryMutex);
+	return m_latencyTracker.percentile(95);
+}
+
+void DownloadSession::registerRetry() { m_retryCount.fetch_add(1, std::memory_order_relaxed); }
+
+void DownloadSession::registerHedge() { m_hedgeCount.fetch_add(1, std::memory_order_relaxed); }
+
+void DownloadSession::registerHedgeWin() { m_hedgeWinCount.fetch_add(1, std::memory_order_relaxed); }
+
+quint64 DownloadSession::retryCount() const { return m_retryCount.load(std::memory_order_relaxed); }
+
+quint64 DownloadSession::hedgeCount() const { return m_hedgeCount.load(std::memory_order_relaxed); }
+
+quint64 DownloadSession::hedgeWinCount() const { return m_hedgeWinCount.load(std::memory_order_relaxed); }
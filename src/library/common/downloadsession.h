@@ -0,0 +1,195 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_DOWNLOADSESSION_H__
+#define __BFR_DOWNLOADSESSION_H__
+
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+#include <common/retrypolicy.h>
+
+#include <atomic>
+#include <memory>
+
+#ifndef USE_QT_NAM
+#include <curl/curl.h>
+
+class CurlSocketLoop;
+#else
+#include <QtNetwork/QNetworkAccessManager>
+
+class SharedNetworkCache;
+#endif
+
+// Process-wide network state shared by all the FileDownloader instances:
+// - one-time libcurl initialization;
+// - reusable libcurl easy handles, one per worker thread, so the live connections,
+//   DNS results and TLS sessions survive between the page downloads;
+// - libcurl share handle: DNS cache, TLS session cache and connection pool common for all the threads;
+// - long-lived Qt network access manager per thread, for the same purpose (it's not thread-safe, so can't be shared),
+//   with the automatic redirect following; all the managers use the single size-bounded disk cache of the pages;
+// - reusable libcurl multi handle (and its transfer easy handles) per worker thread,
+//   used by the batch download API;
+// - libcurl socket loop per thread, which runs the async downloads from the thread Qt event loop;
+// - HTTP/2 mode: when enabled, parallel requests to the same host are sent as streams
+//   over a single multiplexed connection, with fallback to HTTP/1.1 keep-alive
+//   if the server (or the network library) does not support HTTP/2;
+// - counters of opened and reused connections;
+// - retry policy of the failed transfers, and latency statistics for hedging of the slow ones
+class DownloadSession {
+	// Delete copy and move constructors and assign operators
+	DownloadSession(DownloadSession const &) = delete; // Copy construct
+	DownloadSession(DownloadSession &&) = delete; // Move construct
+	DownloadSession &operator=(DownloadSession const &) = delete; // Copy assign
+	DownloadSession &operator=(DownloadSession &&) = delete; // Move assign
+
+protected:
+#ifndef USE_QT_NAM
+	bool m_curlInitialized;
+
+	// NOTE: cleaned up on the thread exit, so the recycled thread id never gets the handles of another thread
+	struct ThreadHandles {
+		CURL *m_easy = nullptr;
+		CURLM *m_multi = nullptr;
+		// Idle easy handles for the multi handle transfers
+		QVector<CURL *> m_transfers;
+
+		ThreadHandles() = default;
+		~ThreadHandles();
+		ThreadHandles(ThreadHandles const &) = delete;
+		ThreadHandles &operator=(ThreadHandles const &) = delete;
+	};
+
+	QThreadStorage<ThreadHandles *> m_threadHandles;
+
+	ThreadHandles &threadHandles();
+
+	CURLSH *m_share;
+	// NOTE: libcurl asks to lock every kind of the shared data separately
+	QMutex m_shareMutexes[CURL_LOCK_DATA_LAST];
+
+	static void lockShare(CURL *curl, curl_lock_data data, curl_lock_access access, void *userData);
+	static void unlockShare(CURL *curl, curl_lock_data data, void *userData);
+
+	QThreadStorage<CurlSocketLoop *> m_socketLoops;
+#else
+	QThreadStorage<QNetworkAccessManager *> m_threadManagers;
+	// NOTE: created on the first manager with HTTP cache enabled; every manager owns its own proxy to it
+	QMutex m_networkCacheMutex;
+	std::shared_ptr<SharedNetworkCache> m_networkCache;
+#endif
+
+	std::atomic<bool> m_http2Enabled;
+
+	std::atomic<quint64> m_connectionsOpened;
+	std::atomic<quint64> m_connectionsReused;
+	std::atomic<quint64> m_http2Transfers;
+
+	mutable QMutex m_retryMutex;
+	RetryPolicy m_retryPolicy;
+	LatencyTracker m_latencyTracker;
+	std::atomic<bool> m_hedgingEnabled;
+	std::atomic<quint64> m_retryCount;
+	std::atomic<quint64> m_hedgeCount;
+	std::atomic<quint64> m_hedgeWinCount;
+
+	DownloadSession();
+	~DownloadSession();
+
+public:
+	static DownloadSession &globalInstance();
+
+#ifdef USE_QT_NAM
+	// Maximum size of the network disk cache, common for all the threads
+	static const qint64 NetworkCacheMaxSize = 64 * 1024 * 1024;
+#endif
+
+public:
+	bool isValid() const;
+
+	// Whether the network library was built with HTTP/2 support
+	bool http2Supported() const;
+	bool http2Enabled() const;
+	void setHttp2Enabled(bool enabled);
+
+#ifndef USE_QT_NAM
+	// Easy handle bound to the calling thread, with all options reset to defaults;
+	// NOTE: must not be cleaned up by caller
+	CURL *threadHandle();
+
+	// Multi handle bound to the calling thread; its connection cache is shared by all the added easy handles
+	// NOTE: must not be cleaned up by caller
+	CURLM *threadMultiHandle();
+	// Easy handle for the multi handle transfer, with all options reset to defaults;
+	// must be returned back using releaseTransferHandle() after removing it from the multi handle
+	CURL *acquireTransferHandle();
+	void releaseTransferHandle(CURL *curl);
+
+	// Update connection counters using the statistics of the finished transfer
+	void registerTransfer(CURL *curl);
+
+	// Share handle to be set with CURLOPT_SHARE on every easy handle; nullptr if it was not created
+	CURLSH *shareHandle() const;
+
+	// Socket loop bound to the calling thread, the thread must run the Qt event loop; it's destroyed on thread exit;
+	// nullptr if libcurl was not initialized
+	// NOTE: must not be deleted by caller
+	CurlSocketLoop *threadSocketLoop();
+#else
+	// Network access manager bound to the calling thread; it's destroyed on thread exit;
+	// if HTTP cache is enabled, the manager uses the process-wide disk cache in the HTTP cache directory
+	// NOTE: must not be deleted by caller
+	QNetworkAccessManager *threadNetworkAccessManager();
+#endif
+
+	void registerConnection(bool reused, bool http2);
+
+	quint64 connectionsOpened() const;
+	quint64 connectionsReused() const;
+	quint64 http2Transfers() const;
+	void resetStatistics();
+
+	RetryPolicy retryPolicy() const;
+	void setRetryPolicy(const RetryPolicy &policy);
+
+	bool hedgingEnabled() const;
+	void setHedgingEnabled(bool enabled);
+	// Latency of the successful transfer, used to estimate the tail latency
+	void addLatencySample(qint64 latencyMs);
+	// Time after which the duplicate of the slow request is sent, i.e. p95 latency;
+	// -1 if hedging is disabled or there are not enough latency samples yet
+	qint64 hedgeDelayMs() const;
+
+	void registerRetry();
+	void registerHedge();
+	void registerHedgeWin();
+	quint64 retryCount() const;
+	quint64 hedgeCount() const;
+	// Count of the hedge requests finished before the original ones
+	quint64 hedgeWinCount() const;
+};
+
+#endif // __BFR_DOWNLOADSESSION_H__
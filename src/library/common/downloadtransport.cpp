@@ -0,0 +1,200 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "downloadtransport.h"
+
+#include <common/logger.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+namespace {
+const quint32 FixtureMagic = 0x42465254; // "BFRT"
+const quint32 FixtureVersion = 1;
+
+// Fixture file layout: magic, version, URL, completeness flag, HTTP code, timing, headers, body
+bool readFixture(const QString &filePath, const QString &urlStr, DownloadTransport::Fixture &fixture) {
+
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_12);
+
+	quint32 magic = 0;
+	quint32 version = 0;
+	stream >> magic >> version;
+	if ((magic != FixtureMagic) || (version != FixtureVersion))
+		return false;
+
+	qint32 httpCode = 0;
+	stream >> fixture.m_url >> fixture.m_complete >> httpCode >> fixture.m_ttfbUs >> fixture.m_totalUs;
+	stream >> fixture.m_headers >> fixture.m_body;
+	fixture.m_httpCode = httpCode;
+
+	// NOTE: protect from the hash collision
+	return (stream.status() == QDataStream::Ok) && (fixture.m_url == urlStr);
+}
+}
+
+DownloadTransport::DownloadTransport()
+	: m_mutex()
+	, m_fixtureDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/fixtures"))
+	, m_mode(Mode::Live)
+	, m_simulateLatency(false)
+	, m_recordedCount(0)
+	, m_replayedCount(0) {
+
+	const QString modeStr = QString::fromLocal8Bit(qgetenv("BFR_TRANSPORT_MODE"));
+	if (!modeStr.isEmpty()) {
+		const Mode mode = modeFromString(modeStr);
+		if (mode != Mode::Invalid)
+			m_mode = mode;
+		else
+			SystemLogger->error("Invalid transport mode '{}', live one will be used", modeStr);
+	}
+
+	const QString fixtureDirectory = QString::fromLocal8Bit(qgetenv("BFR_TRANSPORT_FIXTURES"));
+	if (!fixtureDirectory.isEmpty())
+		m_fixtureDirectory = fixtureDirectory;
+
+	m_simulateLatency = (qEnvironmentVariableIntValue("BFR_TRANSPORT_SIMULATE_LATENCY") != 0);
+
+	if (m_mode != Mode::Live)
+		SystemLogger->info("Download transport mode: {}, fixture directory: '{}'", modeStr, m_fixtureDirectory);
+}
+
+DownloadTransport &DownloadTransport::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created, it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static DownloadTransport instance;
+	return instance;
+}
+
+DownloadTransport::Mode DownloadTransport::modeFromString(const QString &modeStr) {
+
+	const QString mode = modeStr.trimmed().toLower();
+	if (mode == QLatin1String("live"))
+		return Mode::Live;
+	if (mode == QLatin1String("record"))
+		return Mode::Record;
+	if (mode == QLatin1String("replay"))
+		return Mode::Replay;
+	return Mode::Invalid;
+}
+
+DownloadTransport::Mode DownloadTransport::mode() const { return m_mode.load(std::memory_order_relaxed); }
+
+void DownloadTransport::setMode(Mode mode) {
+
+	Q_ASSERT(mode > Mode::Invalid && mode < Mode::Count);
+	m_mode.store(mode, std::memory_order_relaxed);
+}
+
+bool DownloadTransport::isRecording() const { return mode() == Mode::Record; }
+
+bool DownloadTransport::isReplaying() const { return mode() == Mode::Replay; }
+
+QString DownloadTransport::fixtureDirectory() const {
+
+	QMutexLocker locker(&m_mutex);
+	return m_fixtureDirectory;
+}
+
+void DownloadTransport::setFixtureDirectory(const QString &path) {
+
+	QMutexLocker locker(&m_mutex);
+	m_fixtureDirectory = path;
+}
+
+bool DownloadTransport::simulateLatency() const { return m_simulateLatency.load(std::memory_order_relaxed); }
+
+void DownloadTransport::setSimulateLatency(bool enabled) { m_simulateLatency.store(enabled, std::memory_order_relaxed); }
+
+QString DownloadTransport::fixtureFilePath(const QString &urlStr) const {
+
+	// NOTE: URL is hashed to get the valid file name of the fixed length
+	const QByteArray urlHash = QCryptographicHash::hash(urlStr.toUtf8(), QCryptographicHash::Sha1).toHex();
+	return m_fixtureDirectory + QLatin1Char('/') + QString::fromLatin1(urlHash);
+}
+
+bool DownloadTransport::load(const QString &urlStr, Fixture &fixture) {
+
+	QMutexLocker locker(&m_mutex);
+
+	if (!readFixture(fixtureFilePath(urlStr), urlStr, fixture)) {
+		SystemLogger->error("No fixture of URL '{}' in directory '{}'", urlStr, m_fixtureDirectory);
+		return false;
+	}
+
+	m_replayedCount.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool DownloadTransport::store(const Fixture &fixture) {
+
+	QMutexLocker locker(&m_mutex);
+
+	if (!QDir().mkpath(m_fixtureDirectory)) {
+		SystemLogger->error("Unable to create fixture directory '{}'", m_fixtureDirectory);
+		return false;
+	}
+
+	const QString filePath = fixtureFilePath(fixture.m_url);
+	if (!fixture.m_complete) {
+		Fixture existing;
+		if (readFixture(filePath, fixture.m_url, existing) && existing.m_complete)
+			return true;
+	}
+
+	// NOTE: QSaveFile replaces the old fixture atomically, so the reader will never see the partially written one
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly)) {
+		SystemLogger->error("Unable to write fixture '{}'", file.fileName());
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_12);
+	stream << FixtureMagic << FixtureVersion;
+	stream << fixture.m_url << fixture.m_complete << static_cast<qint32>(fixture.m_httpCode) << fixture.m_ttfbUs
+		   << fixture.m_totalUs;
+	stream << fixture.m_headers << fixture.m_body;
+	if ((stream.status() != QDataStream::Ok) || !file.commit()) {
+		SystemLogger->error("Unable to write fixture '{}'", file.fileName());
+		return false;
+	}
+
+	m_recordedCount.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+quint64 DownloadTransport::recordedCount() const { return m_recordedCount.load(std::memory_order_relaxed); }
+
+quint64 DownloadTransport::replayedCount() const { return m_replayedCount.load(std::memory_order_relaxed); }
@@ -0,0 +1,114 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_DOWNLOADTRANSPORT_H__
+#define __BFR_DOWNLOADTRANSPORT_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <atomic>
+
+// Transport of the FileDownloader requests, to make the tests and benchmarks reproducible without network:
+// - live: pages are downloaded from network, as usual;
+// - record: pages are downloaded from network, and every response (status, headers, body, timing)
+//   is written to the fixture directory;
+// - replay: pages are served from the fixture directory, network is not used at all;
+//   recorded latency of every response can be simulated optionally.
+// Initial settings are taken from the environment variables:
+// BFR_TRANSPORT_MODE=live|record|replay, BFR_TRANSPORT_FIXTURES=<directory>, BFR_TRANSPORT_SIMULATE_LATENCY=1
+class DownloadTransport {
+	// Delete copy and move constructors and assign operators
+	DownloadTransport(DownloadTransport const &) = delete; // Copy construct
+	DownloadTransport(DownloadTransport &&) = delete; // Move construct
+	DownloadTransport &operator=(DownloadTransport const &) = delete; // Copy assign
+	DownloadTransport &operator=(DownloadTransport &&) = delete; // Move assign
+
+public:
+	enum class Mode {
+		Invalid = -1,
+		Live = 0,
+		Record,
+		Replay,
+		Count
+	};
+
+	struct Fixture {
+		QString m_url;
+		int m_httpCode = 0;
+		// Raw response header lines
+		QByteArray m_headers;
+		QByteArray m_body;
+		// NOTE: transfer aborted by the page probe has incomplete body,
+		//       so such a fixture can be used to replay the probe only
+		bool m_complete = true;
+		qint64 m_ttfbUs = -1;
+		qint64 m_totalUs = -1;
+	};
+
+	// Replayed body is fed to the page stream by chunks, like the network one
+	static const int ReplayChunkSize = 16 * 1024;
+
+protected:
+	mutable QMutex m_mutex;
+	QString m_fixtureDirectory;
+	std::atomic<Mode> m_mode;
+	std::atomic<bool> m_simulateLatency;
+
+	std::atomic<quint64> m_recordedCount;
+	std::atomic<quint64> m_replayedCount;
+
+	DownloadTransport();
+	~DownloadTransport() = default;
+
+	QString fixtureFilePath(const QString &urlStr) const;
+
+public:
+	static DownloadTransport &globalInstance();
+
+	static Mode modeFromString(const QString &modeStr);
+
+public:
+	Mode mode() const;
+	void setMode(Mode mode);
+	bool isRecording() const;
+	bool isReplaying() const;
+
+	// Default is the "fixtures" subdirectory of the application cache directory
+	QString fixtureDirectory() const;
+	void setFixtureDirectory(const QString &path);
+
+	// Whether replay waits for the recorded time to first byte and transfer time
+	bool simulateLatency() const;
+	void setSimulateLatency(bool enabled);
+
+	bool load(const QString &urlStr, Fixture &fixture);
+	// NOTE: incomplete fixture never replaces the complete one of the same URL
+	bool store(const Fixture &fixture);
+
+	quint64 recordedCount() const;
+	quint64 replayedCount() const;
+};
+
+#endif // __BFR_DOWNLOADTRANSPORT_H__
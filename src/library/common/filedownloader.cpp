@@ -22,43 +22,370 @@
  * SOFTWARE.
 */
 #include "filedownloader.h"
+#include "downloadsession.h"
+#include "httpcache.h"
+#include "crawlthrottle.h"
+#include "downloadscheduler.h"
+#include "transfermetrics.h"
+#include "downloadtransport.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
 
-#ifndef USE_QT_NAM
-#include <curl/curl.h>
+#ifdef USE_QT_NAM
+#include <QtNetwork/QSslConfiguration>
+#else
+#include "curlsocketloop.h"
 
-const char *FileDownloader::CACertificatesPath { /*"/system/etc/security/cacerts_google"*/ "/system/etc/security/cacerts" };
+#include <curl/curl.h>
 #endif
 
+#include <algorithm>
+#include <memory>
+
 namespace {
 static const char *bfrUserAgent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/51.0.2704.103 Safari/537.36";
+#if !defined(USE_QT_NAM) && defined(Q_OS_ANDROID)
+static const char *CACertificatesPath { /*"/system/etc/security/cacerts_google"*/ "/system/etc/security/cacerts" };
+#endif
+// How often the cancellation token is checked while waiting
+static const int CancellationPollIntervalMs = 50;
+
+// Sleep for the specified time, waking up as soon as the token is cancelled
+void sleepCancellable(qint64 delayMs, const CancellationToken &token) {
+
+	QElapsedTimer timer;
+	timer.start();
+	while (!token.isCancelled() && (timer.elapsed() < delayMs)) {
+		const qint64 remainingMs = qMin<qint64>(delayMs - timer.elapsed(), CancellationPollIntervalMs);
+		if (remainingMs > 0)
+			QThread::msleep(static_cast<unsigned long>(remainingMs));
+	}
 }
 
-FileDownloader::FileDownloader(QObject *parent)
-	: QObject(parent)
-	, m_nm(new QNetworkAccessManager(this))
-	, m_reply(nullptr)
-	, m_progressCb(nullptr)
-	, m_downloadedData()
-	, m_lastError(result_code::Type::Invalid) { }
+// Serve the empty 304 response body from the HTTP cache, or put the new page contents there
+bool applyHttpCache(const QString &urlStr, int httpCode, const HttpCache::Validators &validators, HtmlPageStream &page) {
+
+	HttpCache &cache = HttpCache::globalInstance();
+	if (httpCode == 304) {
+		QByteArray body;
+		if (!cache.load(urlStr, body))
+			return false;
+
+		page.clear();
+		page.append(body.constData(), body.size());
+		return true;
+	}
+
+	if (httpCode == 200)
+		cache.store(urlStr, page.rawData(), validators);
+	return true;
+}
+
+// Write the response to the fixture directory, if the transport is in the record mode
+void recordFixture(const QString &urlStr, int httpCode, const QByteArray &headers, const HtmlPageStream &page,
+	bool complete, qint64 ttfbUs, qint64 totalUs) {
+
+	DownloadTransport &transport = DownloadTransport::globalInstance();
+	if (!transport.isRecording())
+		return;
+
+	DownloadTransport::Fixture fixture;
+	fixture.m_url = urlStr;
+	fixture.m_httpCode = httpCode;
+	fixture.m_headers = headers;
+	fixture.m_body = page.rawData();
+	fixture.m_complete = complete;
+	fixture.m_ttfbUs = ttfbUs;
+	fixture.m_totalUs = totalUs;
+	transport.store(fixture);
+}
+
+void recordReplayTiming(const DownloadTransport::Fixture &fixture, qint64 ttfbUs, qint64 totalUs, qint64 bytesDecoded) {
+
+	TransferTiming timing;
+	timing.m_url = fixture.m_url;
+	timing.m_ok = true;
+	timing.m_httpCode = fixture.m_httpCode;
+	timing.m_reusedConnection = true;
+	timing.m_ttfbUs = ttfbUs;
+	timing.m_transferUs = (ttfbUs >= 0) ? qMax<qint64>(0, totalUs - ttfbUs) : -1;
+	timing.m_totalUs = totalUs;
+	timing.m_bytesReceived = fixture.m_body.size();
+	timing.m_bytesDecoded = bytesDecoded;
+	TransferMetrics::globalInstance().record(timing);
+}
+
+// Sleep until the specified time since the timer start
+void sleepUntilUs(const QElapsedTimer &timer, qint64 timeUs) {
+
+	const qint64 remainingUs = timeUs - timer.nsecsElapsed() / 1000;
+	if (remainingUs > 0)
+		QThread::usleep(static_cast<unsigned long>(remainingUs));
+}
+
+// Serve the page from the fixture by chunks, calling the progress and probe callbacks as the network transfer does;
+// with latency simulation, chunks are delivered at the recorded pace
+bool replayUrl(const QString &urlStr, HtmlPageStream &page, const FileDownloader::ProgressCallback &progressCb,
+	const FileDownloader::ProbeCallback *probeCb, bool *probeMatched, const CancellationToken &token) {
+
+	page.clear();
+	if (probeMatched)
+		*probeMatched = false;
+
+	DownloadTransport &transport = DownloadTransport::globalInstance();
+	DownloadTransport::Fixture fixture;
+	if (!transport.load(urlStr, fixture))
+		return false;
+
+	const bool simulateLatency = transport.simulateLatency();
+	const qint64 recordedTtfbUs = qMax<qint64>(0, fixture.m_ttfbUs);
+	const qint64 recordedTransferUs = qMax<qint64>(0, fixture.m_totalUs - recordedTtfbUs);
+
+	QElapsedTimer timer;
+	timer.start();
+	if (simulateLatency)
+		sleepUntilUs(timer, recordedTtfbUs);
+	const qint64 ttfbUs = timer.nsecsElapsed() / 1000;
+
+	bool matched = false;
+	const QByteArray &body = fixture.m_body;
+	for (int offset = 0; offset < body.size(); offset += DownloadTransport::ReplayChunkSize) {
+		const int chunkSize = qMin(DownloadTransport::ReplayChunkSize, body.size() - offset);
+		if (simulateLatency)
+			sleepUntilUs(timer, recordedTtfbUs + recordedTransferUs * (offset + chunkSize) / body.size());
+		if (token.isCancelled()) {
+			page.clear();
+			return false;
+		}
+
+		page.append(body.constData() + offset, chunkSize);
+		if (progressCb)
+			progressCb(offset + chunkSize, body.size(), page.size());
+		if (probeCb && *probeCb && (*probeCb)(page.rawData(), offset)) {
+			matched = true;
+			break;
+		}
+	}
+	if (probeMatched)
+		*probeMatched = matched;
+
+	// NOTE: incomplete fixture was recorded by the probe, so it's not enough for anything else
+	if (!fixture.m_complete && !matched) {
+		SystemLogger->error("Fixture of URL '{}' is incomplete", urlStr);
+		page.clear();
+		return false;
+	}
+	if (!matched)
+		page.finish();
+
+	recordReplayTiming(fixture, ttfbUs, timer.nsecsElapsed() / 1000, page.size());
+	return true;
+}
+
+// Serve all the pages from the fixtures; with latency simulation, the pages are delivered in the order
+// and at the time they would be finished by maxParallel concurrent transfers
+bool replayUrls(const QStringList &urlStrs, int maxParallel, const FileDownloader::UrlFinishedCallback &urlCb,
+	const CancellationToken &token) {
+
+	DownloadTransport &transport = DownloadTransport::globalInstance();
+	const bool simulateLatency = transport.simulateLatency();
+
+	struct Completion {
+		qint64 m_finishUs;
+		int m_index;
+	};
+
+	QVector<DownloadTransport::Fixture> fixtures(urlStrs.size());
+	QVector<bool> loaded(urlStrs.size(), false);
+	QVector<Completion> completions;
+	completions.reserve(urlStrs.size());
+	QVector<qint64> slotFreeUs(maxParallel, 0);
+	for (int i = 0; i < urlStrs.size(); ++i) {
+		loaded[i] = transport.load(urlStrs[i], fixtures[i]) && fixtures[i].m_complete;
+
+		// NOTE: the next request is started in the slot which becomes free first
+		auto slot = std::min_element(slotFreeUs.begin(), slotFreeUs.end());
+		if (simulateLatency && loaded[i])
+			*slot += qMax<qint64>(0, fixtures[i].m_totalUs);
+		completions.append({ *slot, i });
+	}
+	std::stable_sort(completions.begin(), completions.end(),
+		[](const Completion &first, const Completion &second) { return first.m_finishUs < second.m_finishUs; });
+
+	QElapsedTimer timer;
+	timer.start();
+
+	bool allSucceeded = true;
+	HtmlPageStream page;
+	for (const Completion &completion : qAsConst(completions)) {
+		sleepUntilUs(timer, completion.m_finishUs);
+		if (token.isCancelled())
+			return false;
+
+		const int index = completion.m_index;
+		const DownloadTransport::Fixture &fixture = fixtures[index];
+		page.clear();
+		if (loaded[index]) {
+			page.append(fixture.m_body.constData(), fixture.m_body.size());
+			page.finish();
+			recordReplayTiming(fixture, -1, qMax<qint64>(0, fixture.m_totalUs), page.size());
+		} else {
+			SystemLogger->error("No complete fixture of URL '{}'", urlStrs[index]);
+			allSucceeded = false;
+		}
+
+		if (urlCb)
+			urlCb(index, urlStrs[index], loaded[index], page);
+	}
+	return allSucceeded;
+}
+
+#ifdef USE_QT_NAM
+// NOTE: network access manager disk cache is used instead of HttpCache, if it's present
+bool hasNetworkCache(const QNetworkAccessManager *nm) { return nm && nm->cache(); }
+
+QNetworkRequest makeNetworkRequest(const QUrl &url, const QNetworkAccessManager *nm) {
+	QNetworkRequest request;
+	request.setUrl(url);
+	request.setRawHeader("User-Agent", bfrUserAgent);
+	// NOTE: Accept-Encoding header must not be set manually: otherwise Qt will not decompress the response;
+	//       by default Qt requests "gzip, deflate" and decompresses the reply on the fly (Qt 5 has no brotli support)
+
+	if (hasNetworkCache(nm)) {
+		// NOTE: the cached page is always revalidated with the conditional request, and 304 response is served from disk
+		request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+	} else {
+		const HttpCache::Validators validators = HttpCache::globalInstance().validators(url.toString());
+		if (!validators.m_etag.isEmpty())
+			request.setRawHeader("If-None-Match", validators.m_etag);
+		if (!validators.m_lastModified.isEmpty())
+			request.setRawHeader("If-Modified-Since", validators.m_lastModified);
+	}
+
+	// NOTE: HTTP/2 is negotiated using ALPN, Qt falls back to HTTP/1.1 if server does not support it;
+	//       all the concurrent requests to the same host are multiplexed over the single connection
+	request.setAttribute(QNetworkRequest::Http2AllowedAttribute, DownloadSession::globalInstance().http2Enabled());
+	return request;
+}
+
+bool http2WasUsed(const QNetworkReply *reply) { return reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool(); }
+
+bool applyHttpCache(QNetworkReply *reply, HtmlPageStream &page) {
+
+	if (hasNetworkCache(reply->manager())) {
+		if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool())
+			HttpCache::globalInstance().registerRevalidated();
+		return true;
+	}
+
+	HttpCache::Validators validators;
+	validators.m_etag = reply->rawHeader("ETag");
+	validators.m_lastModified = reply->rawHeader("Last-Modified");
+
+	const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	return applyHttpCache(reply->request().url().toString(), httpCode, validators, page);
+}
+
+// Feed the crawl throttle with the response code and time to first byte
+void reportCrawlResult(const QNetworkReply *reply, bool ok, qint64 ttfbMs) {
+
+	const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	CrawlThrottle::globalInstance().reportResult(reply->request().url(), ok, httpCode, ttfbMs);
+}
+
+// NOTE: Qt network access manager does not report DNS, connect and TLS times
+void recordTransferTiming(const QNetworkReply *reply, bool ok, bool reusedConnection, qint64 ttfbUs, qint64 totalUs,
+	qint64 bytesReceived, qint64 bytesDecoded) {
+
+	TransferTiming timing;
+	timing.m_url = reply->request().url().toString();
+	timing.m_ok = ok;
+	timing.m_httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	timing.m_reusedConnection = reusedConnection;
+	timing.m_ttfbUs = ttfbUs;
+	timing.m_transferUs = (ttfbUs >= 0) ? qMax<qint64>(0, totalUs - ttfbUs) : -1;
+	timing.m_totalUs = totalUs;
+	timing.m_bytesReceived = bytesReceived;
+	timing.m_bytesDecoded = bytesDecoded;
+	TransferMetrics::globalInstance().record(timing);
+}
+
+void recordReplyFixture(const QNetworkReply *reply, const HtmlPageStream &page, bool complete, qint64 ttfbUs, qint64 totalUs) {
+
+	if (!DownloadTransport::globalInstance().isRecording())
+		return;
+
+	QByteArray headers;
+	for (const auto &header : reply->rawHeaderPairs())
+		headers += header.first + ": " + header.second + "\r\n";
+
+	const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	recordFixture(reply->request().url().toString(), httpCode, headers, page, complete, ttfbUs, totalUs);
+}
+
+// Network failures and server overload are worth retrying, unlike e.g. invalid URL or 404 response
+bool isTransientNetworkError(const QNetworkReply *reply) {
+
+	switch (reply->error()) {
+	case QNetworkReply::RemoteHostClosedError:
+	case QNetworkReply::HostNotFoundError:
+	case QNetworkReply::TimeoutError:
+	case QNetworkReply::SslHandshakeFailedError:
+	case QNetworkReply::TemporaryNetworkFailureError:
+	case QNetworkReply::NetworkSessionFailedError:
+	case QNetworkReply::ProxyConnectionClosedError:
+	case QNetworkReply::ProxyTimeoutError:
+	case QNetworkReply::ServiceUnavailableError:
+	case QNetworkReply::UnknownNetworkError:
+		return true;
+	default:
+		break;
+	}
+
+	const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	return RetryPolicy::isTransientHttpCode(httpCode);
+}
+#endif
+}
 
 // Async API
 
 #ifndef USE_QT_NAM
 namespace {
+// NOTE: libcurl reports the compressed bytes received from network,
+//       and the page buffer size is the count of already decompressed ones
+struct ProgressContext {
+	FileDownloader *m_downloader = nullptr;
+	FileDownloader::ProgressCallback *m_progressCb = nullptr;
+	const HtmlPageStream *m_page = nullptr;
+	const CancellationToken *m_token = nullptr;
+};
+
+// NOTE: non-zero return value of the progress callback makes libcurl to abort the transfer with CURLE_ABORTED_BY_CALLBACK
+bool isTransferCancelled(const ProgressContext *progress) {
+	return progress && progress->m_token && progress->m_token->isCancelled();
+}
+
 int downloadFileProgressCallback(
 	void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
 	Q_UNUSED(ultotal);
 	Q_UNUSED(ulnow);
 
-	FileDownloader *thisObj = reinterpret_cast<FileDownloader *>(clientp);
-	Q_ASSERT(thisObj);
+	ProgressContext *progress = reinterpret_cast<ProgressContext *>(clientp);
+	Q_ASSERT(progress && progress->m_downloader && progress->m_page);
+	if (isTransferCancelled(progress))
+		return 1;
 
 	if (dltotal > 0 || dlnow > 0) {
+		const qint64 bytesDecoded = progress->m_page->size();
 #ifdef BFR_PRINT_DEBUG_OUTPUT
-		SystemLogger->info("Download progress: {} of {} bytes", dlnow, dltotal);
+		SystemLogger->info("Download progress: {} of {} bytes, {} bytes decoded", dlnow, dltotal, bytesDecoded);
 #endif
 
-		emit thisObj->downloadProgress(dlnow, dltotal);
+		emit progress->m_downloader->downloadProgress(dlnow, dltotal, bytesDecoded);
 	}
 	return CURLE_OK;
 }
@@ -68,134 +395,635 @@ int downloadFileProgressCallback_2(
 	Q_UNUSED(ultotal);
 	Q_UNUSED(ulnow);
 
+	ProgressContext *progress = reinterpret_cast<ProgressContext *>(clientp);
+	Q_ASSERT(progress && progress->m_page);
+	if (isTransferCancelled(progress))
+		return 1;
+
 	if (dltotal > 0 || dlnow > 0) {
+		const qint64 bytesDecoded = progress->m_page->size();
 #ifdef BFR_PRINT_DEBUG_OUTPUT
-		SystemLogger->info("Download progress: {} of {} bytes", dlnow, dltotal);
+		SystemLogger->info("Download progress: {} of {} bytes, {} bytes decoded", dlnow, dltotal, bytesDecoded);
 #endif
 
-		if (clientp) {
-			FileDownloader::ProgressCallback *progressCb
-				= reinterpret_cast<FileDownloader::ProgressCallback *>(clientp);
-			if (*progressCb)
-				(*progressCb)(dlnow, dltotal);
-		}
+		if (progress->m_progressCb && *progress->m_progressCb)
+			(*progress->m_progressCb)(dlnow, dltotal, bytesDecoded);
 	}
 	return CURLE_OK;
 }
 
-size_t downloadFileWriteCallback(void *ptr, size_t size, size_t nmemb, QByteArray *data) {
-	QCoreApplication::processEvents();
-
-	data->append((char *)ptr, (int)(size * nmemb));
+// NOTE: chunk goes straight to the page buffer (and the transcoder), without event loop pumping
+size_t downloadFileWriteCallback(char *ptr, size_t size, size_t nmemb, HtmlPageStream *page) {
+	page->append(ptr, static_cast<int>(size * nmemb));
 	return size * nmemb;
 }
 
-QByteArray downloadFileAsync(QString urlStr, FileDownloader* thisObj, QByteArray& resultData, result_code::Type& resultCode)
-{
-#ifdef BFR_PRINT_DEBUG_OUTPUT
-	SystemLogger->info("libcurl version: {}", LIBCURL_VERSION);
-#endif
+struct ProbeContext {
+	HtmlPageStream *m_page = nullptr;
+	const FileDownloader::ProbeCallback *m_probeCb = nullptr;
+	bool m_matched = false;
+};
 
-	// FIXME: curl_global_init is not thread-safe, so call it manually
-	//        to prevent automatic call from curl_easy_init;
-	//        ensure what such call prevent from multi-threading problems!
-	CURLcode result = curl_global_init(CURL_GLOBAL_ALL);
-	if (result != CURLE_OK) {
-		SystemLogger->error("curl_global_init() failed");
-		SystemLogger->error("Error code: {}", result);
-		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+// NOTE: returning the value different from the chunk size makes libcurl to abort the transfer
+size_t probeWriteCallback(char *ptr, size_t size, size_t nmemb, ProbeContext *probe) {
+	const int offset = probe->m_page->size();
+	probe->m_page->append(ptr, static_cast<int>(size * nmemb));
 
-		resultCode = result_code::Type::CurlError;
-		emit thisObj->downloadFailed(result_code::Type::NetworkError);
-		return QByteArray();
+	if ((*probe->m_probeCb) && (*probe->m_probeCb)(probe->m_page->rawData(), offset)) {
+		probe->m_matched = true;
+		return 0;
 	}
+	return size * nmemb;
+}
+
+size_t downloadFileHeaderCallback(char *ptr, size_t size, size_t nmemb, QByteArray *header) {
+	header->append(ptr, static_cast<int>(size * nmemb));
+	return size * nmemb;
+}
 
-	CURL *curl = curl_easy_init();
-	if (!curl) {
-		SystemLogger->error("curl_easy_init() failed");
+// NOTE: headers of all the redirect responses are collected, so only the last response ones are used
+HttpCache::Validators parseCacheValidators(const QByteArray &header) {
 
-		resultCode = result_code::Type::CurlError;
-		emit thisObj->downloadFailed(result_code::Type::NetworkError);
-		return QByteArray();
+	HttpCache::Validators result;
+
+	const QList<QByteArray> lines = header.split('\n');
+	for (const QByteArray &line : lines) {
+		if (line.startsWith("HTTP/")) {
+			result = HttpCache::Validators();
+			continue;
+		}
+
+		const int colonIdx = line.indexOf(':');
+		if (colonIdx <= 0)
+			continue;
+
+		// NOTE: header names are case-insensitive, and HTTP/2 ones are always lowercase
+		const QByteArray name = line.left(colonIdx).trimmed().toLower();
+		if (name == "etag")
+			result.m_etag = line.mid(colonIdx + 1).trimmed();
+		else if (name == "last-modified")
+			result.m_lastModified = line.mid(colonIdx + 1).trimmed();
 	}
+	return result;
+}
+
+// Conditional request headers with validators of the cached page; must be freed by caller
+curl_slist *makeCacheRequestHeaders(const QString &urlStr) {
+
+	const HttpCache::Validators validators = HttpCache::globalInstance().validators(urlStr);
+
+	curl_slist *headers = nullptr;
+	if (!validators.m_etag.isEmpty())
+		headers = curl_slist_append(headers, QByteArray("If-None-Match: " + validators.m_etag).constData());
+	if (!validators.m_lastModified.isEmpty())
+		headers = curl_slist_append(headers, QByteArray("If-Modified-Since: " + validators.m_lastModified).constData());
+	return headers;
+}
+
+// Feed the crawl throttle with the response code and time to first byte;
+// NOTE: time to first byte does not depend on the page size, unlike the total transfer time
+void reportCrawlResult(CURL *curl, const QString &urlStr, bool ok) {
+
+	long httpCode = 0;
+	curl_off_t ttfbUs = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfbUs);
+	CrawlThrottle::globalInstance().reportResult(QUrl(urlStr), ok, static_cast<int>(httpCode), ttfbUs / 1000);
+}
+
+// NOTE: libcurl reports the cumulative times since the transfer start, so they are converted to the phase durations
+void recordTransferTiming(CURL *curl, const QString &urlStr, bool ok, qint64 bytesDecoded) {
+
+	long httpCode = 0;
+	long connectCount = 0;
+	curl_off_t nameLookupUs = 0;
+	curl_off_t connectUs = 0;
+	curl_off_t appConnectUs = 0;
+	curl_off_t startTransferUs = 0;
+	curl_off_t totalUs = 0;
+	curl_off_t bytesReceived = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connectCount);
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &nameLookupUs);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connectUs);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnectUs);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &startTransferUs);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &totalUs);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytesReceived);
+
+	TransferTiming timing;
+	timing.m_url = urlStr;
+	timing.m_ok = ok;
+	timing.m_httpCode = static_cast<int>(httpCode);
+	timing.m_reusedConnection = (connectCount == 0);
+	timing.m_dnsUs = nameLookupUs;
+	timing.m_connectUs = qMax<qint64>(0, connectUs - nameLookupUs);
+	// NOTE: APPCONNECT time is zero for plain HTTP
+	timing.m_tlsUs = (appConnectUs > 0) ? qMax<qint64>(0, appConnectUs - connectUs) : 0;
+	timing.m_ttfbUs = startTransferUs;
+	timing.m_transferUs = (startTransferUs > 0) ? qMax<qint64>(0, totalUs - startTransferUs) : -1;
+	timing.m_totalUs = totalUs;
+	timing.m_bytesReceived = bytesReceived;
+	timing.m_bytesDecoded = bytesDecoded;
+	TransferMetrics::globalInstance().record(timing);
+}
+
+void recordCurlFixture(CURL *curl, const QString &urlStr, const QByteArray &header, const HtmlPageStream &page, bool complete) {
+
+	long httpCode = 0;
+	curl_off_t startTransferUs = 0;
+	curl_off_t totalUs = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &startTransferUs);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &totalUs);
+	recordFixture(urlStr, static_cast<int>(httpCode), header, page, complete, startTransferUs, totalUs);
+}
+
+bool applyHttpCache(CURL *curl, const QString &urlStr, const QByteArray &header, HtmlPageStream &page) {
+
+	long httpCode = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+	return applyHttpCache(urlStr, static_cast<int>(httpCode), parseCacheValidators(header), page);
+}
+
+// Set the options common for all the forum page downloads
+bool setupCurlHandle(CURL *curl, const QString &urlStr, HtmlPageStream *page, QByteArray *header,
+	curl_slist *requestHeaders, curl_xferinfo_callback progressFunc, void *progressData) {
 
 	curl_easy_setopt(curl, CURLOPT_URL, urlStr.toLocal8Bit().constData());
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, CURL_TRUE);
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, CURL_TRUE);
 
-	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, downloadFileProgressCallback);
-	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, thisObj);
+	if (progressFunc) {
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressFunc);
+		curl_easy_setopt(curl, CURLOPT_XFERINFODATA, progressData);
+	}
 
 	//    curl_easy_setopt(curl, CURLOPT_USERPWD, "user:pass");
-	curl_easy_setopt(curl, bfrUserAgent);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, bfrUserAgent);
+	// NOTE: empty string means all the encodings libcurl was built with (gzip, deflate, br, zstd),
+	//       response is decompressed on the fly, before the write callback
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
 	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
 
-	QByteArray response_string;
-	QByteArray header_string;
+	// NOTE: DNS results, TLS sessions and connections are shared by all the threads, see DownloadSession
+	if (CURLSH *share = DownloadSession::globalInstance().shareHandle())
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+	// NOTE: CURL_HTTP_VERSION_2TLS falls back to HTTP/1.1 if server does not negotiate HTTP/2 using ALPN;
+	//       CURLOPT_PIPEWAIT makes the parallel transfers wait for the first connection to be established
+	//       and reuse it for multiplexing instead of opening the new ones
+	if (DownloadSession::globalInstance().http2Enabled()) {
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+	}
+
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, downloadFileWriteCallback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &header_string);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, page);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, downloadFileHeaderCallback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, header);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders);
 
 	// FIXME HACK: need corect cert stuff setup instead of ignoring them
 #ifdef Q_OS_ANDROID
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CURL_FALSE);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, CURL_FALSE);
+	//curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CURL_FALSE);
+	//curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, CURL_FALSE);
+
+	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1) != CURLE_OK, false, "setting CURLOPT_SSL_VERIFYPEER failed");
+	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2) != CURLE_OK, false, "setting CURLOPT_SSL_VERIFYHOST failed");
+	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_CAPATH, CACertificatesPath) != CURLE_OK, false, "setting CURLOPT_CAPATH failed");
 #endif
+	return true;
+}
+
+// Network failures and server overload are worth retrying, unlike e.g. invalid URL or 404 response
+bool isTransientCurlError(CURL *curl, CURLcode result) {
+
+	switch (result) {
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_PARTIAL_FILE:
+	case CURLE_HTTP2:
+	case CURLE_HTTP2_STREAM:
+		return true;
+	case CURLE_HTTP_RETURNED_ERROR: {
+		long httpCode = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+		return RetryPolicy::isTransientHttpCode(static_cast<int>(httpCode));
+	}
+	default:
+		return false;
+	}
+}
+
+// Download the specified URL using the easy handle of the calling thread;
+// the handle (and so the connection to the forum host) is kept alive after the transfer
+bool performCurlAttempt(const QString &urlStr, HtmlPageStream &page, curl_xferinfo_callback progressFunc,
+	ProgressContext *progress, ProbeContext *probe, bool &transient) {
+
+	page.clear();
+	transient = false;
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	if (!session.isValid()) {
+		SystemLogger->error("libcurl was not initialized");
+		return false;
+	}
+
+	CURL *curl = session.threadHandle();
+	if (!curl)
+		return false;
+
+	QByteArray header_string;
+	std::unique_ptr<curl_slist, decltype(&curl_slist_free_all)> requestHeaders(
+		makeCacheRequestHeaders(urlStr), &curl_slist_free_all);
+	if (progress)
+		progress->m_page = &page;
+	if (!setupCurlHandle(curl, urlStr, &page, &header_string, requestHeaders.get(), progressFunc, progress))
+		return false;
+	if (probe) {
+		probe->m_page = &page;
+		probe->m_matched = false;
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probeWriteCallback);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, probe);
+	}
 
-	result = curl_easy_perform(curl);
+	const CancellationToken token = (progress && progress->m_token) ? *progress->m_token : CancellationToken();
+	if (!CrawlThrottle::globalInstance().waitForSlot(QUrl(urlStr), token))
+		return false;
+
+	CURLcode result = curl_easy_perform(curl);
+	session.registerTransfer(curl);
+	if ((result == CURLE_ABORTED_BY_CALLBACK) && isTransferCancelled(progress)) {
+		// NOTE: cancelled transfer says nothing about the server, so it is not reported to the crawl throttle
+		SystemLogger->info("Download of URL '{}' was cancelled", urlStr);
+		page.clear();
+		return false;
+	}
+	reportCrawlResult(curl, urlStr, (result == CURLE_OK) || (probe && probe->m_matched));
+	recordTransferTiming(curl, urlStr, (result == CURLE_OK) || (probe && probe->m_matched), page.size());
+	if ((result == CURLE_WRITE_ERROR) && probe && probe->m_matched) {
+		// Transfer was aborted by the probe: page is incomplete, but it's enough for the caller
+		recordCurlFixture(curl, urlStr, header_string, page, false);
+		return true;
+	}
 	if (result != CURLE_OK) {
 		SystemLogger->error("curl_easy_perform() failed");
 		SystemLogger->error("Error code: {}", result);
 		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
 
-		resultCode = result_code::Type::NetworkError;
-		emit thisObj->downloadFailed(result_code::Type::NetworkError);
-		return QByteArray();
+		transient = isTransientCurlError(curl, result);
+		page.clear();
+		return false;
 	}
+	if (!applyHttpCache(curl, urlStr, header_string, page)) {
+		page.clear();
+		return false;
+	}
+	page.finish();
+	recordCurlFixture(curl, urlStr, header_string, page, true);
 
 #ifdef BFR_PRINT_DEBUG_OUTPUT
 	char *url;
 	long response_code;
-	double elapsed;
+	long connectCount;
 	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &elapsed);
 	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connectCount);
 
 	SystemLogger->info("libcurl response:");
-	SystemLogger->info("Elapsed time: {}", elapsed);
+	// NOTE: timing breakdown is printed by TransferMetrics
 	SystemLogger->info("Redirected URL: {}", url);
 	SystemLogger->info("Response code: {}", response_code);
+	SystemLogger->info("New connections: {}", connectCount);
 	SystemLogger->info("Response header: {}", header_string.toStdString());
-	SystemLogger->info("Response string: {}", response_string.toStdString());
+	SystemLogger->info("Response string: {}", page.rawData().toStdString());
 #endif
 
-	curl_easy_cleanup(curl);
-	curl = NULL;
+	return true;
+}
+
+// Open the connection to the host of the specified URL ahead of time: DNS result, TLS session
+// and the connection itself are kept in the share handle for the following downloads;
+// HEAD request is used, so the page itself is not downloaded
+bool performCurlWarmUp(const QString &urlStr) {
 
-	resultData = response_string;
-	resultCode = result_code::Type::NetworkError;
-	emit thisObj->downloadFinished();
-	return response_string;
+	DownloadSession &session = DownloadSession::globalInstance();
+	if (!session.isValid()) {
+		SystemLogger->error("libcurl was not initialized");
+		return false;
+	}
+
+	CURL *curl = session.threadHandle();
+	if (!curl)
+		return false;
+
+	HtmlPageStream page(HtmlPageStream::Mode::Raw, 0);
+	QByteArray header;
+	if (!setupCurlHandle(curl, urlStr, &page, &header, nullptr, nullptr, nullptr))
+		return false;
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+
+	CrawlThrottle::globalInstance().waitForSlot(QUrl(urlStr));
+	CURLcode result = curl_easy_perform(curl);
+	session.registerTransfer(curl);
+	if (result != CURLE_OK) {
+		SystemLogger->error("Connection warm-up to URL '{}' failed", urlStr);
+		SystemLogger->error("Error code: {}", result);
+		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+		return false;
+	}
+	return true;
 }
+
+// Download the specified URL, retrying the transient failures with the backoff delay
+bool performCurlDownload(const QString &urlStr, HtmlPageStream &page, curl_xferinfo_callback progressFunc,
+	ProgressContext *progress, ProbeContext *probe = nullptr) {
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	const RetryPolicy retryPolicy = session.retryPolicy();
+
+	for (int attempt = 1;; ++attempt) {
+		bool transient = false;
+		if (performCurlAttempt(urlStr, page, progressFunc, progress, probe, transient))
+			return true;
+		if (!transient || (attempt >= retryPolicy.m_maxAttempts) || isTransferCancelled(progress))
+			return false;
+
+		const qint64 delayMs = retryPolicy.backoffDelayMs(attempt);
+		SystemLogger->info("Retrying download of URL '{}' in {} ms (attempt {} of {})", urlStr, delayMs, attempt + 1,
+			retryPolicy.m_maxAttempts);
+		session.registerRetry();
+		if (progress && progress->m_token)
+			sleepCancellable(delayMs, *progress->m_token);
+		else
+			QThread::msleep(static_cast<unsigned long>(delayMs));
+	}
 }
+
+// State of the single multi handle transfer
+struct CurlTransfer {
+	CURL *m_curl = nullptr;
+	DownloadScheduler::Request m_request;
+	HtmlPageStream m_page;
+	QByteArray m_header;
+	curl_slist *m_requestHeaders = nullptr;
+};
+
+bool performCurlBatchDownload(const QStringList &urlStrs, int maxParallel, FileDownloader::UrlFinishedCallback urlCb,
+	const CancellationToken &token) {
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	if (!session.isValid()) {
+		SystemLogger->error("libcurl was not initialized");
+		return false;
+	}
+
+	CURLM *multi = session.threadMultiHandle();
+	if (!multi)
+		return false;
+
+	// HTTP/2: send all the requests as streams of one connection;
+	// HTTP/1.1: use up to maxParallel keep-alive connections
+	const bool http2 = session.http2Enabled();
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(maxParallel));
+
+	// NOTE: hedge requests use the same transfer slots
+	std::vector<CurlTransfer> transfers(static_cast<size_t>(maxParallel));
+	QVector<CurlTransfer *> idleTransfers;
+	for (auto &transfer : transfers)
+		idleTransfers << &transfer;
+
+	DownloadScheduler scheduler(urlStrs, maxParallel);
+
+	// Return the transfer slot back to the idle ones
+	auto releaseTransfer = [&](CurlTransfer *transfer) {
+		if (transfer->m_curl) {
+			curl_multi_remove_handle(multi, transfer->m_curl);
+			session.releaseTransferHandle(transfer->m_curl);
+			transfer->m_curl = nullptr;
+		}
+		curl_slist_free_all(transfer->m_requestHeaders);
+		transfer->m_requestHeaders = nullptr;
+
+		transfer->m_request = DownloadScheduler::Request();
+		transfer->m_page.clear();
+		transfer->m_header.clear();
+		idleTransfers << transfer;
+	};
+
+	// Report the URL download result, or schedule the retry
+	auto finishTransfer = [&](CurlTransfer *transfer, bool ok, bool transient) {
+		const int index = transfer->m_request.m_index;
+		if (ok)
+			ok = applyHttpCache(transfer->m_curl, urlStrs[index], transfer->m_header, transfer->m_page);
+
+		switch (scheduler.onFinished(transfer->m_request, ok, transient)) {
+		case DownloadScheduler::Outcome::Succeeded:
+			transfer->m_page.finish();
+			recordCurlFixture(transfer->m_curl, urlStrs[index], transfer->m_header, transfer->m_page, true);
+			if (urlCb)
+				urlCb(index, urlStrs[index], true, transfer->m_page);
+
+			// Cancel the hedging loser
+			for (auto &other : transfers) {
+				if ((&other != transfer) && other.m_curl && (other.m_request.m_index == index)) {
+					scheduler.onFinished(other.m_request, false, false);
+					releaseTransfer(&other);
+				}
+			}
+			break;
+		case DownloadScheduler::Outcome::Failed:
+			transfer->m_page.clear();
+			if (urlCb)
+				urlCb(index, urlStrs[index], false, transfer->m_page);
+			break;
+		default:
+			break;
+		}
+
+		releaseTransfer(transfer);
+	};
+
+	// Abort all the transfers in flight
+	auto releaseAllTransfers = [&]() {
+		for (auto &transfer : transfers) {
+			if (transfer.m_curl)
+				releaseTransfer(&transfer);
+		}
+	};
+
+	while (!scheduler.isFinished()) {
+		if (token.isCancelled()) {
+			SystemLogger->info("Batch download of {} URLs was cancelled", urlStrs.size());
+			releaseAllTransfers();
+			return false;
+		}
+
+		// Fill the free transfer slots, as far as the scheduler allows
+		qint64 waitMs = -1;
+		DownloadScheduler::Request request;
+		while (!idleTransfers.isEmpty() && scheduler.nextRequest(request, waitMs)) {
+			const int index = request.m_index;
+
+			CURL *curl = session.acquireTransferHandle();
+			if (!curl) {
+				if ((scheduler.onFinished(request, false, false) == DownloadScheduler::Outcome::Failed) && urlCb)
+					urlCb(index, urlStrs[index], false, HtmlPageStream(HtmlPageStream::Mode::Raw, 0));
+				continue;
+			}
+
+			CurlTransfer *transfer = idleTransfers.takeLast();
+			transfer->m_curl = curl;
+			transfer->m_request = request;
+			transfer->m_requestHeaders = makeCacheRequestHeaders(urlStrs[index]);
+			if (!setupCurlHandle(curl, urlStrs[index], &transfer->m_page, &transfer->m_header,
+					transfer->m_requestHeaders, nullptr, nullptr)) {
+				session.releaseTransferHandle(curl);
+				transfer->m_curl = nullptr;
+				finishTransfer(transfer, false, false);
+				continue;
+			}
+			curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+
+			curl_multi_add_handle(multi, curl);
+		}
+
+		int stillRunning = 0;
+		CURLMcode multiResult = curl_multi_perform(multi, &stillRunning);
+		if (multiResult != CURLM_OK) {
+			SystemLogger->error("curl_multi_perform() failed");
+			SystemLogger->error("Error code: {}", multiResult);
+			SystemLogger->error("Error string: {}", curl_multi_strerror(multiResult));
+
+			releaseAllTransfers();
+			return false;
+		}
+
+		// Collect the finished transfers
+		int messagesLeft = 0;
+		while (CURLMsg *message = curl_multi_info_read(multi, &messagesLeft)) {
+			if (message->msg != CURLMSG_DONE)
+				continue;
+
+			// NOTE: message is invalidated by curl_multi_remove_handle call
+			CURL *curl = message->easy_handle;
+			const CURLcode result = message->data.result;
+
+			char *transferPtr = nullptr;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transferPtr);
+			CurlTransfer *transfer = reinterpret_cast<CurlTransfer *>(transferPtr);
+			// NOTE: hedging loser can't be met here: curl_multi_remove_handle drops the pending message of the handle
+			Q_ASSERT(transfer && transfer->m_curl == curl);
+
+			const QString &urlStr = urlStrs[transfer->m_request.m_index];
+			session.registerTransfer(curl);
+			reportCrawlResult(curl, urlStr, result == CURLE_OK);
+			recordTransferTiming(curl, urlStr, result == CURLE_OK, transfer->m_page.size());
+			if (result != CURLE_OK) {
+				SystemLogger->error("Download of URL '{}' failed", urlStr);
+				SystemLogger->error("Error code: {}", result);
+				SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+			}
+
+			finishTransfer(transfer, result == CURLE_OK, (result != CURLE_OK) && isTransientCurlError(curl, result));
+		}
+
+		// NOTE: curl_multi_wait returns immediately if there are no transfers;
+		//       cancellable batch must not sleep for long, because token is checked between the waits only
+		const qint64 maxWaitMs = token.isNull() ? 1000 : 100;
+		const int waitTimeoutMs = static_cast<int>((waitMs > 0) ? qMin<qint64>(waitMs, maxWaitMs) : maxWaitMs);
+		if (scheduler.runningCount() > 0)
+			curl_multi_wait(multi, nullptr, 0, waitTimeoutMs, nullptr);
+		else if (waitMs > 0)
+			QThread::msleep(static_cast<unsigned long>(waitTimeoutMs));
+	}
+
+	return scheduler.allSucceeded();
+}
+}
+
+// State of the async download, see FileDownloader::startDownloadAsync
+struct FileDownloader::AsyncTransfer {
+	QString m_urlStr;
+	CURL *m_curl = nullptr;
+	HtmlPageStream m_page { HtmlPageStream::Mode::Raw };
+	QByteArray m_header;
+	curl_slist *m_requestHeaders = nullptr;
+	ProgressContext m_progress;
+	int m_attempt = 1;
+	// Delay before the retry of the transient failure
+	QTimer m_retryTimer;
+};
 #endif
 
+FileDownloader::FileDownloader(QObject *parent)
+	: QObject(parent)
+#ifdef USE_QT_NAM
+	, m_nm(nullptr)
+	, m_reply(nullptr)
+	, m_progressCb(nullptr)
+	, m_newConnection(false)
+	, m_page(HtmlPageStream::Mode::Raw)
+	, m_probeCb(nullptr)
+	, m_probeMatched(false)
+	, m_requestTimer()
+	, m_ttfbUs(-1)
+	, m_bytesReceived(0)
+	, m_transientError(false)
+	, m_token()
+#endif
+	, m_downloadedData()
+	, m_lastError(result_code::Type::Invalid)
+	, m_replayTimer()
+	, m_replayUrlStr()
+#ifndef USE_QT_NAM
+	, m_asyncTransfer()
+#endif
+{
+	m_replayTimer.setSingleShot(true);
+	connect(&m_replayTimer, &QTimer::timeout, this, &FileDownloader::replayAsync);
+}
+
+FileDownloader::~FileDownloader() {
+	// NOTE: transfer in progress refers to this object
+	cancelDownload();
+}
+
 #ifdef USE_QT_NAM
 void FileDownloader::startDownloadSync(const QUrl &url) {
 	m_lastError = result_code::Type::Invalid;
 	m_downloadedData.clear();
+	m_page.clear();
+	m_newConnection = false;
+	m_probeMatched = false;
+	m_ttfbUs = -1;
+	m_bytesReceived = 0;
+	m_transientError = false;
+	if (m_token.isCancelled()) {
+		m_lastError = result_code::Type::Cancelled;
+		return;
+	}
 
-	QNetworkRequest request;
-	request.setUrl(url);
-	request.setRawHeader("User-Agent", bfrUserAgent);
-
-	// FIXME: move to separate method and call on program start
-	//m_nm->connectToHostEncrypted(url.host());
+	// NOTE: connection warmed up by prewarmConnection() is reused here
+	m_nm = DownloadSession::globalInstance().threadNetworkAccessManager();
+	QNetworkRequest request = makeNetworkRequest(url, m_nm);
 
-	QEventLoop loop;
-	connect(m_nm, SIGNAL(finished(QNetworkReply *)), &loop, SLOT(quit()), Qt::DirectConnection);
+	if (!CrawlThrottle::globalInstance().waitForSlot(url, m_token)) {
+		m_lastError = result_code::Type::Cancelled;
+		return;
+	}
+	m_requestTimer.start();
 
 	m_reply = m_nm->get(request);
 	if (!m_reply) {
@@ -204,27 +1032,71 @@ void FileDownloader::startDownloadSync(const QUrl &url) {
 	}
 
 	connect(m_reply, &QNetworkReply::metaDataChanged, this, &FileDownloader::onMetadataChanged, Qt::DirectConnection);
+	connect(m_reply, &QNetworkReply::readyRead, this, &FileDownloader::onReadyRead, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::downloadProgress, this, &FileDownloader::onDownloadProgress, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::finished, this, &FileDownloader::onDownloadFinished, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::errorOccurred, this, &FileDownloader::onDownloadFailed, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::sslErrors, this, &FileDownloader::onSslErrors, Qt::DirectConnection);
+	connect(m_reply, &QNetworkReply::encrypted, this, &FileDownloader::onEncrypted, Qt::DirectConnection);
 
+	// NOTE: network access manager is shared, so its finished signal can't be used here
+	QEventLoop loop;
+	connect(m_reply, &QNetworkReply::finished, &loop, &QEventLoop::quit, Qt::DirectConnection);
+
+	// NOTE: token can be cancelled from any thread, so it is polled; abort() emits the finished signal synchronously
+	QTimer cancelTimer;
+	if (!m_token.isNull()) {
+		connect(&cancelTimer, &QTimer::timeout, &loop, [this]() {
+			if (m_token.isCancelled() && m_reply)
+				m_reply->abort();
+		});
+		cancelTimer.start(CancellationPollIntervalMs);
+	}
 	loop.exec();
 }
+
+void FileDownloader::abortReply() {
+
+	if (!m_reply)
+		return;
+
+	// NOTE: aborted reply must not report anything
+	disconnect(m_reply.data(), nullptr, this, nullptr);
+	m_reply->abort();
+	m_reply->deleteLater();
+	m_reply = nullptr;
+}
 #endif
 
 void FileDownloader::startDownloadAsync(const QUrl &url) {
+	// NOTE: result of the previous download is superseded by this one
+	cancelDownload();
+
 	m_lastError = result_code::Type::Invalid;
 	m_downloadedData.clear();
-
 #ifdef USE_QT_NAM
-	QNetworkRequest request;
-	request.setUrl(url);
-	request.setRawHeader("User-Agent", bfrUserAgent);
+	m_page.clear();
+	m_newConnection = false;
+	m_probeMatched = false;
+	m_ttfbUs = -1;
+	m_bytesReceived = 0;
+	m_transientError = false;
+#endif
+
+	// NOTE: replay must not touch network, and the result is still reported asynchronously
+	if (DownloadTransport::globalInstance().isReplaying()) {
+		m_replayUrlStr = url.toString();
+		m_replayTimer.start(0);
+		return;
+	}
 
-	// FIXME: move to separate method and call on program start
-	//m_nm->connectToHostEncrypted(url.host());
+#ifdef USE_QT_NAM
+	m_nm = DownloadSession::globalInstance().threadNetworkAccessManager();
+	QNetworkRequest request = makeNetworkRequest(url, m_nm);
 
+	// NOTE: async request must not block the caller, so it is not delayed by the crawl throttle,
+	//       but its result is still reported to it
+	m_requestTimer.start();
 	m_reply = m_nm->get(request);
 	if (!m_reply) {
 		SPDLOG_ERROR("GET request failed for URL '{}'", url.toString());
@@ -232,19 +1104,164 @@ void FileDownloader::startDownloadAsync(const QUrl &url) {
 	}
 
 	connect(m_reply, &QNetworkReply::metaDataChanged, this, &FileDownloader::onMetadataChanged, Qt::DirectConnection);
+	connect(m_reply, &QNetworkReply::readyRead, this, &FileDownloader::onReadyRead, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::downloadProgress, this, &FileDownloader::onDownloadProgress, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::finished, this, &FileDownloader::onDownloadFinished, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::errorOccurred, this, &FileDownloader::onDownloadFailed, Qt::DirectConnection);
 	connect(m_reply, &QNetworkReply::sslErrors, this, &FileDownloader::onSslErrors, Qt::DirectConnection);
+	connect(m_reply, &QNetworkReply::encrypted, this, &FileDownloader::onEncrypted, Qt::DirectConnection);
 #else
-	// FIXME: test what happens when we will call this method again BEFORE previous call finishes
-	//    m_downloadedDataWatcher.waitForFinished();
+	m_asyncTransfer.reset(new AsyncTransfer);
+	m_asyncTransfer->m_urlStr = url.toString();
+	m_asyncTransfer->m_progress.m_downloader = this;
+	m_asyncTransfer->m_retryTimer.setSingleShot(true);
+	connect(&m_asyncTransfer->m_retryTimer, &QTimer::timeout, this, &FileDownloader::startAsyncAttempt);
+	startAsyncAttempt();
+#endif
+}
+
+void FileDownloader::cancelDownload() {
+	if (m_replayTimer.isActive()) {
+		m_replayTimer.stop();
+		m_lastError = result_code::Type::Cancelled;
+		return;
+	}
 
-	m_downloadedDataWatcher.setFuture(QtConcurrent::run(
-		std::bind(downloadFileAsync, url.toString(), this, std::ref(m_downloadedData), std::ref(m_lastError))));
+#ifdef USE_QT_NAM
+	if (!m_reply || m_reply->isFinished())
+		return;
+
+	abortReply();
+	m_lastError = result_code::Type::Cancelled;
+#else
+	if (!m_asyncTransfer)
+		return;
+
+	releaseAsyncTransfer();
+	m_asyncTransfer.reset();
+	m_lastError = result_code::Type::Cancelled;
 #endif
 }
 
+void FileDownloader::replayAsync() {
+
+	// NOTE: with latency simulation enabled, the object thread is blocked for the recorded transfer time
+	HtmlPageStream page(HtmlPageStream::Mode::Raw);
+	const bool ok = replayUrl(m_replayUrlStr, page,
+		[this](qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded) {
+			emit downloadProgress(bytesReceived, bytesTotal, bytesDecoded);
+		},
+		nullptr, nullptr, CancellationToken());
+
+	if (ok)
+		m_downloadedData = page.rawData();
+	m_lastError = ok ? result_code::Type::Ok : result_code::Type::NetworkError;
+	if (ok)
+		emit downloadFinished();
+	else
+		emit downloadFailed(result_code::Type::NetworkError);
+}
+
+#ifndef USE_QT_NAM
+void FileDownloader::startAsyncAttempt() {
+
+	AsyncTransfer &transfer = *m_asyncTransfer;
+	transfer.m_page.clear();
+	transfer.m_header.clear();
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	CurlSocketLoop *loop = session.threadSocketLoop();
+	transfer.m_curl = (loop && loop->isValid()) ? session.acquireTransferHandle() : nullptr;
+	bool ok = (transfer.m_curl != nullptr);
+	if (ok) {
+		transfer.m_requestHeaders = makeCacheRequestHeaders(transfer.m_urlStr);
+		transfer.m_progress.m_page = &transfer.m_page;
+		ok = setupCurlHandle(transfer.m_curl, transfer.m_urlStr, &transfer.m_page, &transfer.m_header,
+			transfer.m_requestHeaders, downloadFileProgressCallback, &transfer.m_progress);
+	}
+
+	// NOTE: async request must not block the caller, so it is not delayed by the crawl throttle,
+	//       but its result is still reported to it
+	if (ok)
+		ok = loop->addTransfer(transfer.m_curl, [this](CURL *, CURLcode result) { finishAsyncAttempt(result); });
+	if (!ok) {
+		SystemLogger->error("Unable to start download of URL '{}'", transfer.m_urlStr);
+
+		releaseAsyncTransfer();
+		m_asyncTransfer.reset();
+		m_lastError = result_code::Type::NetworkError;
+		emit downloadFailed(result_code::Type::NetworkError);
+	}
+}
+
+void FileDownloader::finishAsyncAttempt(int curlResult) {
+
+	const CURLcode result = static_cast<CURLcode>(curlResult);
+	AsyncTransfer &transfer = *m_asyncTransfer;
+	CURL *curl = transfer.m_curl;
+	const QString &urlStr = transfer.m_urlStr;
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	session.registerTransfer(curl);
+	reportCrawlResult(curl, urlStr, result == CURLE_OK);
+	recordTransferTiming(curl, urlStr, result == CURLE_OK, transfer.m_page.size());
+	if (result != CURLE_OK) {
+		SystemLogger->error("Download of URL '{}' failed", urlStr);
+		SystemLogger->error("Error code: {}", result);
+		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+	}
+
+	const bool ok = (result == CURLE_OK) && applyHttpCache(curl, urlStr, transfer.m_header, transfer.m_page);
+	if (ok) {
+		transfer.m_page.finish();
+		recordCurlFixture(curl, urlStr, transfer.m_header, transfer.m_page, true);
+	}
+	const bool transient = (result != CURLE_OK) && isTransientCurlError(curl, result);
+	releaseAsyncTransfer();
+
+	const RetryPolicy retryPolicy = session.retryPolicy();
+	if (!ok && transient && (transfer.m_attempt < retryPolicy.m_maxAttempts)) {
+		const qint64 delayMs = retryPolicy.backoffDelayMs(transfer.m_attempt);
+		SystemLogger->info("Retrying download of URL '{}' in {} ms (attempt {} of {})", urlStr, delayMs,
+			transfer.m_attempt + 1, retryPolicy.m_maxAttempts);
+		session.registerRetry();
+
+		transfer.m_attempt++;
+		transfer.m_retryTimer.start(static_cast<int>(delayMs));
+		return;
+	}
+
+	if (ok)
+		m_downloadedData = transfer.m_page.rawData();
+	m_lastError = ok ? result_code::Type::Ok : result_code::Type::NetworkError;
+
+	// NOTE: signal handler can start the new download, so the transfer state must be released before
+	m_asyncTransfer.reset();
+	if (ok)
+		emit downloadFinished();
+	else
+		emit downloadFailed(result_code::Type::NetworkError);
+}
+
+void FileDownloader::releaseAsyncTransfer() {
+
+	AsyncTransfer &transfer = *m_asyncTransfer;
+	transfer.m_retryTimer.stop();
+
+	if (transfer.m_curl) {
+		DownloadSession &session = DownloadSession::globalInstance();
+		// NOTE: finished transfer is already removed from the loop
+		if (CurlSocketLoop *loop = session.threadSocketLoop())
+			loop->removeTransfer(transfer.m_curl);
+		session.releaseTransferHandle(transfer.m_curl);
+		transfer.m_curl = nullptr;
+	}
+
+	curl_slist_free_all(transfer.m_requestHeaders);
+	transfer.m_requestHeaders = nullptr;
+}
+#endif
+
 QByteArray FileDownloader::downloadedData() const { return m_downloadedData; }
 
 result_code::Type FileDownloader::lastError() const { return m_lastError; }
@@ -253,17 +1270,49 @@ result_code::Type FileDownloader::lastError() const { return m_lastError; }
 void FileDownloader::onMetadataChanged() {
 	SPDLOG_INFO("bytesAvail: {}", m_reply->bytesAvailable());
 	SPDLOG_INFO("has content-length: {}", m_reply->hasRawHeader("Content-Length"));
+
+	if (m_ttfbUs < 0)
+		m_ttfbUs = m_requestTimer.nsecsElapsed() / 1000;
+
+	// NOTE: Content-Length of the compressed response is not the page size
+	bool contentLengthOk = false;
+	const qint64 contentLength = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong(&contentLengthOk);
+	if (contentLengthOk && (contentLength > 0) && !m_reply->hasRawHeader("Content-Encoding"))
+		m_page.reserve(contentLength);
+}
+
+void FileDownloader::onReadyRead() {
+
+	if (m_token.isCancelled()) {
+		m_reply->abort();
+		return;
+	}
+
+	const int offset = m_page.size();
+	if (m_page.appendFrom(m_reply) <= 0)
+		return;
+
+	if (m_probeCb && !m_probeMatched && m_probeCb(m_page.rawData(), offset)) {
+		m_probeMatched = true;
+		// NOTE: both errorOccurred and finished signals are emitted synchronously here
+		m_reply->abort();
+	}
 }
 
 void FileDownloader::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
-	SPDLOG_INFO("received {} bytes from total {}", bytesReceived, bytesTotal);
+	// NOTE: QNetworkReply reports the bytes read from socket, i.e. compressed ones;
+	//       the decompressed data is either already in the page buffer or still in the reply one
+	const qint64 bytesDecoded = m_page.size() + (m_reply ? m_reply->bytesAvailable() : 0);
+	SPDLOG_INFO("received {} bytes from total {}, {} bytes decoded", bytesReceived, bytesTotal, bytesDecoded);
+
+	m_bytesReceived = bytesReceived;
 
 	m_lastError = result_code::Type::InProgress;
 
 	if (m_progressCb)
-		m_progressCb(bytesReceived, bytesTotal);
+		m_progressCb(bytesReceived, bytesTotal, bytesDecoded);
 
-	emit downloadProgress(bytesReceived, bytesTotal);
+	emit downloadProgress(bytesReceived, bytesTotal, bytesDecoded);
 }
 
 void FileDownloader::onDownloadFinished() {
@@ -273,15 +1322,48 @@ void FileDownloader::onDownloadFinished() {
 		return;
 	}
 
-	m_lastError = result_code::Type::Ok;
+	// NOTE: cancelled reply is dropped as is, without touching the crawl throttle and transfer metrics
+	if (!m_probeMatched && m_token.isCancelled()) {
+		SPDLOG_INFO("Download of URL '{}' was cancelled", m_reply->request().url().toString());
+		m_lastError = result_code::Type::Cancelled;
+		m_transientError = false;
+		m_page.clear();
+		m_downloadedData.clear();
+		m_reply->deleteLater();
+		return;
+	}
+
+	// NOTE: reply aborted by the probe reports OperationCanceledError
+	const bool replyOk = m_probeMatched || (m_reply->error() == QNetworkReply::NoError);
+	m_lastError = replyOk ? result_code::Type::Ok : result_code::Type::NetworkError;
+	m_transientError = !replyOk && isTransientNetworkError(m_reply);
+
+	DownloadSession::globalInstance().registerConnection(!m_newConnection, http2WasUsed(m_reply));
+	const qint64 totalUs = m_requestTimer.nsecsElapsed() / 1000;
+	reportCrawlResult(m_reply, replyOk, ((m_ttfbUs >= 0) ? m_ttfbUs : totalUs) / 1000);
+
+	// NOTE: page is incomplete if transfer was aborted by the probe
+	if (!m_probeMatched)
+		m_page.appendFrom(m_reply);
+	recordTransferTiming(m_reply, replyOk, !m_newConnection, m_ttfbUs, totalUs, m_bytesReceived, m_page.size());
 
-	m_downloadedData = m_reply->readAll();
+	if (!m_probeMatched) {
+		if (replyOk && !applyHttpCache(m_reply, m_page))
+			m_lastError = result_code::Type::NetworkError;
+		m_page.finish();
+	}
+	if (result_code::succeeded(m_lastError))
+		recordReplyFixture(m_reply, m_page, !m_probeMatched, m_ttfbUs, totalUs);
+	m_downloadedData = m_page.rawData();
 	m_reply->deleteLater();
 
 	emit downloadFinished();
 }
 
 void FileDownloader::onDownloadFailed(QNetworkReply::NetworkError code) {
+	if ((m_probeMatched || m_token.isCancelled()) && (code == QNetworkReply::OperationCanceledError))
+		return;
+
 	m_lastError = result_code::Type::NetworkError;
 
 	// FIXME: map the NetworkError to the ResultCode
@@ -296,105 +1378,362 @@ void FileDownloader::onSslErrors(const QList<QSslError> &errors) {
 	for (const auto &error : errors)
 		SPDLOG_ERROR("SSL error: '{}'", error.errorString());
 }
+
+void FileDownloader::onEncrypted() { m_newConnection = true; }
 #endif
 
 //-----------------------------------------------------------------------------
 // Sync API
 
 #ifdef USE_QT_NAM
-bool FileDownloader::downloadUrl(const QString &urlStr, QByteArray &data, ProgressCallback progressCb) {
+bool FileDownloader::startDownloadSyncWithRetries(const QUrl &url) {
+
+	DownloadSession &session = DownloadSession::globalInstance();
+	const RetryPolicy retryPolicy = session.retryPolicy();
+
+	for (int attempt = 1;; ++attempt) {
+		startDownloadSync(url);
+		if (result_code::succeeded(m_lastError))
+			return true;
+		if (!m_transientError || (attempt >= retryPolicy.m_maxAttempts))
+			return false;
+
+		const qint64 delayMs = retryPolicy.backoffDelayMs(attempt);
+		SystemLogger->info("Retrying download of URL '{}' in {} ms (attempt {} of {})", url.toString(), delayMs,
+			attempt + 1, retryPolicy.m_maxAttempts);
+		session.registerRetry();
+		sleepCancellable(delayMs, m_token);
+	}
+}
+
+bool FileDownloader::downloadUrl(
+	const QString &urlStr, QByteArray &data, ProgressCallback progressCb, const CancellationToken &token) {
+
+	HtmlPageStream page(HtmlPageStream::Mode::Raw);
+	const bool result = downloadUrl(urlStr, page, progressCb, token);
+	data = page.rawData();
+	return result;
+}
+
+bool FileDownloader::downloadUrl(
+	const QString &urlStr, HtmlPageStream &page, ProgressCallback progressCb, const CancellationToken &token) {
+
+	if (DownloadTransport::globalInstance().isReplaying())
+		return replayUrl(urlStr, page, progressCb, nullptr, nullptr, token);
 
 	QScopedPointer<FileDownloader> fd(new FileDownloader);
 	fd->m_progressCb = progressCb;
-	fd->startDownloadSync(QUrl(urlStr));
+	fd->m_token = token;
+	// NOTE: caller page buffer is used for transfer to keep its mode and reserved capacity
+	fd->m_page = std::move(page);
+	const bool result = fd->startDownloadSyncWithRetries(QUrl(urlStr));
 
-	data = fd->downloadedData();
-	return result_code::succeeded(fd->lastError());
+	page = std::move(fd->m_page);
+	return result;
 }
-#else
-bool FileDownloader::downloadUrl(QString urlStr, QByteArray &data, ProgressCallback progressCb) {
-	data.clear();
 
-#ifdef BFR_PRINT_DEBUG_OUTPUT
-	SystemLogger->info("libcurl version: {}", LIBCURL_VERSION);
-#endif
+bool FileDownloader::probeUrl(const QString &urlStr, HtmlPageStream &page, ProbeCallback probeCb, bool &complete,
+	ProgressCallback progressCb, const CancellationToken &token) {
 
-	// FIXME: curl_global_init is not thread-safe, so call it manually
-	//        to prevent automatic call from curl_easy_init;
-	//        ensure what such call prevent from multi-threading problems!
-	CURLcode result = curl_global_init(CURL_GLOBAL_ALL);
-	if (result != CURLE_OK) {
-		SystemLogger->error("curl_global_init() failed");
-		SystemLogger->error("Error code: {}", result);
-		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
-		return false;
+	if (DownloadTransport::globalInstance().isReplaying()) {
+		bool probeMatched = false;
+		const bool result = replayUrl(urlStr, page, progressCb, &probeCb, &probeMatched, token);
+		complete = result && !probeMatched;
+		return result;
 	}
 
-	CURL *curl = curl_easy_init();
-	if (!curl) {
-		SystemLogger->error("curl_easy_init() failed");
-		return false;
+	QScopedPointer<FileDownloader> fd(new FileDownloader);
+	fd->m_progressCb = progressCb;
+	fd->m_token = token;
+	fd->m_probeCb = probeCb;
+	fd->m_page = std::move(page);
+	const bool result = fd->startDownloadSyncWithRetries(QUrl(urlStr));
+
+	page = std::move(fd->m_page);
+	complete = result && !fd->m_probeMatched;
+	return result;
+}
+
+bool FileDownloader::prewarmConnection(const QString &urlStr) {
+
+	const QUrl url(urlStr);
+	BFR_RETURN_VALUE_IF(!url.isValid() || url.host().isEmpty(), false, "Invalid URL to warm up the connection");
+	// NOTE: replay must not touch network
+	if (DownloadTransport::globalInstance().isReplaying())
+		return true;
+
+	// NOTE: connection is being established asynchronously, in the network access manager own thread
+	QNetworkAccessManager *nm = DownloadSession::globalInstance().threadNetworkAccessManager();
+	if (url.scheme() == QLatin1String("https")) {
+		// NOTE: HTTP/2 requests don't reuse the HTTP/1.1 connections, so the warmed up one must negotiate HTTP/2 too
+		QSslConfiguration sslConfiguration = QSslConfiguration::defaultConfiguration();
+		if (DownloadSession::globalInstance().http2Enabled())
+			sslConfiguration.setAllowedNextProtocols(
+				{ QSslConfiguration::ALPNProtocolHTTP2, QSslConfiguration::NextProtocolHttp1_1 });
+		nm->connectToHostEncrypted(url.host(), static_cast<quint16>(url.port(443)), sslConfiguration);
+	} else {
+		nm->connectToHost(url.host(), static_cast<quint16>(url.port(80)));
 	}
+	return true;
+}
+#else
+bool FileDownloader::downloadUrl(
+	const QString &urlStr, QByteArray &data, ProgressCallback progressCb, const CancellationToken &token) {
 
-	curl_easy_setopt(curl, CURLOPT_URL, urlStr.toLocal8Bit().constData());
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, CURL_TRUE);
-	curl_easy_setopt(curl, CURLOPT_FAILONERROR, CURL_TRUE);
+	HtmlPageStream page(HtmlPageStream::Mode::Raw);
+	const bool result = downloadUrl(urlStr, page, progressCb, token);
+	data = page.rawData();
+	return result;
+}
 
-	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, downloadFileProgressCallback_2);
-	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progressCb);
+bool FileDownloader::downloadUrl(
+	const QString &urlStr, HtmlPageStream &page, ProgressCallback progressCb, const CancellationToken &token) {
 
-	//    curl_easy_setopt(curl, CURLOPT_USERPWD, "user:pass");
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, bfrUserAgent);
-	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
-	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	if (DownloadTransport::globalInstance().isReplaying())
+		return replayUrl(urlStr, page, progressCb, nullptr, nullptr, token);
 
-	QByteArray response_string;
-	QByteArray header_string;
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, downloadFileWriteCallback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &header_string);
+	ProgressContext progress;
+	progress.m_progressCb = &progressCb;
+	progress.m_token = &token;
+	return performCurlDownload(urlStr, page, downloadFileProgressCallback_2, &progress);
+}
 
-	// FIXME HACK: need corect cert stuff setup instead of ignoring them
-#ifdef Q_OS_ANDROID
-	//curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CURL_FALSE);
-	//curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, CURL_FALSE);
+bool FileDownloader::probeUrl(const QString &urlStr, HtmlPageStream &page, ProbeCallback probeCb, bool &complete,
+	ProgressCallback progressCb, const CancellationToken &token) {
 
-	// #define BFR_RETURN_VALUE_IF(cond, returnValue, msg)
+	if (DownloadTransport::globalInstance().isReplaying()) {
+		bool probeMatched = false;
+		const bool result = replayUrl(urlStr, page, progressCb, &probeCb, &probeMatched, token);
+		complete = result && !probeMatched;
+		return result;
+	}
 
-	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1) != CURLE_OK, false, "setting CURLOPT_SSL_VERIFYPEER failed");
-	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2) != CURLE_OK, false, "setting CURLOPT_SSL_VERIFYHOST failed");
-	BFR_RETURN_VALUE_IF(curl_easy_setopt(curl, CURLOPT_CAPATH, CACertificatesPath) != CURLE_OK, false, "setting CURLOPT_CAPATH failed");
+	ProbeContext probe;
+	probe.m_probeCb = &probeCb;
+	ProgressContext progress;
+	progress.m_progressCb = &progressCb;
+	progress.m_token = &token;
+	const bool result = performCurlDownload(urlStr, page, downloadFileProgressCallback_2, &progress, &probe);
+	complete = result && !probe.m_matched;
+	return result;
+}
+
+bool FileDownloader::prewarmConnection(const QString &urlStr) {
+
+	const QUrl url(urlStr);
+	BFR_RETURN_VALUE_IF(!url.isValid() || url.host().isEmpty(), false, "Invalid URL to warm up the connection");
+	// NOTE: replay must not touch network
+	if (DownloadTransport::globalInstance().isReplaying())
+		return true;
+
+	return performCurlWarmUp(urlStr);
+}
 #endif
 
-	result = curl_easy_perform(curl);
-	if (result != CURLE_OK) {
-		SystemLogger->error("curl_easy_perform() failed");
-		SystemLogger->error("Error code: {}", result);
-		SystemLogger->error("Error string: {}", curl_easy_strerror(result));
+//-----------------------------------------------------------------------------
+// Batch API
+
+#ifdef USE_QT_NAM
+bool FileDownloader::downloadUrls(
+	const QStringList &urlStrs, int maxParallel, UrlFinishedCallback urlCb, const CancellationToken &token) {
+
+	if (urlStrs.isEmpty())
+		return true;
+	if (token.isCancelled())
 		return false;
+	maxParallel = qBound(1, maxParallel, urlStrs.size());
+
+	if (DownloadTransport::globalInstance().isReplaying())
+		return replayUrls(urlStrs, maxParallel, urlCb, token);
+
+	QNetworkAccessManager *nm = DownloadSession::globalInstance().threadNetworkAccessManager();
+	QEventLoop loop;
+
+	DownloadScheduler scheduler(urlStrs, maxParallel);
+	QHash<QNetworkReply *, DownloadScheduler::Request> activeReplies;
+	bool fillScheduled = false;
+	bool cancelled = false;
+
+	std::function<void()> fillSlots;
+	std::function<void(const DownloadScheduler::Request &)> startRequest = [&](const DownloadScheduler::Request &request) {
+		const int index = request.m_index;
+
+		QNetworkRequest networkRequest = makeNetworkRequest(QUrl(urlStrs[index]), nm);
+		QElapsedTimer requestTimer;
+		requestTimer.start();
+
+		QNetworkReply *reply = nm->get(networkRequest);
+		if (!reply) {
+			SPDLOG_ERROR("GET request failed for URL '{}'", urlStrs[index]);
+			if ((scheduler.onFinished(request, false, false) == DownloadScheduler::Outcome::Failed) && urlCb)
+				urlCb(index, urlStrs[index], false, HtmlPageStream(HtmlPageStream::Mode::Raw, 0));
+			return;
+		}
+		activeReplies.insert(reply, request);
+
+		auto page = std::make_shared<HtmlPageStream>();
+		connect(reply, &QNetworkReply::readyRead, &loop, [reply, page]() { page->appendFrom(reply); });
+
+		auto ttfbUs = std::make_shared<qint64>(-1);
+		connect(reply, &QNetworkReply::metaDataChanged, &loop, [requestTimer, ttfbUs]() {
+			if (*ttfbUs < 0)
+				*ttfbUs = requestTimer.nsecsElapsed() / 1000;
+		});
+
+		auto bytesReceived = std::make_shared<qint64>(0);
+		connect(reply, &QNetworkReply::downloadProgress, &loop,
+			[bytesReceived](qint64 received, qint64 /*total*/) { *bytesReceived = received; });
+
+		// NOTE: see FileDownloader::m_newConnection
+		auto newConnection = std::make_shared<bool>(false);
+		connect(reply, &QNetworkReply::encrypted, &loop, [newConnection]() { *newConnection = true; });
+		connect(reply, &QNetworkReply::finished, &loop, [&, reply, index, newConnection, page, ttfbUs, bytesReceived, requestTimer]() {
+			// NOTE: hedging loser was already accounted when it was aborted
+			if (!activeReplies.contains(reply))
+				return;
+			const DownloadScheduler::Request finishedRequest = activeReplies.take(reply);
+
+			bool ok = (reply->error() == QNetworkReply::NoError);
+			const qint64 totalUs = requestTimer.nsecsElapsed() / 1000;
+			reportCrawlResult(reply, ok, ((*ttfbUs >= 0) ? *ttfbUs : totalUs) / 1000);
+			if (ok) {
+				DownloadSession::globalInstance().registerConnection(!*newConnection, http2WasUsed(reply));
+
+				page->appendFrom(reply);
+				recordTransferTiming(reply, true, !*newConnection, *ttfbUs, totalUs, *bytesReceived, page->size());
+				ok = applyHttpCache(reply, *page);
+			} else {
+				SPDLOG_ERROR("Download of URL '{}' failed: '{}'", urlStrs[index], reply->errorString());
+				recordTransferTiming(reply, false, !*newConnection, *ttfbUs, totalUs, *bytesReceived, 0);
+			}
+
+			const bool transient = !ok && isTransientNetworkError(reply);
+			switch (scheduler.onFinished(finishedRequest, ok, transient)) {
+			case DownloadScheduler::Outcome::Succeeded: {
+				page->finish();
+				recordReplyFixture(reply, *page, true, *ttfbUs, totalUs);
+				if (urlCb)
+					urlCb(index, urlStrs[index], true, *page);
+
+				// Cancel the hedging loser
+				QList<QNetworkReply *> losers;
+				for (auto it = activeReplies.cbegin(); it != activeReplies.cend(); ++it) {
+					if (it.value().m_index == index)
+						losers << it.key();
+				}
+				for (QNetworkReply *loser : losers) {
+					scheduler.onFinished(activeReplies.take(loser), false, false);
+					loser->abort();
+					loser->deleteLater();
+				}
+				break;
+			}
+			case DownloadScheduler::Outcome::Failed:
+				page->clear();
+				if (urlCb)
+					urlCb(index, urlStrs[index], false, *page);
+				break;
+			default:
+				break;
+			}
+			reply->deleteLater();
+
+			fillSlots();
+		});
+	};
+
+	// Start the new, retried and hedge requests, as far as the scheduler allows
+	fillSlots = [&]() {
+		if (cancelled)
+			return;
+
+		qint64 waitMs = -1;
+		DownloadScheduler::Request request;
+		while (scheduler.nextRequest(request, waitMs))
+			startRequest(request);
+
+		if (scheduler.isFinished()) {
+			loop.quit();
+			return;
+		}
+
+		if ((waitMs > 0) && !fillScheduled) {
+			fillScheduled = true;
+			QTimer::singleShot(static_cast<int>(waitMs), &loop, [&]() {
+				fillScheduled = false;
+				fillSlots();
+			});
+		}
+	};
+
+	// NOTE: token can be cancelled from any thread, so it is polled
+	QTimer cancelTimer;
+	if (!token.isNull()) {
+		connect(&cancelTimer, &QTimer::timeout, &loop, [&]() {
+			if (!token.isCancelled())
+				return;
+
+			SystemLogger->info("Batch download of {} URLs was cancelled", urlStrs.size());
+			cancelled = true;
+			cancelTimer.stop();
+
+			// NOTE: aborted replies are not in the active ones, so their finished signal is ignored
+			const QList<QNetworkReply *> replies = activeReplies.keys();
+			activeReplies.clear();
+			for (QNetworkReply *reply : replies) {
+				reply->abort();
+				reply->deleteLater();
+			}
+			loop.quit();
+		});
+		cancelTimer.start(CancellationPollIntervalMs);
 	}
 
-#ifdef BFR_PRINT_DEBUG_OUTPUT
-	char *url;
-	long response_code;
-	double elapsed;
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &elapsed);
-	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+	fillSlots();
+	if (!scheduler.isFinished())
+		loop.exec();
 
-	SystemLogger->info("libcurl response:");
-	SystemLogger->info("Elapsed time: {}", elapsed);
-	SystemLogger->info("Redirected URL: {}", url);
-	SystemLogger->info("Response code: {}", response_code);
-	SystemLogger->info("Response header: {}", header_string.toStdString());
-	SystemLogger->info("Response string: {}", response_string.toStdString());
-#endif
+	return !cancelled && scheduler.allSucceeded();
+}
+#else
+bool FileDownloader::downloadUrls(
+	const QStringList &urlStrs, int maxParallel, UrlFinishedCallback urlCb, const CancellationToken &token) {
+
+	if (urlStrs.isEmpty())
+		return true;
+	if (token.isCancelled())
+		return false;
+	maxParallel = qBound(1, maxParallel, urlStrs.size());
 
-	curl_easy_cleanup(curl);
-	curl = NULL;
+	if (DownloadTransport::globalInstance().isReplaying())
+		return replayUrls(urlStrs, maxParallel, urlCb, token);
 
-	data = response_string;
-	return true;
+	return performCurlBatchDownload(urlStrs, maxParallel, urlCb, token);
 }
 #endif
+
+quint64 FileDownloader::connectionsOpened() { return DownloadSession::globalInstance().connectionsOpened(); }
+
+quint64 FileDownloader::connectionsReused() { return DownloadSession::globalInstance().connectionsReused(); }
+
+quint64 FileDownloader::http2Transfers() { return DownloadSession::globalInstance().http2Transfers(); }
+
+quint64 FileDownloader::cacheRevalidatedCount() { return HttpCache::globalInstance().revalidatedCount(); }
+
+RetryPolicy FileDownloader::retryPolicy() { return DownloadSession::globalInstance().retryPolicy(); }
+
+void FileDownloader::setRetryPolicy(const RetryPolicy &policy) { DownloadSession::globalInstance().setRetryPolicy(policy); }
+
+bool FileDownloader::hedgingEnabled() { return DownloadSession::globalInstance().hedgingEnabled(); }
+
+void FileDownloader::setHedgingEnabled(bool enabled) { DownloadSession::globalInstance().setHedgingEnabled(enabled); }
+
+quint64 FileDownloader::retryCount() { return DownloadSession::globalInstance().retryCount(); }
+
+quint64 FileDownloader::hedgeCount() { return DownloadSession::globalInstance().hedgeCount(); }
+
+quint64 FileDownloader::hedgeWinCount() { return DownloadSession::globalInstance().hedgeWinCount(); }
+
+TransferMetricsSnapshot FileDownloader::transferMetrics() { return TransferMetrics::globalInstance().snapshot(); }
+
+void FileDownloader::resetTransferMetrics() { TransferMetrics::globalInstance().reset(); }
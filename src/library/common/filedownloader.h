@@ -32,8 +32,10 @@
 
 // FIXME: implement proxy auth
 
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QEventLoop>
 #include <QtCore/QPointer>
+#include <QtCore/QTimer>
 #include <QtCore/QUrl>
 
 #ifdef USE_QT_NAM
@@ -41,43 +43,101 @@
 #include <QtNetwork/QNetworkRequest>
 #include <QtNetwork/QNetworkReply>
 #else
-#include <QtConcurrent/QtConcurrent>
 #define CURL_TRUE 1
 #define CURL_FALSE 0
 #endif
 
 #include <common/resultcode.h>
+#include <common/cancellationtoken.h>
 #include <common/logger.h>
+#include <common/htmlpagestream.h>
+#include <common/retrypolicy.h>
+#include <common/transfermetrics.h>
+
+#include <memory>
 
 class FileDownloader : public QObject {
 	Q_OBJECT
 
 public:
 	explicit FileDownloader(QObject *parent = nullptr);
-	virtual ~FileDownloader() = default;
+	virtual ~FileDownloader();
 
 	// Async API
+	// NOTE: the previous download which is still in progress is cancelled;
+	//       the result is reported by the signals below, so the object thread must run the Qt event loop
 	void startDownloadAsync(const QUrl &url);
+	void cancelDownload();
 	QByteArray downloadedData() const;
 	result_code::Type lastError() const;
 
 	// Sync API
+	// NOTE: bytesReceived and bytesTotal are the bytes on the wire, i.e. compressed ones if server supports compression;
+	//       bytesDecoded is the count of decompressed page bytes
 	//using ProgressCallback = void (*)(qint64 /*bytesReceived*/, qint64 /*bytesTotal*/);
-	using ProgressCallback = std::function<void(qint64, qint64)>;
-	static bool downloadUrl(const QString &urlStr, QByteArray &data, ProgressCallback progressCb = nullptr);
+	using ProgressCallback = std::function<void(qint64 /*bytesReceived*/, qint64 /*bytesTotal*/, qint64 /*bytesDecoded*/)>;
+	// NOTE: all the sync and batch API functions abort the transfer and return false as soon as the token is cancelled
+	static bool downloadUrl(const QString &urlStr, QByteArray &data, ProgressCallback progressCb = nullptr,
+		const CancellationToken &token = CancellationToken());
+	// Streaming version: page is transcoded to UTF-8 (if page mode requires it) while it's being downloaded
+	static bool downloadUrl(const QString &urlStr, HtmlPageStream &page, ProgressCallback progressCb = nullptr,
+		const CancellationToken &token = CancellationToken());
+
+	// Batch API: download all the URLs concurrently, with at most maxParallel transfers in flight;
+	// callback is called on the calling thread as soon as each single URL download is finished.
+	// Returns false if at least one of URLs was not downloaded
+	using UrlFinishedCallback = std::function<void(int /*index*/, const QString & /*urlStr*/, bool /*ok*/, const HtmlPageStream & /*page*/)>;
+	static bool downloadUrls(const QStringList &urlStrs, int maxParallel, UrlFinishedCallback urlCb,
+		const CancellationToken &token = CancellationToken());
+
+	// Probe API: probeCb is called after each received chunk, and the transfer is aborted as soon as it returns true.
+	// complete is set to true if the whole page was downloaded, i.e. probe did not match.
+	// Returns false on network error only
+	using ProbeCallback = std::function<bool(const QByteArray & /*rawData*/, int /*chunkOffset*/)>;
+	static bool probeUrl(const QString &urlStr, HtmlPageStream &page, ProbeCallback probeCb, bool &complete,
+		ProgressCallback progressCb = nullptr, const CancellationToken &token = CancellationToken());
+
+	// Warm-up API: open the connection (DNS lookup, TCP and TLS handshakes) to the host of the specified URL
+	// ahead of time, so the first download from it will not pay for the connection setup.
+	// NOTE: must be called from the thread that will download the pages, because Qt network access manager
+	//       is thread-affine; libcurl path shares the connection with all the threads
+	static bool prewarmConnection(const QString &urlStr);
+
+	// Connection reuse statistics, see DownloadSession
+	static quint64 connectionsOpened();
+	static quint64 connectionsReused();
+	static quint64 http2Transfers();
+	// Count of the pages served from the HTTP cache after 304 response, see HttpCache
+	static quint64 cacheRevalidatedCount();
+
+	// Transient failures are retried with the jittered exponential backoff delay;
+	// optionally, the slow batch requests are hedged after the p95 latency, see DownloadScheduler
+	static RetryPolicy retryPolicy();
+	static void setRetryPolicy(const RetryPolicy &policy);
+	static bool hedgingEnabled();
+	static void setHedgingEnabled(bool enabled);
+	static quint64 retryCount();
+	static quint64 hedgeCount();
+	static quint64 hedgeWinCount();
+
+	// Timing breakdown of the latest requests, and its histograms over all the requests, see TransferMetrics
+	static TransferMetricsSnapshot transferMetrics();
+	static void resetTransferMetrics();
 
 signals:
-	void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+	void downloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded);
 	void downloadFinished();
 	void downloadFailed(result_code::Type code);
 
 #ifdef USE_QT_NAM
 private slots:
 	void onMetadataChanged();
+	void onReadyRead();
 	void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
 	void onDownloadFinished();
 	void onDownloadFailed(QNetworkReply::NetworkError code);
 	void onSslErrors(const QList<QSslError> &errors);
+	void onEncrypted();
 #endif
 
 private:
@@ -85,20 +145,45 @@ private:
 	QPointer<QNetworkAccessManager> m_nm;
 	QPointer<QNetworkReply> m_reply;
 	ProgressCallback m_progressCb;
+	// NOTE: QNetworkReply::encrypted is emitted only after the new TLS handshake,
+	//       i.e. it will not be emitted for the reused connection
+	bool m_newConnection;
+	HtmlPageStream m_page;
+	ProbeCallback m_probeCb;
+	bool m_probeMatched;
+	// Request time to first byte, for the crawl throttle and transfer metrics
+	QElapsedTimer m_requestTimer;
+	qint64 m_ttfbUs;
+	qint64 m_bytesReceived;
+	// Whether the last failure is worth retrying, see RetryPolicy
+	bool m_transientError;
+	// Checked periodically while the reply is in progress
+	CancellationToken m_token;
 #endif
 
 	QByteArray m_downloadedData;
 	result_code::Type m_lastError;
 
+	// Async API in the replay mode: fixture is served from the object thread event loop, like the network response
+	QTimer m_replayTimer;
+	QString m_replayUrlStr;
+
 #ifndef USE_QT_NAM
-	// Async API
-	QFutureWatcher<QByteArray> m_downloadedDataWatcher;
+	// Async API: transfer is run by the socket loop of the object thread, see CurlSocketLoop
+	struct AsyncTransfer;
+	std::unique_ptr<AsyncTransfer> m_asyncTransfer;
 #endif
 private:
-#ifndef USE_QT_NAM
-	static const char *CACertificatesPath;
-#else
+	void replayAsync();
+#ifdef USE_QT_NAM
 	void startDownloadSync(const QUrl &url);
+	bool startDownloadSyncWithRetries(const QUrl &url);
+	void abortReply();
+#else
+	void startAsyncAttempt();
+	// NOTE: curlResult is CURLcode, libcurl header is not included here
+	void finishAsyncAttempt(int curlResult);
+	void releaseAsyncTransfer();
 #endif
 };
 
@@ -0,0 +1,178 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "htmlpagestream.h"
+
+#include <common/logger.h>
+
+#include <limits>
+
+namespace {
+// https://www.iana.org/assignments/character-sets/character-sets.xhtml
+const int Utf8MibEnum = 106;
+}
+
+HtmlPageStream::HtmlPageStream(Mode mode, int expectedSize)
+	: m_mode(mode)
+	, m_rawData()
+	, m_codec(nullptr)
+	, m_isUtf8(false)
+	, m_decoder()
+	, m_decodedText()
+	, m_utf8Data()
+	, m_finished(false) {
+
+	Q_ASSERT(m_mode == Mode::Raw || m_mode == Mode::DecodeToUtf8);
+	m_rawData.reserve(expectedSize);
+}
+
+HtmlPageStream::Mode HtmlPageStream::mode() const { return m_mode; }
+
+void HtmlPageStream::clear() {
+
+	// NOTE: keep the reserved buffer capacity
+	m_rawData.resize(0);
+	m_codec = nullptr;
+	m_isUtf8 = false;
+	m_decoder.reset();
+	m_decodedText.clear();
+	m_utf8Data.clear();
+	m_finished = false;
+}
+
+void HtmlPageStream::reserve(qint64 size) {
+
+	if ((size <= m_rawData.capacity()) || (size > std::numeric_limits<int>::max()))
+		return;
+
+	m_rawData.reserve(static_cast<int>(size));
+	if (m_decoder)
+		m_decodedText.reserve(static_cast<int>(size));
+}
+
+void HtmlPageStream::append(const char *data, int size) {
+
+	Q_ASSERT(!m_finished);
+	if (size <= 0)
+		return;
+
+	const int offset = m_rawData.size();
+	m_rawData.append(data, size);
+	onAppended(offset, size);
+}
+
+qint64 HtmlPageStream::appendFrom(QIODevice *device) {
+
+	Q_ASSERT(!m_finished);
+	Q_ASSERT(device);
+	if (!device)
+		return -1;
+
+	const qint64 available = device->bytesAvailable();
+	if (available <= 0)
+		return 0;
+
+	const int offset = m_rawData.size();
+	m_rawData.resize(offset + static_cast<int>(available));
+	const qint64 readSize = device->read(m_rawData.data() + offset, available);
+	m_rawData.resize(offset + static_cast<int>(qMax<qint64>(readSize, 0)));
+
+	if (readSize > 0)
+		onAppended(offset, static_cast<int>(readSize));
+	return readSize;
+}
+
+void HtmlPageStream::onAppended(int offset, int size) {
+
+	if (m_mode != Mode::DecodeToUtf8)
+		return;
+
+	// Wait for the HTML header with charset
+	if (!m_codec) {
+		if (m_rawData.size() >= CharsetDetectionSize)
+			startDecoding();
+		return;
+	}
+
+	if (m_decoder)
+		m_decodedText += m_decoder->toUnicode(m_rawData.constData() + offset, size);
+}
+
+void HtmlPageStream::startDecoding() {
+
+	Q_ASSERT(!m_codec);
+
+	m_codec = QTextCodec::codecForHtml(m_rawData);
+	Q_ASSERT(m_codec);
+	if (!m_codec)
+		return;
+
+#ifdef BFR_PRINT_DEBUG_OUTPUT
+	SystemLogger->info("HTML encoding/charset is '{}'", m_codec->name().toStdString());
+#endif
+
+	m_isUtf8 = (m_codec->mibEnum() == Utf8MibEnum);
+	if (m_isUtf8)
+		return;
+
+	// NOTE: decoder keeps the state between the chunks, so multibyte sequences can be split
+	m_decoder.reset(m_codec->makeDecoder());
+	m_decodedText.reserve(m_rawData.capacity());
+	m_decodedText += m_decoder->toUnicode(m_rawData.constData(), m_rawData.size());
+}
+
+void HtmlPageStream::finish() {
+
+	if (m_finished)
+		return;
+	m_finished = true;
+
+	if (m_mode != Mode::DecodeToUtf8)
+		return;
+
+	if (!m_codec)
+		startDecoding();
+
+	if (m_isUtf8) {
+		// NOTE: implicit sharing, no copy
+		m_utf8Data = m_rawData;
+	} else {
+		m_utf8Data = m_decodedText.toUtf8();
+		m_decodedText.clear();
+		m_decoder.reset();
+	}
+}
+
+bool HtmlPageStream::isEmpty() const { return m_rawData.isEmpty(); }
+
+int HtmlPageStream::size() const { return m_rawData.size(); }
+
+bool HtmlPageStream::isFinished() const { return m_finished; }
+
+const QByteArray &HtmlPageStream::rawData() const { return m_rawData; }
+
+QByteArray HtmlPageStream::utf8Data() const {
+
+	Q_ASSERT(m_finished && (m_mode == Mode::DecodeToUtf8));
+	return m_utf8Data;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_HTMLPAGESTREAM_H__
+#define __BFR_HTMLPAGESTREAM_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QString>
+#include <QtCore/QTextCodec>
+
+#include <memory>
+
+// Receiver of the HTML page bytes being downloaded:
+// - chunks are appended to the pre-reserved buffer, without per-chunk reallocations;
+// - page charset is detected as soon as the first kilobyte has arrived, and every following chunk
+//   is transcoded immediately, i.e. while the page tail is still being downloaded;
+// - UTF-8 result shares the raw buffer (no copy, no transcoding) if the page is already UTF-8 encoded
+class HtmlPageStream {
+	// Delete copy constructor and assign operator
+	HtmlPageStream(HtmlPageStream const &) = delete; // Copy construct
+	HtmlPageStream &operator=(HtmlPageStream const &) = delete; // Copy assign
+
+public:
+	enum class Mode { Invalid = -1, Raw = 0, DecodeToUtf8 = 1, Count };
+
+	// Forum HTML page average size is around 400 Kb
+	static const int DefaultPageSize = 512 * 1024;
+	// NOTE: QTextCodec::codecForHtml looks for the charset in the first 1024 bytes only
+	static const int CharsetDetectionSize = 1024;
+
+	explicit HtmlPageStream(Mode mode = Mode::DecodeToUtf8, int expectedSize = DefaultPageSize);
+	HtmlPageStream(HtmlPageStream &&) = default; // Move construct
+	HtmlPageStream &operator=(HtmlPageStream &&) = default; // Move assign
+	~HtmlPageStream() = default;
+
+	Mode mode() const;
+	void clear();
+	// Enlarge the buffer if the page size is known in advance, e.g. from the Content-Length header
+	void reserve(qint64 size);
+
+	void append(const char *data, int size);
+	// Read all the available data from the device directly to the page buffer
+	qint64 appendFrom(QIODevice *device);
+	// Must be called after the last chunk was appended
+	void finish();
+
+	bool isEmpty() const;
+	int size() const;
+	bool isFinished() const;
+
+	const QByteArray &rawData() const;
+	// Page contents converted to UTF-8; available in DecodeToUtf8 mode after finish() call only
+	QByteArray utf8Data() const;
+
+private:
+	void onAppended(int offset, int size);
+	void startDecoding();
+
+	Mode m_mode;
+	QByteArray m_rawData;
+
+	QTextCodec *m_codec;
+	bool m_isUtf8;
+	std::unique_ptr<QTextDecoder> m_decoder;
+	QString m_decodedText;
+
+	QByteArray m_utf8Data;
+	bool m_finished;
+};
+
+#endif // __BFR_HTMLPAGESTREAM_H__
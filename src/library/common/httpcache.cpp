@@ -0,0 +1,265 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "httpcache.h"
+
+#include <common/logger.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+namespace {
+const quint32 CacheEntryMagic = 0x42465243; // "BFRC"
+const quint32 CacheEntryVersion = 1;
+}
+
+HttpCache::HttpCache()
+	: m_mutex()
+	, m_cacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/http"))
+	, m_enabled(true)
+	, m_maximumSize(DefaultMaximumSize)
+	, m_cacheSize(-1)
+	, m_revalidatedCount(0)
+	, m_storedCount(0) { }
+
+HttpCache &HttpCache::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created, it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static HttpCache instance;
+	return instance;
+}
+
+bool HttpCache::isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+void HttpCache::setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+QString HttpCache::cacheDirectory() const {
+
+	QMutexLocker locker(&m_mutex);
+	return m_cacheDirectory;
+}
+
+void HttpCache::setCacheDirectory(const QString &path) {
+
+	QMutexLocker locker(&m_mutex);
+	m_cacheDirectory = path;
+	m_cacheSize = -1;
+}
+
+qint64 HttpCache::maximumSize() const {
+
+	QMutexLocker locker(&m_mutex);
+	return m_maximumSize;
+}
+
+void HttpCache::setMaximumSize(qint64 size) {
+
+	Q_ASSERT(size > 0);
+
+	QMutexLocker locker(&m_mutex);
+	m_maximumSize = size;
+}
+
+qint64 HttpCache::cacheSize() const {
+
+	QMutexLocker locker(&m_mutex);
+	return (m_cacheSize >= 0) ? m_cacheSize : calculateCacheSize();
+}
+
+qint64 HttpCache::calculateCacheSize() const {
+
+	// NOTE: network library disk cache lives in the subdirectory, and has its own limit
+	qint64 result = 0;
+	const QFileInfoList entries = QDir(m_cacheDirectory).entryInfoList(QDir::Files);
+	for (const QFileInfo &entry : entries)
+		result += entry.size();
+	return result;
+}
+
+void HttpCache::evict(const QString &keptFilePath) {
+
+	const qint64 targetSize = m_maximumSize / 10 * 9;
+	const QString keptFileName = QFileInfo(keptFilePath).fileName();
+
+	// Oldest entries first
+	const QFileInfoList entries = QDir(m_cacheDirectory).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+	for (const QFileInfo &entry : entries) {
+		if (m_cacheSize <= targetSize)
+			break;
+		if (entry.fileName() == keptFileName)
+			continue;
+
+		if (QFile::remove(entry.filePath()))
+			m_cacheSize -= entry.size();
+	}
+
+	SystemLogger->debug("HTTP cache was shrunk to {} bytes", m_cacheSize);
+}
+
+QString HttpCache::entryFilePath(const QString &urlStr) const {
+
+	// NOTE: URL is hashed to get the valid file name of the fixed length
+	const QByteArray urlHash = QCryptographicHash::hash(urlStr.toUtf8(), QCryptographicHash::Sha1).toHex();
+	return m_cacheDirectory + QLatin1Char('/') + QString::fromLatin1(urlHash);
+}
+
+// Entry file layout: magic, version, URL, validators, body;
+// the body is the last one, so validators can be read without reading the whole page
+bool HttpCache::readEntry(const QString &urlStr, Validators &validators, QByteArray *body) const {
+
+	QFile file(entryFilePath(urlStr));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_12);
+
+	quint32 magic = 0;
+	quint32 version = 0;
+	QString entryUrlStr;
+	stream >> magic >> version;
+	if ((magic != CacheEntryMagic) || (version != CacheEntryVersion))
+		return false;
+
+	stream >> entryUrlStr >> validators.m_etag >> validators.m_lastModified;
+	// NOTE: protect from the hash collision
+	if ((stream.status() != QDataStream::Ok) || (entryUrlStr != urlStr))
+		return false;
+
+	if (body) {
+		stream >> *body;
+		if (stream.status() != QDataStream::Ok)
+			return false;
+	}
+	return true;
+}
+
+HttpCache::Validators HttpCache::validators(const QString &urlStr) const {
+
+	if (!isEnabled())
+		return Validators();
+
+	QMutexLocker locker(&m_mutex);
+
+	Validators result;
+	if (!readEntry(urlStr, result, nullptr))
+		return Validators();
+	return result;
+}
+
+bool HttpCache::load(const QString &urlStr, QByteArray &body) {
+
+	QMutexLocker locker(&m_mutex);
+
+	Validators validators;
+	if (!readEntry(urlStr, validators, &body)) {
+		SystemLogger->error("Unable to read HTTP cache entry of URL '{}'", urlStr);
+		return false;
+	}
+
+	// NOTE: modification time is the entry usage time for the eviction
+	QFile file(entryFilePath(urlStr));
+	if (file.open(QIODevice::ReadOnly))
+		file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+
+	m_revalidatedCount.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool HttpCache::store(const QString &urlStr, const QByteArray &body, const Validators &validators) {
+
+	if (!isEnabled() || validators.isEmpty())
+		return false;
+
+	QMutexLocker locker(&m_mutex);
+
+	if (!QDir().mkpath(m_cacheDirectory)) {
+		SystemLogger->error("Unable to create HTTP cache directory '{}'", m_cacheDirectory);
+		return false;
+	}
+
+	const QString filePath = entryFilePath(urlStr);
+	const qint64 oldFileSize = QFileInfo(filePath).size();
+
+	// NOTE: QSaveFile replaces the old entry atomically, so the reader will never see the partially written one
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly)) {
+		SystemLogger->error("Unable to write HTTP cache entry '{}'", file.fileName());
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_12);
+	stream << CacheEntryMagic << CacheEntryVersion;
+	stream << urlStr << validators.m_etag << validators.m_lastModified << body;
+	if ((stream.status() != QDataStream::Ok) || !file.commit()) {
+		SystemLogger->error("Unable to write HTTP cache entry '{}'", file.fileName());
+		return false;
+	}
+
+	m_storedCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (m_cacheSize < 0)
+		m_cacheSize = calculateCacheSize();
+	else
+		m_cacheSize += QFileInfo(filePath).size() - oldFileSize;
+	if (m_cacheSize > m_maximumSize)
+		evict(filePath);
+	return true;
+}
+
+void HttpCache::remove(const QString &urlStr) {
+
+	QMutexLocker locker(&m_mutex);
+
+	const QString filePath = entryFilePath(urlStr);
+	const qint64 fileSize = QFileInfo(filePath).size();
+	if (QFile::remove(filePath) && (m_cacheSize >= 0))
+		m_cacheSize -= fileSize;
+}
+
+void HttpCache::clear() {
+
+	QMutexLocker locker(&m_mutex);
+	QDir(m_cacheDirectory).removeRecursively();
+	m_cacheSize = -1;
+}
+
+quint64 HttpCache::revalidatedCount() const { return m_revalidatedCount.load(std::memory_order_relaxed); }
+
+void HttpCache::registerRevalidated() { m_revalidatedCount.fetch_add(1, std::memory_order_relaxed); }
+
+quint64 HttpCache::storedCount() const { return m_storedCount.load(std::memory_order_relaxed); }
+
+void HttpCache::resetStatistics() {
+
+	m_revalidatedCount.store(0, std::memory_order_relaxed);
+	m_storedCount.store(0, std::memory_order_relaxed);
+}
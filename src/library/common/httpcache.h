@@ -0,0 +1,109 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_HTTPCACHE_H__
+#define __BFR_HTTPCACHE_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <atomic>
+
+// Persistent on-disk HTTP cache of the downloaded pages:
+// - every response with ETag and/or Last-Modified header is stored to disk together with these validators;
+// - next request of the same URL is sent with If-None-Match / If-Modified-Since headers,
+//   so the unchanged page costs just a header round-trip, and 304 response body is read from disk;
+// - total size of the entries is limited: the least recently used ones are evicted on store
+class HttpCache {
+	// Delete copy and move constructors and assign operators
+	HttpCache(HttpCache const &) = delete; // Copy construct
+	HttpCache(HttpCache &&) = delete; // Move construct
+	HttpCache &operator=(HttpCache const &) = delete; // Copy assign
+	HttpCache &operator=(HttpCache &&) = delete; // Move assign
+
+public:
+	struct Validators {
+		QByteArray m_etag;
+		QByteArray m_lastModified;
+
+		bool isEmpty() const { return m_etag.isEmpty() && m_lastModified.isEmpty(); }
+	};
+
+	// The same limit as the network library disk cache one, see DownloadSession::NetworkCacheMaxSize
+	static const qint64 DefaultMaximumSize = 64 * 1024 * 1024;
+
+protected:
+	mutable QMutex m_mutex;
+	QString m_cacheDirectory;
+	std::atomic<bool> m_enabled;
+	qint64 m_maximumSize;
+	// Total size of the entry files; -1 if it was not calculated yet
+	qint64 m_cacheSize;
+
+	std::atomic<quint64> m_revalidatedCount;
+	std::atomic<quint64> m_storedCount;
+
+	HttpCache();
+	~HttpCache() = default;
+
+	QString entryFilePath(const QString &urlStr) const;
+	bool readEntry(const QString &urlStr, Validators &validators, QByteArray *body) const;
+	qint64 calculateCacheSize() const;
+	// Remove the least recently used entries (by the file modification time), except the specified one,
+	// until the cache takes no more than 90% of the maximum size
+	void evict(const QString &keptFilePath);
+
+public:
+	static HttpCache &globalInstance();
+
+public:
+	bool isEnabled() const;
+	void setEnabled(bool enabled);
+
+	// Default is the "http" subdirectory of the application cache directory
+	QString cacheDirectory() const;
+	void setCacheDirectory(const QString &path);
+
+	qint64 maximumSize() const;
+	void setMaximumSize(qint64 size);
+	qint64 cacheSize() const;
+
+	// Validators of the stored URL response; empty if there is no cache entry
+	Validators validators(const QString &urlStr) const;
+	// Read the stored response body, i.e. serve the 304 response; the entry becomes the most recently used one
+	bool load(const QString &urlStr, QByteArray &body);
+	// NOTE: responses without validators are not stored, because they can't be revalidated
+	bool store(const QString &urlStr, const QByteArray &body, const Validators &validators);
+	void remove(const QString &urlStr);
+	void clear();
+
+	// Count of the responses served from disk after the successful revalidation
+	quint64 revalidatedCount() const;
+	// Account the response revalidated by the network library own cache, see DownloadSession
+	void registerRevalidated();
+	quint64 storedCount() const;
+	void resetStatistics();
+};
+
+#endif // __BFR_HTTPCACHE_H__
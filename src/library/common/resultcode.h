@@ -33,6 +33,8 @@ enum class Type {
 	OkFalse = 1,
 	Fail,
 	InProgress,
+	// Operation was cancelled by the caller, because its result became obsolete
+	Cancelled,
 	// CURL
 	CurlError,
 	// System
@@ -0,0 +1,94 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "retrypolicy.h"
+
+#include <QtCore/QRandomGenerator>
+
+#include <algorithm>
+
+// RetryPolicy ////////////////////////////////////////////////////////////////
+
+qint64 RetryPolicy::backoffDelayMs(int attempt) const {
+
+	Q_ASSERT(attempt >= 1);
+
+	// NOTE: limit the shift to avoid the overflow
+	const int exponent = qBound(0, attempt - 1, 20);
+	const qint64 maxDelayMs = qMin<qint64>(m_maxDelayMs, static_cast<qint64>(m_baseDelayMs) << exponent);
+	if (maxDelayMs <= 0)
+		return 0;
+
+	// NOTE: delay never exceeds m_maxDelayMs, so it fits to 32 bits
+	return static_cast<qint64>(QRandomGenerator::global()->bounded(static_cast<quint32>(maxDelayMs) + 1));
+}
+
+bool RetryPolicy::isTransientHttpCode(int httpCode) {
+
+	switch (httpCode) {
+	case 408: // Request Timeout
+	case 429: // Too Many Requests
+	case 500: // Internal Server Error
+	case 502: // Bad Gateway
+	case 503: // Service Unavailable
+	case 504: // Gateway Timeout
+		return true;
+	default:
+		return false;
+	}
+}
+
+// LatencyTracker /////////////////////////////////////////////////////////////
+
+LatencyTracker::LatencyTracker()
+	: m_samples()
+	, m_nextSample(0) {
+
+	m_samples.reserve(WindowSize);
+}
+
+void LatencyTracker::addSample(qint64 latencyMs) {
+
+	if (m_samples.size() < WindowSize) {
+		m_samples.append(latencyMs);
+		return;
+	}
+
+	m_samples[m_nextSample] = latencyMs;
+	m_nextSample = (m_nextSample + 1) % WindowSize;
+}
+
+int LatencyTracker::sampleCount() const { return m_samples.size(); }
+
+qint64 LatencyTracker::percentile(int percent) const {
+
+	Q_ASSERT(percent > 0 && percent <= 100);
+	if (m_samples.size() < MinSampleCount)
+		return -1;
+
+	// NOTE: nearest-rank method
+	QVector<qint64> sorted = m_samples;
+	const int rank = qBound(0, (percent * sorted.size() + 99) / 100 - 1, sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
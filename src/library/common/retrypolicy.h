@@ -0,0 +1,64 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_RETRYPOLICY_H__
+#define __BFR_RETRYPOLICY_H__
+
+#include <QtCore/QVector>
+
+// Retry policy of the failed transfers: exponential backoff with full jitter,
+// i.e. random delay in range [0, min(maxDelay, baseDelay * 2^(attempt - 1))];
+// jitter prevents the retries of simultaneously failed requests from hitting the server simultaneously again
+struct RetryPolicy {
+	// Total count of the request attempts, including the first one
+	int m_maxAttempts = 4;
+	int m_baseDelayMs = 250;
+	int m_maxDelayMs = 8000;
+
+	// Delay before the next attempt after the specified failed one (counting from 1)
+	qint64 backoffDelayMs(int attempt) const;
+
+	// Request timeout, rate limiting and server-side errors are worth retrying; other HTTP errors are not
+	static bool isTransientHttpCode(int httpCode);
+};
+
+// Sliding window of the latest transfer latencies, used to estimate the tail latency
+class LatencyTracker {
+public:
+	static const int WindowSize = 128;
+	// Percentiles of the smaller sample are too unreliable
+	static const int MinSampleCount = 20;
+
+	LatencyTracker();
+
+	void addSample(qint64 latencyMs);
+	int sampleCount() const;
+	// Returns -1 if there are not enough samples yet
+	qint64 percentile(int percent) const;
+
+private:
+	QVector<qint64> m_samples;
+	int m_nextSample;
+};
+
+#endif // __BFR_RETRYPOLICY_H__
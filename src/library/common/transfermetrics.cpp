@@ -0,0 +1,214 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "transfermetrics.h"
+
+#include <common/logger.h>
+
+#include <algorithm>
+#include <limits>
+
+// TransferTiming /////////////////////////////////////////////////////////////
+
+qint64 TransferTiming::phaseUs(Phase phase) const {
+
+	switch (phase) {
+	case Phase::Dns:
+		return m_dnsUs;
+	case Phase::Connect:
+		return m_connectUs;
+	case Phase::Tls:
+		return m_tlsUs;
+	case Phase::Ttfb:
+		return m_ttfbUs;
+	case Phase::Transfer:
+		return m_transferUs;
+	case Phase::Total:
+		return m_totalUs;
+	default:
+		Q_ASSERT_X(false, Q_FUNC_INFO, "invalid transfer phase");
+		return -1;
+	}
+}
+
+const char *TransferTiming::phaseName(Phase phase) {
+
+	switch (phase) {
+	case Phase::Dns:
+		return "dns";
+	case Phase::Connect:
+		return "connect";
+	case Phase::Tls:
+		return "tls";
+	case Phase::Ttfb:
+		return "ttfb";
+	case Phase::Transfer:
+		return "transfer";
+	case Phase::Total:
+		return "total";
+	default:
+		Q_ASSERT_X(false, Q_FUNC_INFO, "invalid transfer phase");
+		return "";
+	}
+}
+
+// TimingHistogram ////////////////////////////////////////////////////////////
+
+TimingHistogram::TimingHistogram()
+	: m_buckets(BucketCount, 0)
+	, m_count(0)
+	, m_sumUs(0)
+	, m_minUs(std::numeric_limits<qint64>::max())
+	, m_maxUs(0) { }
+
+void TimingHistogram::addValue(qint64 valueUs) {
+
+	if (valueUs < 0)
+		return;
+
+	// NOTE: zero values go to the first bucket together with 1 us ones
+	int bucket = 0;
+	for (qint64 v = valueUs >> 1; (v > 0) && (bucket < BucketCount - 1); v >>= 1)
+		bucket++;
+	m_buckets[bucket]++;
+
+	m_count++;
+	m_sumUs += valueUs;
+	m_minUs = qMin(m_minUs, valueUs);
+	m_maxUs = qMax(m_maxUs, valueUs);
+}
+
+void TimingHistogram::clear() { *this = TimingHistogram(); }
+
+quint64 TimingHistogram::count() const { return m_count; }
+
+qint64 TimingHistogram::sumUs() const { return m_sumUs; }
+
+qint64 TimingHistogram::minUs() const { return (m_count > 0) ? m_minUs : -1; }
+
+qint64 TimingHistogram::maxUs() const { return (m_count > 0) ? m_maxUs : -1; }
+
+qint64 TimingHistogram::meanUs() const { return (m_count > 0) ? m_sumUs / static_cast<qint64>(m_count) : -1; }
+
+qint64 TimingHistogram::percentileUs(int percent) const {
+
+	Q_ASSERT(percent > 0 && percent <= 100);
+	if (m_count == 0)
+		return -1;
+
+	// NOTE: nearest-rank method
+	const quint64 rank = (static_cast<quint64>(percent) * m_count + 99) / 100;
+	quint64 seen = 0;
+	for (int i = 0; i < BucketCount; ++i) {
+		seen += m_buckets[i];
+		if (seen >= rank)
+			return qBound(m_minUs, bucketUpperBoundUs(i), m_maxUs);
+	}
+	return m_maxUs;
+}
+
+qint64 TimingHistogram::bucketUpperBoundUs(int bucket) {
+
+	Q_ASSERT(bucket >= 0 && bucket < BucketCount);
+	return (static_cast<qint64>(1) << (bucket + 1)) - 1;
+}
+
+const QVector<quint64> &TimingHistogram::buckets() const { return m_buckets; }
+
+// TransferMetrics ////////////////////////////////////////////////////////////
+
+TransferMetrics::TransferMetrics()
+	: m_mutex()
+	, m_data()
+	, m_nextRecent(0) {
+
+	m_data.m_phases.resize(static_cast<int>(TransferTiming::Phase::Count));
+	m_data.m_recent.reserve(RecentTransferCount);
+}
+
+TransferMetrics &TransferMetrics::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created, it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static TransferMetrics instance;
+	return instance;
+}
+
+void TransferMetrics::record(const TransferTiming &timing) {
+
+#ifdef BFR_PRINT_DEBUG_OUTPUT
+	SystemLogger->info("Transfer of URL '{}': HTTP {}, dns {} us, connect {} us, tls {} us, ttfb {} us, "
+		"transfer {} us, total {} us, {} bytes received, {} bytes decoded",
+		timing.m_url, timing.m_httpCode, timing.m_dnsUs, timing.m_connectUs, timing.m_tlsUs, timing.m_ttfbUs,
+		timing.m_transferUs, timing.m_totalUs, timing.m_bytesReceived, timing.m_bytesDecoded);
+#endif
+
+	QMutexLocker locker(&m_mutex);
+
+	m_data.m_transferCount++;
+	if (!timing.m_ok)
+		m_data.m_failedCount++;
+	if (timing.m_bytesReceived > 0)
+		m_data.m_bytesReceived += static_cast<quint64>(timing.m_bytesReceived);
+	if (timing.m_bytesDecoded > 0)
+		m_data.m_bytesDecoded += static_cast<quint64>(timing.m_bytesDecoded);
+
+	// NOTE: timings of the failed transfers would distort the server latency statistics
+	if (timing.m_ok) {
+		for (int i = 0; i < static_cast<int>(TransferTiming::Phase::Count); ++i)
+			m_data.m_phases[i].addValue(timing.phaseUs(static_cast<TransferTiming::Phase>(i)));
+	}
+
+	if (m_data.m_recent.size() < RecentTransferCount) {
+		m_data.m_recent.append(timing);
+	} else {
+		m_data.m_recent[m_nextRecent] = timing;
+		m_nextRecent = (m_nextRecent + 1) % RecentTransferCount;
+	}
+}
+
+void TransferMetrics::recordParse(qint64 durationUs) {
+
+	QMutexLocker locker(&m_mutex);
+	m_data.m_parse.addValue(durationUs);
+}
+
+TransferMetricsSnapshot TransferMetrics::snapshot() const {
+
+	QMutexLocker locker(&m_mutex);
+
+	TransferMetricsSnapshot result = m_data;
+	// Ring buffer -> chronological order
+	std::rotate(result.m_recent.begin(), result.m_recent.begin() + m_nextRecent, result.m_recent.end());
+	return result;
+}
+
+void TransferMetrics::reset() {
+
+	QMutexLocker locker(&m_mutex);
+
+	m_data = TransferMetricsSnapshot();
+	m_data.m_phases.resize(static_cast<int>(TransferTiming::Phase::Count));
+	m_data.m_recent.reserve(RecentTransferCount);
+	m_nextRecent = 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_TRANSFERMETRICS_H__
+#define __BFR_TRANSFERMETRICS_H__
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+// Timing breakdown of the single HTTP request, in microseconds; -1 means the value is unknown,
+// e.g. Qt network access manager does not report the connection phases.
+// DNS, connect and TLS are the phase durations, they are zero for the reused connection;
+// TTFB is the time from the request start to the first response byte, it includes the connection phases;
+// transfer is the time from the first to the last response byte
+struct TransferTiming {
+	enum class Phase {
+		Invalid = -1,
+		Dns = 0,
+		Connect,
+		Tls,
+		Ttfb,
+		Transfer,
+		Total,
+		Count
+	};
+
+	QString m_url;
+	bool m_ok = false;
+	int m_httpCode = 0;
+	bool m_reusedConnection = false;
+
+	qint64 m_dnsUs = -1;
+	qint64 m_connectUs = -1;
+	qint64 m_tlsUs = -1;
+	qint64 m_ttfbUs = -1;
+	qint64 m_transferUs = -1;
+	qint64 m_totalUs = -1;
+
+	// Bytes on the wire, i.e. compressed ones if server supports compression
+	qint64 m_bytesReceived = -1;
+	// Decompressed response body size
+	qint64 m_bytesDecoded = -1;
+
+	qint64 phaseUs(Phase phase) const;
+	static const char *phaseName(Phase phase);
+};
+
+// Histogram with exponential buckets: bucket i counts the values in range [2^i, 2^(i+1)) microseconds,
+// i.e. from 1 us up to 35 minutes; percentiles are estimated as the upper bound of the bucket
+class TimingHistogram {
+public:
+	static const int BucketCount = 32;
+
+	TimingHistogram();
+
+	void addValue(qint64 valueUs);
+	void clear();
+
+	quint64 count() const;
+	qint64 sumUs() const;
+	qint64 minUs() const;
+	qint64 maxUs() const;
+	qint64 meanUs() const;
+	// Returns -1 if the histogram is empty
+	qint64 percentileUs(int percent) const;
+
+	static qint64 bucketUpperBoundUs(int bucket);
+	const QVector<quint64> &buckets() const;
+
+private:
+	QVector<quint64> m_buckets;
+	quint64 m_count;
+	qint64 m_sumUs;
+	qint64 m_minUs;
+	qint64 m_maxUs;
+};
+
+struct TransferMetricsSnapshot {
+	quint64 m_transferCount = 0;
+	quint64 m_failedCount = 0;
+	quint64 m_bytesReceived = 0;
+	quint64 m_bytesDecoded = 0;
+	// Indexed by TransferTiming::Phase
+	QVector<TimingHistogram> m_phases;
+	// Time of the page HTML parsing, to tell the network delays from the parser ones
+	TimingHistogram m_parse;
+	// Latest transfers, oldest first
+	QVector<TransferTiming> m_recent;
+};
+
+// Aggregated timing statistics of all the HTTP requests, filled by FileDownloader
+class TransferMetrics {
+	// Delete copy and move constructors and assign operators
+	TransferMetrics(TransferMetrics const &) = delete; // Copy construct
+	TransferMetrics(TransferMetrics &&) = delete; // Move construct
+	TransferMetrics &operator=(TransferMetrics const &) = delete; // Copy assign
+	TransferMetrics &operator=(TransferMetrics &&) = delete; // Move assign
+
+public:
+	static const int RecentTransferCount = 64;
+
+protected:
+	mutable QMutex m_mutex;
+	TransferMetricsSnapshot m_data;
+	int m_nextRecent;
+
+	TransferMetrics();
+	~TransferMetrics() = default;
+
+public:
+	static TransferMetrics &globalInstance();
+
+public:
+	void record(const TransferTiming &timing);
+	void recordParse(qint64 durationUs);
+
+	TransferMetricsSnapshot snapshot() const;
+	void reset();
+};
+
+#endif // __BFR_TRANSFERMETRICS_H__
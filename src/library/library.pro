@@ -72,29 +72,60 @@ CONFIG(debug, debug|release) {
 #######################################################################################################################
 
 SOURCES += \
+    common/cancellationtoken.cpp            \
+    common/crawlthrottle.cpp                \
+    common/downloadscheduler.cpp            \
+    common/downloadsession.cpp              \
+    common/downloadtransport.cpp            \
     common/filedownloader.cpp               \
     common/forumthreadurl.cpp               \
+    common/htmlpagestream.cpp               \
+    common/httpcache.cpp                    \
+    common/retrypolicy.cpp                  \
+    common/transfermetrics.cpp              \
     parser_frontend/forumthreadpool.cpp     \
     website_backend/gumboparserimpl.cpp     \
+    website_backend/qtgumboallocator.cpp    \
     website_backend/qtgumbodocument.cpp     \
     website_backend/qtgumbonode.cpp         \
+    website_backend/qtgumbonodeindex.cpp    \
+    website_backend/qtgumboselector.cpp     \
     website_backend/websiteinterface.cpp    \
     website_backend/websiteinterface_qt.cpp
 
 HEADERS += \
+    common/cancellationtoken.h              \
+    common/crawlthrottle.h                  \
+    common/downloadscheduler.h              \
+    common/downloadsession.h                \
+    common/downloadtransport.h              \
     common/filedownloader.h                 \
     common/forumthreadurl.h                 \
+    common/htmlpagestream.h                 \
+    common/httpcache.h                      \
     common/logger.h                         \
     common/resultcode.h                     \
+    common/retrypolicy.h                    \
+    common/transfermetrics.h                \
     parser_frontend/forumthreadpool.h       \
     website_backend/gumboparserimpl.h       \
     website_backend/html_tag.h              \
+    website_backend/qtgumboallocator.h      \
     website_backend/qtgumbodocument.h       \
     website_backend/qtgumbonode.h           \
+    website_backend/qtgumbonodeindex.h      \
+    website_backend/qtgumboselector.h       \
+    website_backend/qtgumbotreewalker.h     \
     website_backend/websiteinterface.h      \
     website_backend/websiteinterface_fwd.h  \
     website_backend/websiteinterface_qt.h
 
+# libcurl socket loop is used by the async API only
+bfr_use_curl {
+    SOURCES += common/curlsocketloop.cpp
+    HEADERS += common/curlsocketloop.h
+}
+
 #######################################################################################################################
 
 # Static libraries for different architectures live in different directories
@@ -25,8 +25,38 @@
 
 #include <website_backend/gumboparserimpl.h>
 
+#include <QtCore/QElapsedTimer>
+#include <QtConcurrent/QtConcurrentRun>
+
+namespace {
+// NOTE: all the forum threads are located on the same host
+QString forumHost() { return QUrl(ForumThreadUrl().firstPageUrl()).host(); }
+}
+
 ForumThreadPool::ForumThreadPool(QObject *parent) : QObject(parent)
 {
+	setCrawlRate(CrawlRequestsPerSecond, CrawlBurst);
+	// NOTE: duplicate requests are sent only for the slowest 5% of pages, so the extra load is negligible
+	FileDownloader::setHedgingEnabled(true);
+}
+
+void ForumThreadPool::setCrawlRate(double requestsPerSecond, double burst) {
+
+	CrawlThrottle::globalInstance().setHostRate(forumHost(), requestsPerSecond, burst);
+}
+
+CrawlThrottle::Metrics ForumThreadPool::crawlMetrics() const { return CrawlThrottle::globalInstance().metrics(forumHost()); }
+
+result_code::Type ForumThreadPool::warmUpConnection() {
+
+	const QString urlStr = ForumThreadUrl().firstPageUrl();
+	SystemLogger->debug("Warming up the connection to forum host '{}'...", forumHost());
+	// NOTE: network may be unavailable yet, it's not an error: the connection will be opened on demand then
+	if (!FileDownloader::prewarmConnection(urlStr)) {
+		SystemLogger->warn("Unable to warm up the connection to forum host '{}'", forumHost());
+		return result_code::Type::NetworkError;
+	}
+	return result_code::Type::Ok;
 }
 
 size_t ForumThreadPool::pageCountCacheSize() const {
@@ -54,9 +84,9 @@ size_t ForumThreadPool::pagePostsCacheSize() const {
 	return result;
 }
 
-void ForumThreadPool::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
+void ForumThreadPool::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded) {
 	
-	emit downloadProgress(bytesReceived, bytesTotal);
+	emit downloadProgress(bytesReceived, bytesTotal, bytesDecoded);
 }
 
 ForumThreadPool &ForumThreadPool::globalInstance() {
@@ -67,7 +97,8 @@ ForumThreadPool &ForumThreadPool::globalInstance() {
 	return instance;
 }
 
-result_code::Type ForumThreadPool::getForumThreadPageCount(const ForumThreadUrlData &urlData, int &pageCount) {
+result_code::Type ForumThreadPool::getForumThreadPageCount(
+	const ForumThreadUrlData &urlData, int &pageCount, const CancellationToken &token) {
 
 	QScopedPointer<ForumThreadUrl> url(new ForumThreadUrl(urlData.m_sectionId, urlData.m_threadId));
 
@@ -79,24 +110,40 @@ result_code::Type ForumThreadPool::getForumThreadPageCount(const ForumThreadUrlD
 		return result_code::Type::Ok;
 	}
 
-	// 1) Download the first forum web page
+	// 1) Download the first forum web page until the page count expression is received
 	SystemLogger->debug(
 		"Forum thread '{}' was not parsed yet, no page count in the pagecount-cache", url->firstPageUrl());
-	SystemLogger->debug("Downloading first page of forum thread '{}'...", url->firstPageUrl());
-	QByteArray htmlRawData;
-	BFR_RETURN_VALUE_IF(
-		!FileDownloader::downloadUrl(url->firstPageUrl(), htmlRawData,
-			std::bind(&ForumThreadPool::onDownloadProgress, this, std::placeholders::_1, std::placeholders::_2)),
-		result_code::Type::NetworkError, "Unable to download first forum thread page");
-	SystemLogger->debug("Forum thread '{}' first page has been downloaded", url->firstPageUrl());
-
-	// 2) Parse the page HTML to get the page count
+	SystemLogger->debug("Probing first page of forum thread '{}'...", url->firstPageUrl());
 	bfr::ForumPageParser fpp;
 	int pageCountTemp = -1;
-	SystemLogger->debug("Parsing first page of forum thread '{}'...", url->firstPageUrl());
-	result_code::Type result = fpp.getPageCount(htmlRawData, pageCountTemp);
-	BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to parse first forum thread page");
-	SystemLogger->debug("Forum thread '{}' first page has been parsed", url->firstPageUrl());
+	HtmlPageStream page;
+	bool pageComplete = false;
+	const bool probeOk = FileDownloader::probeUrl(url->firstPageUrl(), page,
+		[&fpp, &pageCountTemp](const QByteArray &rawData, int chunkOffset) {
+			return fpp.probePageCount(rawData, chunkOffset, pageCountTemp);
+		},
+		pageComplete,
+		std::bind(&ForumThreadPool::onDownloadProgress, this, std::placeholders::_1, std::placeholders::_2,
+			std::placeholders::_3),
+		token);
+	if (!probeOk && token.isCancelled())
+		return result_code::Type::Cancelled;
+	BFR_RETURN_VALUE_IF(!probeOk, result_code::Type::NetworkError, "Unable to download first forum thread page");
+	SystemLogger->debug("Forum thread '{}' first page has been probed: {} bytes received, complete: {}",
+		url->firstPageUrl(), page.size(), pageComplete);
+
+	// 2) Probe did not match, so the whole page was downloaded: parse it as usual,
+	//    and keep its posts to avoid the second download of the same page
+	if (pageComplete) {
+		SystemLogger->debug("Parsing first page of forum thread '{}'...", url->firstPageUrl());
+		result_code::Type result = fpp.getPageCount(page.rawData(), pageCountTemp);
+		BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to parse first forum thread page");
+		SystemLogger->debug("Forum thread '{}' first page has been parsed", url->firstPageUrl());
+
+		bfr::PostList posts;
+		result = parseForumPage(urlData, 1, page, posts);
+		BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to parse first forum thread page");
+	}
 
 	// 4) Update cache
 	pageCount = pageCountTemp;
@@ -107,7 +154,8 @@ result_code::Type ForumThreadPool::getForumThreadPageCount(const ForumThreadUrlD
 	return result_code::Type::Ok;
 }
 
-result_code::Type ForumThreadPool::getForumPagePosts(const ForumThreadUrlData &urlData, const int pageNo, bfr::PostList &posts) {
+result_code::Type ForumThreadPool::getForumPagePosts(
+	const ForumThreadUrlData &urlData, const int pageNo, bfr::PostList &posts, const CancellationToken &token) {
 
 	QScopedPointer<ForumThreadUrl> url(new ForumThreadUrl(urlData.m_sectionId, urlData.m_threadId));
 
@@ -125,47 +173,159 @@ result_code::Type ForumThreadPool::getForumPagePosts(const ForumThreadUrlData &u
 	SystemLogger->debug(
 		"Forum thread '{}' was not parsed yet, no page posts in the pageposts-cache", url->pageUrl(pageNo));
 	SystemLogger->debug("Downloading first page of forum thread '{}'...", url->pageUrl(pageNo));
-	QByteArray htmlRawData;
-	BFR_RETURN_VALUE_IF(
-		!FileDownloader::downloadUrl(url->pageUrl(pageNo), htmlRawData,
-			std::bind(&ForumThreadPool::onDownloadProgress, this, std::placeholders::_1, std::placeholders::_2)),
-		result_code::Type::NetworkError, "Unable to download specified forum thread page");
+	HtmlPageStream page;
+	const bool downloadOk = FileDownloader::downloadUrl(url->pageUrl(pageNo), page,
+		std::bind(&ForumThreadPool::onDownloadProgress, this, std::placeholders::_1, std::placeholders::_2,
+			std::placeholders::_3),
+		token);
+	if (!downloadOk && token.isCancelled())
+		return result_code::Type::Cancelled;
+	BFR_RETURN_VALUE_IF(!downloadOk, result_code::Type::NetworkError, "Unable to download specified forum thread page");
 	SystemLogger->debug("Forum thread '{}' specified page has been downloaded", url->pageUrl(pageNo));
 
+	return parseForumPage(urlData, pageNo, page, posts, token);
+}
+
+result_code::Type ForumThreadPool::parseForumPage(const ForumThreadUrlData &urlData, const int pageNo,
+	const HtmlPageStream &page, bfr::PostList &posts, const CancellationToken &token) {
+
+	// NOTE: page was already converted to UTF-8 while downloading
+	PageParseResult parseResult = parsePage(urlData, pageNo, page.rawData(), page.utf8Data(), token);
+	if (result_code::failed(parseResult.m_result))
+		return parseResult.m_result;
+
+	// 4) Update cache
+	cachePagePosts(urlData, pageNo, parseResult.m_posts);
+	posts.swap(parseResult.m_posts);
+	return result_code::Type::Ok;
+}
+
+ForumThreadPool::PageParseResult ForumThreadPool::parsePage(const ForumThreadUrlData &urlData, const int pageNo,
+	const QByteArray &rawData, const QByteArray &utf8Data, const CancellationToken &token) {
+
+	PageParseResult parseResult;
+	QScopedPointer<ForumThreadUrl> url(new ForumThreadUrl(urlData.m_sectionId, urlData.m_threadId));
+	if (token.isCancelled()) {
+		SystemLogger->debug("Parsing of forum thread '{}' page was cancelled", url->pageUrl(pageNo));
+		parseResult.m_result = result_code::Type::Cancelled;
+		return parseResult;
+	}
+
+	// NOTE: parse time is measured to tell the slow parsing from the slow network, see TransferMetrics
+	QElapsedTimer parseTimer;
+	parseTimer.start();
+
 	// 2) Parse the page HTML to get the page count
+	// NOTE: parser instance is local, so the pages can be parsed on different threads
 	bfr::ForumPageParser fpp;
 	int pageCount = -1;
 	SystemLogger->debug("Parsing specified page of forum thread '{}': page count...", url->pageUrl(pageNo));
-	result_code::Type result = fpp.getPageCount(htmlRawData, pageCount);
-	BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to parse specified forum thread page");
+	parseResult.m_result = fpp.getPageCount(rawData, pageCount);
+	BFR_RETURN_VALUE_IF(result_code::failed(parseResult.m_result), parseResult,
+		"Unable to parse specified forum thread page");
 	SystemLogger->debug("Forum thread '{}' specified page has been parsed: page count", url->pageUrl(pageNo));
 
 	// 3) Parse the page HTML to get the page user posts
-	bfr::PostList postsTemp;
+	if (token.isCancelled()) {
+		parseResult.m_result = result_code::Type::Cancelled;
+		return parseResult;
+	}
 	SystemLogger->debug("Parsing specified page of forum thread '{}': page posts...", url->pageUrl(pageNo));
-	result = fpp.getPagePosts(htmlRawData, postsTemp);
-	BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to parse specified forum thread page");
+	parseResult.m_result = fpp.getPagePostsUtf8(utf8Data, parseResult.m_posts);
+	BFR_RETURN_VALUE_IF(result_code::failed(parseResult.m_result), parseResult,
+		"Unable to parse specified forum thread page");
 	SystemLogger->debug("Forum thread '{}' specified page has been parsed: page posts", url->pageUrl(pageNo));
+	TransferMetrics::globalInstance().recordParse(parseTimer.nsecsElapsed() / 1000);
+	return parseResult;
+}
 
-	// 4) Update cache
-	m_threadPagePostCollection[urlData][pageNo] = postsTemp;
-	posts.swap(postsTemp);
+QFuture<ForumThreadPool::PageParseResult> ForumThreadPool::startPageParse(
+	const ForumThreadUrlData &urlData, const int pageNo, const HtmlPageStream &page, const CancellationToken &token) {
+
+	// NOTE: page data is implicitly shared, so it's not copied to the task
+	return QtConcurrent::run(&ForumThreadPool::parsePage, urlData, pageNo, page.rawData(), page.utf8Data(), token);
+}
+
+result_code::Type ForumThreadPool::finishPageParses(const ForumThreadUrlData &urlData, PageParseFutureMap &parses,
+	const bool wait, const int pageCount, int &parsedPageCount) {
+
+	result_code::Type result = result_code::Type::Ok;
+	for (auto iParse = parses.begin(); iParse != parses.end();) {
+		if (!wait && !iParse.value().isFinished()) {
+			++iParse;
+			continue;
+		}
+
+		// NOTE: result() blocks until the task is finished
+		const PageParseResult parseResult = iParse.value().result();
+		if (result_code::succeeded(parseResult.m_result)) {
+			cachePagePosts(urlData, iParse.key(), parseResult.m_posts);
+			emit threadParseProgress(++parsedPageCount, pageCount);
+		} else if (result_code::succeeded(result)) {
+			result = parseResult.m_result;
+		}
+		iParse = parses.erase(iParse);
+	}
+	return result;
+}
+
+void ForumThreadPool::cachePagePosts(const ForumThreadUrlData &urlData, const int pageNo, const bfr::PostList &posts) {
+
+	QScopedPointer<ForumThreadUrl> url(new ForumThreadUrl(urlData.m_sectionId, urlData.m_threadId));
+	m_threadPagePostCollection[urlData][pageNo] = posts;
 	SystemLogger->debug(
 		"Forum thread '{}' page posts (count: {}) was added to pageposts-cache", url->pageUrl(pageNo), posts.size());
 	SystemLogger->debug("New size of pageposts-cache: {} bytes", pagePostsCacheSize());
-	return result_code::Type::Ok;
 }
 
-result_code::Type ForumThreadPool::getForumThreadPosts(const ForumThreadUrlData &urlData, bfr::PostList &posts) {
+result_code::Type ForumThreadPool::getForumThreadPosts(
+	const ForumThreadUrlData &urlData, bfr::PostList &posts, const CancellationToken &token) {
 
 	QScopedPointer<ForumThreadUrl> url(new ForumThreadUrl(urlData.m_sectionId, urlData.m_threadId));
 
 	// 1) Get thread page count
 	int pageCount = -1;
-	result_code::Type result = getForumThreadPageCount(urlData, pageCount);
+	result_code::Type result = getForumThreadPageCount(urlData, pageCount, token);
+	if (result == result_code::Type::Cancelled)
+		return result;
 	BFR_RETURN_VALUE_IF(result_code::failed(result), result, "Unable to get forum thread page count");
 
-	// 2) Load and parse absent pages
+	// 2) Download absent pages concurrently, parsing each one on the thread pool as soon as it arrives
+	QStringList absentPageUrls;
+	QVector<int> absentPageNumbers;
+	for (int i = 1; i <= pageCount; i++) {
+		if (m_threadPagePostCollection.value(urlData).contains(i))
+			continue;
+
+		absentPageUrls << url->pageUrl(i);
+		absentPageNumbers << i;
+	}
+
+	SystemLogger->debug("Downloading {} absent pages of forum thread '{}'...", absentPageUrls.size(), url->firstPageUrl());
+	int parsedPageCount = pageCount - absentPageUrls.size();
+	result_code::Type parseResult = result_code::Type::Ok;
+	PageParseFutureMap parses;
+	bool downloadOk = FileDownloader::downloadUrls(absentPageUrls, MaxParallelPageDownloads,
+		[&](int index, const QString & /*urlStr*/, bool ok, const HtmlPageStream &page) {
+			// NOTE: the already parsed pages are cached here to report the progress while downloading
+			const result_code::Type finishResult = finishPageParses(urlData, parses, false, pageCount, parsedPageCount);
+			if (result_code::succeeded(parseResult))
+				parseResult = finishResult;
+			if (!ok || result_code::failed(parseResult))
+				return;
+
+			parses.insert(absentPageNumbers[index], startPageParse(urlData, absentPageNumbers[index], page, token));
+		},
+		token);
+	const result_code::Type finishResult = finishPageParses(urlData, parses, true, pageCount, parsedPageCount);
+	if (result_code::succeeded(parseResult))
+		parseResult = finishResult;
+	if (token.isCancelled())
+		return result_code::Type::Cancelled;
+	BFR_RETURN_VALUE_IF(!downloadOk, result_code::Type::NetworkError, "Unable to download forum thread pages");
+	BFR_RETURN_VALUE_IF(result_code::failed(parseResult), parseResult, "Unable to parse forum thread pages");
+
+	// 3) Collect the posts of all pages in order
 	bfr::PostList postsTemp;
 	for (int i = 1; i <= pageCount; i++) {
 		result = getForumPagePosts(urlData, i, postsTemp);
@@ -173,10 +333,28 @@ result_code::Type ForumThreadPool::getForumThreadPosts(const ForumThreadUrlData
 
 		posts << postsTemp;
 		postsTemp.clear();
-
-		emit threadParseProgress(i, pageCount);
 	}
 
 	SystemLogger->debug("Forum thread '{}' posts has been parsed", url->firstPageUrl());
+	SystemLogger->debug("Connections opened: {}, reused: {}, HTTP/2 transfers: {}, pages revalidated: {}",
+		FileDownloader::connectionsOpened(), FileDownloader::connectionsReused(), FileDownloader::http2Transfers(),
+		FileDownloader::cacheRevalidatedCount());
+
+	const CrawlThrottle::Metrics metrics = crawlMetrics();
+	SystemLogger->debug("Crawl rate: {} req/s, parallel requests: {}, latency: {} ms, requests: {}, congestions: {}, delayed: {}",
+		metrics.m_rate, metrics.m_window, metrics.m_latencyMs, metrics.m_requestCount, metrics.m_congestionCount,
+		metrics.m_delayedCount);
+	SystemLogger->debug("Retries: {}, hedge requests: {}, hedge wins: {}",
+		FileDownloader::retryCount(), FileDownloader::hedgeCount(), FileDownloader::hedgeWinCount());
+
+	const TransferMetricsSnapshot transferMetrics = FileDownloader::transferMetrics();
+	for (int i = 0; i < static_cast<int>(TransferTiming::Phase::Count); ++i) {
+		const TimingHistogram &histogram = transferMetrics.m_phases[i];
+		SystemLogger->debug("Request {} time: p50 {} us, p95 {} us, max {} us",
+			TransferTiming::phaseName(static_cast<TransferTiming::Phase>(i)), histogram.percentileUs(50),
+			histogram.percentileUs(95), histogram.maxUs());
+	}
+	SystemLogger->debug("Page parse time: p50 {} us, p95 {} us, max {} us", transferMetrics.m_parse.percentileUs(50),
+		transferMetrics.m_parse.percentileUs(95), transferMetrics.m_parse.maxUs());
 	return result_code::Type::Ok;
 }
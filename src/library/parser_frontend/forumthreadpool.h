@@ -25,11 +25,15 @@
 #define __BFR_FORUMTHREADPOOL_H__
 
 #include <common/resultcode.h>
+#include <common/cancellationtoken.h>
 #include <common/logger.h>
 #include <common/filedownloader.h>
+#include <common/crawlthrottle.h>
 #include <common/forumthreadurl.h>
 #include <website_backend/websiteinterface_fwd.h>
 
+#include <QtCore/QFuture>
+
 #include <functional>
 
 class ForumThreadPool : public QObject {
@@ -55,11 +59,40 @@ protected:
 	size_t pageCountCacheSize() const;
 	size_t pagePostsCacheSize() const;
 
-	void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+	void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded);
+
+	// Parse the downloaded forum thread page HTML and put the posts to the cache
+	result_code::Type parseForumPage(const ForumThreadUrlData &urlData, const int pageNo, const HtmlPageStream &page,
+		bfr::PostList &posts, const CancellationToken &token = CancellationToken());
+
+	struct PageParseResult {
+		result_code::Type m_result = result_code::Type::Fail;
+		bfr::PostList m_posts;
+	};
+	using PageParseFutureMap = QMap<int /*pageNo*/, QFuture<PageParseResult>>;
+
+	// Parse the downloaded forum thread page HTML; thread-safe, i.e. the caches are not touched
+	static PageParseResult parsePage(const ForumThreadUrlData &urlData, const int pageNo, const QByteArray &rawData,
+		const QByteArray &utf8Data, const CancellationToken &token);
+	// Run parsePage() on the global thread pool
+	static QFuture<PageParseResult> startPageParse(
+		const ForumThreadUrlData &urlData, const int pageNo, const HtmlPageStream &page, const CancellationToken &token);
+	// Put the posts of the finished page parses to the cache and remove them from the map;
+	// waits for all of them if wait is true. Returns the first failure result
+	result_code::Type finishPageParses(const ForumThreadUrlData &urlData, PageParseFutureMap &parses, const bool wait,
+		const int pageCount, int &parsedPageCount);
+	void cachePagePosts(const ForumThreadUrlData &urlData, const int pageNo, const bfr::PostList &posts);
 
 public:
 	static ForumThreadPool &globalInstance();
 
+	// Maximum count of the forum thread pages being downloaded simultaneously;
+	// the actual count is adjusted by the crawl throttle according to the forum server load
+	static const int MaxParallelPageDownloads = 8;
+	// Default politeness settings of the forum host crawling
+	static constexpr double CrawlRequestsPerSecond = 8.0;
+	static constexpr double CrawlBurst = 8.0;
+
 public:
 	// FIXME: implement
 	//enum class Policy { Invalid = -1, CachedOnly, PreferCached, PreferNew, NewOnly, Count };
@@ -67,12 +100,24 @@ public:
 	// FIXME: implement
 	//void setMaximumMemoryUsage(quint64 maxCacheMem);
 
-	/*SYNC*/ result_code::Type getForumThreadPageCount(const ForumThreadUrlData &urlData, int &pageCount);
-	/*SYNC*/ result_code::Type getForumPagePosts(const ForumThreadUrlData &urlData, const int pageNo, bfr::PostList &posts);
-	/*SYNC*/ result_code::Type getForumThreadPosts(const ForumThreadUrlData &urlData, bfr::PostList &posts);
+	// NOTE: result_code::Type::Cancelled is returned as soon as the token is cancelled, and nothing is cached then
+	/*SYNC*/ result_code::Type getForumThreadPageCount(
+		const ForumThreadUrlData &urlData, int &pageCount, const CancellationToken &token = CancellationToken());
+	/*SYNC*/ result_code::Type getForumPagePosts(const ForumThreadUrlData &urlData, const int pageNo, bfr::PostList &posts,
+		const CancellationToken &token = CancellationToken());
+	/*SYNC*/ result_code::Type getForumThreadPosts(
+		const ForumThreadUrlData &urlData, bfr::PostList &posts, const CancellationToken &token = CancellationToken());
+
+	// Open the connection to the forum host ahead of time, so the first page download will not wait for it;
+	// must be called from the thread that will download the pages
+	/*SYNC*/ result_code::Type warmUpConnection();
+
+	// Forum host request rate limit, and the current crawl state: rate, parallel requests window, latency
+	void setCrawlRate(double requestsPerSecond, double burst);
+	CrawlThrottle::Metrics crawlMetrics() const;
 
 signals:
-	void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+	void downloadProgress(qint64 bytesReceived, qint64 bytesTotal, qint64 bytesDecoded);
 	//    void downloadFinished();
 	//    void downloadFailed(result_code::Type code);
 
@@ -22,6 +22,8 @@
  * SOFTWARE.
 */
 #include "gumboparserimpl.h"
+#include "qtgumboselector.h"
+#include "qtgumbotreewalker.h"
 
 #include <common/logger.h>
 
@@ -38,11 +40,22 @@ using namespace bfr;
 
 namespace {
 static const QString g_bankiRuHost = "https://www.banki.ru";
+static const char *const g_msdivIdPrefix = "msdiv";
+
+// NOTE: selectors are compiled once and shared by all parser instances
+static const QtGumboSelector g_postTableBodySelector("> table > tbody");
+static const QtGumboSelector g_postFirstRowSelector("> tr:nth-child(1)");
+static const QtGumboSelector g_postSecondRowSelector("> tr:nth-child(2)");
+static const QtGumboSelector g_postCellSelector("> td.forum-cell-post");
+static const QtGumboSelector g_postDateSelector("> div.forum-post-date");
+static const QtGumboSelector g_postEntrySelector("> div.forum-post-entry");
+static const QtGumboSelector g_postTextSelector("> div.forum-post-text");
+static const QtGumboSelector g_firstSpanSelector("> span");
 }
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------------
 
-void ForumPageParser::printTagsRecursively(const QtGumboNodePtr &node, int &level) const {
+void ForumPageParser::printTags(QtGumboNodeRef node) const {
 
 	BFR_RETURN_VOID_IF(!node || !node->isValid(), "invalid node");
 
@@ -50,54 +63,43 @@ void ForumPageParser::printTagsRecursively(const QtGumboNodePtr &node, int &leve
 		return;
 
 #ifdef BFR_PRINT_DEBUG_OUTPUT
-	QString levelStr;
-	levelStr.fill('-', level);
-
-	QString idAttrValue = "<empty id>";
-	if (node->hasAttribute("id"))
-		idAttrValue = ", id = " + node->getIdAttribute();
-
-	QString classAttrValue = "<empty class>";
-	if (node->hasClassAttribute())
-		classAttrValue = ", class = " + node->getClassAttribute();
-
-	SystemLogger->info("{} {} {} {}", levelStr, node->getTagName(), idAttrValue, classAttrValue);
-
-	QtGumboNodes children = node->getChildren();
-	for (auto iChild = children.begin(); iChild != children.end(); ++iChild) {
-		level += 4;
-		printTagsRecursively(*iChild, level);
-		level -= 4;
-	}
-#else
-	Q_UNUSED(level);
+	QtGumboTreeWalker walker;
+	walker.walkPreOrder(node, [](QtGumboNodeRef element, int depth) {
+		QString levelStr;
+		levelStr.fill('-', depth * 4);
+
+		QString idAttrValue = "<empty id>";
+		if (element->hasIdAttribute())
+			idAttrValue = ", id = " + element->getIdAttribute();
+
+		QString classAttrValue = "<empty class>";
+		if (element->hasClassAttribute())
+			classAttrValue = ", class = " + element->getClassAttribute();
+
+		SystemLogger->info("{} {} {} {}", levelStr, element->getTagName(), idAttrValue, classAttrValue);
+		return QtGumboWalkAction::Continue;
+	});
 #endif
 }
 
-void ForumPageParser::findMsdivNodesRecursively(const QtGumboNodePtr &node, QVector<QtGumboNodePtr> &msdivNodes) const {
-
-	BFR_RETURN_VOID_IF(!node || !node->isValid(), "Invalid input parameters");
-
-	if (!node->isElement())
-		return;
-
-	bool isDivTag = (node->getTag() == HtmlTag::DIV);
-	if (isDivTag && node->hasIdAttribute()) {
-		QString idAttrValue = node->getIdAttribute();
-		int msdivIndex = idAttrValue.indexOf("msdiv");
-		if (msdivIndex != -1) {
-			// TODO: this number should be stored now, i.e. the id currently extracted twice
-			QString msdivNumberStr = idAttrValue.mid(5);
-			bool msdivNumberCorrect = false;
-			/*int msdivNumber =*/msdivNumberStr.toInt(&msdivNumberCorrect);
-			BFR_RETURN_VOID_IF(!msdivNumberCorrect, "Invalid ID string format: not a number");
-			msdivNodes.append(node);
+void ForumPageParser::findMsdivNodes(const QtGumboDocument &document, QtGumboNodeRefs &msdivNodes) const {
+
+	// NOTE: ids with this prefix are indexed on the document parsing, see getPagePostsUtf8()
+	const QtGumboNodeRefs idNodes = document.elementsByIdPrefix(g_msdivIdPrefix);
+	for (QtGumboNodeRef node : idNodes) {
+		if (node->getTag() != HtmlTag::DIV)
+			continue;
+
+		// TODO: this number should be stored now, i.e. the id currently extracted twice
+		QString msdivNumberStr = node->getIdAttribute().mid(5);
+		bool msdivNumberCorrect = false;
+		/*int msdivNumber =*/msdivNumberStr.toInt(&msdivNumberCorrect);
+		if (!msdivNumberCorrect) {
+			// NOTE: skip only the malformed node, the rest of the posts must still be collected
+			SystemLogger->warn("Invalid ID string format: not a number, id = '{}'", node->getIdAttribute());
+			continue;
 		}
-	}
-
-	QtGumboNodes children = node->getChildren();
-	for (auto iChild = children.begin(); iChild != children.end(); ++iChild) {
-		findMsdivNodesRecursively(*iChild, msdivNodes);
+		msdivNodes.append(node);
 	}
 }
 
@@ -119,13 +121,13 @@ int parseUserId(const QString &userProfileUrl) {
 }
 }
 
-ForumPageParser::UserBaseInfo ForumPageParser::getUserBaseInfo(const QtGumboNodePtr &userInfoNode) const {
+ForumPageParser::UserBaseInfo ForumPageParser::getUserBaseInfo(QtGumboNodeRef userInfoNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(UserBaseInfo);
 
 	BFR_RETURN_DEFAULT_IF(!userInfoNode || !userInfoNode->isValid(), "Invalid input parameters");
 
-	QtGumboNodePtr userNameNode = userInfoNode->getElementByClass("forum-user-name", HtmlTag::DIV);
+	QtGumboNodeRef userNameNode = userInfoNode->getElementByClass("forum-user-name", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!userNameNode || !userNameNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(
 		(userNameNode->getChildElementCount() != 1) && (userNameNode->getChildElementCount() != 2), "Invalid node");
@@ -144,17 +146,17 @@ ForumPageParser::UserBaseInfo ForumPageParser::getUserBaseInfo(const QtGumboNode
 	return result;
 }
 
-ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(const QtGumboNodePtr &userInfoNode) const {
+ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(QtGumboNodeRef userInfoNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(UserAdditionalInfo);
 
 	BFR_RETURN_DEFAULT_IF(!userInfoNode || !userInfoNode->isValid(), "Invalid input parameters");
 
-	QtGumboNodePtr userAdditionalNode = userInfoNode->getElementByClass("forum-user-additional", HtmlTag::DIV);
+	QtGumboNodeRef userAdditionalNode = userInfoNode->getElementByClass("forum-user-additional", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!userAdditionalNode || !userAdditionalNode->isValid(), "Invalid node");
 
 	// Read the all message URL and the post count
-	QtGumboNodePtr postLinkNode = userAdditionalNode->getElementByTag(
+	QtGumboNodeRef postLinkNode = userAdditionalNode->getElementByTag(
 		{ { HtmlTag::SPAN, 1 }, { HtmlTag::SPAN, 1 }, { HtmlTag::UNKNOWN, 0 }, { HtmlTag::A, 0 } });
 	BFR_RETURN_DEFAULT_IF(!postLinkNode || !postLinkNode->isValid(), "Invalid node");
 
@@ -169,7 +171,7 @@ ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(const
 	BFR_RETURN_DEFAULT_IF(!postCountOk, "Invalid post count string format: not a number");
 
 	// Read the registration date
-	QtGumboNodePtr regDateNode = userAdditionalNode->getElementByTag({ { HtmlTag::SPAN, 3 }, { HtmlTag::SPAN, 1 } });
+	QtGumboNodeRef regDateNode = userAdditionalNode->getElementByTag({ { HtmlTag::SPAN, 3 }, { HtmlTag::SPAN, 1 } });
 	BFR_RETURN_DEFAULT_IF(!regDateNode || !regDateNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(regDateNode->getChildElementCount() != 0, "Invalid node child element count");
 	BFR_RETURN_DEFAULT_IF(regDateNode->getTextChildrenCount() != 1, "Invalid node child text element count");
@@ -179,7 +181,7 @@ ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(const
 	BFR_RETURN_DEFAULT_IF(!registrationDate.isValid(), "Invalid registration date string format: not a date");
 
 	// Read the reputation value
-	QtGumboNodePtr userReputationRefNode
+	QtGumboNodeRef userReputationRefNode
 		= userAdditionalNode->getElementByTag({ { HtmlTag::SPAN, 5 }, { HtmlTag::SPAN, 1 }, { HtmlTag::A, 0 } });
 	BFR_RETURN_DEFAULT_IF(!userReputationRefNode || !userReputationRefNode->isValid(), "Invalid node");
 
@@ -192,11 +194,11 @@ ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(const
 
 	// NOTE: city is optional field, instead the rest of others
 	QString cityStr;
-	QtGumboNodePtr userCityNode = userAdditionalNode->getElementByTag({ HtmlTag::SPAN, 3 });
+	QtGumboNodeRef userCityNode = userAdditionalNode->getElementByTag({ HtmlTag::SPAN, 3 });
 	if (userCityNode && userCityNode->isValid()) {
 		BFR_RETURN_DEFAULT_IF(userCityNode->getChildElementCount() != 1, "Invalid node");
 
-		QtGumboNodePtr spanNode1 = userCityNode->getElementByTag({ HtmlTag::SPAN, 0 });
+		QtGumboNodeRef spanNode1 = userCityNode->getElementByTag({ HtmlTag::SPAN, 0 });
 		BFR_RETURN_DEFAULT_IF(!spanNode1 || !spanNode1->isValid(), "Invalid node");
 		BFR_RETURN_DEFAULT_IF(spanNode1->getChildElementCount() != 0, "Invalid node child element count");
 		BFR_RETURN_DEFAULT_IF(spanNode1->getTextChildrenCount() != 1, "Invalid node text child element count");
@@ -218,25 +220,25 @@ ForumPageParser::UserAdditionalInfo ForumPageParser::getUserAdditionalInfo(const
 	return result;
 }
 
-PostImagePtr ForumPageParser::getUserAvatar(const QtGumboNodePtr &userInfoNode) const {
+PostImagePtr ForumPageParser::getUserAvatar(QtGumboNodeRef userInfoNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostImagePtr);
 
 	BFR_RETURN_DEFAULT_IF(!userInfoNode || !userInfoNode->isValid(), "Invalid input parameters");
 
-	QtGumboNodePtr userAvatarNode = userInfoNode->getElementByClass("forum-user-avatar", HtmlTag::DIV);
+	QtGumboNodeRef userAvatarNode = userInfoNode->getElementByClass("forum-user-avatar", HtmlTag::DIV);
 	if (!userAvatarNode || !userAvatarNode->isValid())
 		userAvatarNode = userInfoNode->getElementByClass("forum-user-register-avatar", HtmlTag::DIV);
 
 	BFR_RETURN_DEFAULT_IF(!userAvatarNode || !userAvatarNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(userAvatarNode->getChildElementCount() != 1, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF((userAvatarNode->getClassAttribute() != "forum-user-avatar")
-			&& (userAvatarNode->getClassAttribute() != "forum-user-register-avatar"),
+	BFR_RETURN_DEFAULT_IF((userAvatarNode->getClassAttributeView() != "forum-user-avatar")
+			&& (userAvatarNode->getClassAttributeView() != "forum-user-register-avatar"),
 		"Invalid node class");
 
 	PostImagePtr result;
-	if (userAvatarNode->getClassAttribute() == "forum-user-avatar") {
-		QtGumboNodePtr imageNode
+	if (userAvatarNode->getClassAttributeView() == "forum-user-avatar") {
+		QtGumboNodeRef imageNode
 			= userAvatarNode->getElementByTag({ { HtmlTag::UNKNOWN, 1 }, { HtmlTag::A, 1 }, { HtmlTag::IMG, 0 } });
 		BFR_RETURN_DEFAULT_IF(!imageNode || !imageNode->isValid(), "Invalid node");
 
@@ -246,23 +248,23 @@ PostImagePtr ForumPageParser::getUserAvatar(const QtGumboNodePtr &userInfoNode)
 	return result;
 }
 
-UserPtr ForumPageParser::getPostUser(const QtGumboNodePtr &trNode1) const {
+UserPtr ForumPageParser::getPostUser(QtGumboNodeRef trNode1) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(UserPtr);
 	BFR_RETURN_DEFAULT_IF(!trNode1 || !trNode1->isValid(), "Invalid input parameters");
 
-	QtGumboNodePtr userNode = trNode1->getElementByClass("forum-cell-user", HtmlTag::TD);
+	QtGumboNodeRef userNode = trNode1->getElementByClass("forum-cell-user", HtmlTag::TD);
 	BFR_RETURN_DEFAULT_IF(!userNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(userNode->getChildElementCount() != 1, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(userNode->getClassAttribute() != "forum-cell-user", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(userNode->getClassAttributeView() != "forum-cell-user", "Invalid node class");
 
-	QtGumboNodePtr userInfoNode = userNode->getElementByClass("forum-user-info", HtmlTag::DIV);
+	QtGumboNodeRef userInfoNode = userNode->getElementByClass("forum-user-info", HtmlTag::DIV);
 	if (!userInfoNode || !userInfoNode->isValid())
 		userInfoNode = userNode->getElementByClass("forum-user-info w-el-dropDown", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!userInfoNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(userInfoNode->getChildElementCount() < 4, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF((userInfoNode->getClassAttribute() != "forum-user-info w-el-dropDown")
-			&& (userInfoNode->getClassAttribute() != "forum-user-info"),
+	BFR_RETURN_DEFAULT_IF((userInfoNode->getClassAttributeView() != "forum-user-info w-el-dropDown")
+			&& (userInfoNode->getClassAttributeView() != "forum-user-info"),
 		"Invalid node class");
 
 	// Get user base info: id, name, profile URL
@@ -302,24 +304,24 @@ UserPtr ForumPageParser::getPostUser(const QtGumboNodePtr &trNode1) const {
 	return userInfo;
 }
 
-PostPtr ForumPageParser::getPostValue(const QtGumboNodePtr &trNode1) const {
+PostPtr ForumPageParser::getPostValue(QtGumboNodeRef trNode1) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostPtr);
 
 	BFR_RETURN_DEFAULT_IF(!trNode1 || !trNode1->isValid(), "Invalid input parameters");
 
-	QtGumboNodePtr postNode = trNode1->getElementByClass("forum-cell-post", HtmlTag::TD);
+	QtGumboNodeRef postNode = g_postCellSelector.selectFirst(trNode1);
 	BFR_RETURN_DEFAULT_IF(!postNode || !postNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(postNode->getChildElementCount() != 2, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(postNode->getClassAttribute() != "forum-cell-post", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postNode->getClassAttributeView() != "forum-cell-post", "Invalid node class");
 
 	// 1) <div class="forum-post-date">
-	QtGumboNodePtr postDateNode = postNode->getElementByClass("forum-post-date", HtmlTag::DIV);
+	QtGumboNodeRef postDateNode = g_postDateSelector.selectFirst(postNode);
 	BFR_RETURN_DEFAULT_IF(!postDateNode || !postDateNode->isValid(), "Invalid post date string format: not a date");
 	BFR_RETURN_DEFAULT_IF(postDateNode->getChildElementCount() > 3, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(postDateNode->getClassAttribute() != "forum-post-date", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postDateNode->getClassAttributeView() != "forum-post-date", "Invalid node class");
 
-	QtGumboNodePtr spanNode = postDateNode->getElementByTag({ HtmlTag::SPAN, 0 });
+	QtGumboNodeRef spanNode = g_firstSpanSelector.selectFirst(postDateNode);
 	BFR_RETURN_DEFAULT_IF(!spanNode || !spanNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(spanNode->getChildElementCount() != 0, "Invalid child element count");
 	BFR_RETURN_DEFAULT_IF(spanNode->getTextChildrenCount() != 1, "Invalid text child element count");
@@ -329,15 +331,15 @@ PostPtr ForumPageParser::getPostValue(const QtGumboNodePtr &trNode1) const {
 	BFR_RETURN_DEFAULT_IF(!postDate.isValid(), "Invalid post date string format: not a date");
 
 	// 2) <div class="forum-post-entry" style="font-size: 14px;">
-	QtGumboNodePtr postEntryNode = postNode->getElementByClass("forum-post-entry", HtmlTag::DIV);
+	QtGumboNodeRef postEntryNode = g_postEntrySelector.selectFirst(postNode);
 	BFR_RETURN_DEFAULT_IF(!postEntryNode || !postEntryNode->isValid(), "Invalid node");
-	BFR_RETURN_DEFAULT_IF(postEntryNode->getClassAttribute() != "forum-post-entry", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postEntryNode->getClassAttributeView() != "forum-post-entry", "Invalid node class");
 
-	QtGumboNodePtr postTextNode = postEntryNode->getElementByClass("forum-post-text", HtmlTag::DIV);
-	BFR_RETURN_DEFAULT_IF(!postTextNode->isValid(), "Invalid node");
+	QtGumboNodeRef postTextNode = g_postTextSelector.selectFirst(postEntryNode);
+	BFR_RETURN_DEFAULT_IF(!postTextNode || !postTextNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF((postTextNode->getChildElementCount() == 0) && (postTextNode->getTextChildrenCount() == 0),
 		"Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(postTextNode->getClassAttribute() != "forum-post-text", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postTextNode->getClassAttributeView() != "forum-post-text", "Invalid node class");
 
 	// Read message id
 	QString messageIdStr = postTextNode->getIdAttribute();
@@ -349,7 +351,7 @@ PostPtr ForumPageParser::getPostValue(const QtGumboNodePtr &trNode1) const {
 	BFR_RETURN_DEFAULT_IF(!idOk, "Invalid message ID string format: not a number");
 
 	// Read message contents (HTML)
-	QtGumboNodes postTextNodeChildren = postTextNode->getChildren(false);
+	QtGumboNodeRange postTextNodeChildren = postTextNode->getChildren(false);
 	PostPtr postInfo(new Post);
 	parseMessage(postTextNodeChildren, postInfo->m_data);
 
@@ -387,7 +389,8 @@ PostPtr ForumPageParser::getPostValue(const QtGumboNodePtr &trNode1) const {
 	return postInfo;
 }
 
-void ForumPageParser::parseMessage(const QtGumboNodes &nodes, IPostObjectList &postObjects) const {
+void ForumPageParser::parseMessage(
+	const QtGumboNodeRange &nodes, IPostObjectList &postObjects, bool stripLeadingColon) const {
 
 	for (auto iChild = nodes.begin(); iChild != nodes.end(); ++iChild) {
 		auto iChildPtr = *iChild;
@@ -420,8 +423,8 @@ void ForumPageParser::parseMessage(const QtGumboNodes &nodes, IPostObjectList &p
 					QString textColor = "black";
 					if (iChildPtr->hasAttribute("color"))
 						textColor = iChildPtr->getAttribute("color");
-					QtGumboNodes fontTagChildren = iChildPtr->getChildren(false);
-					for (QtGumboNodePtr node : fontTagChildren) {
+					QtGumboNodeRange fontTagChildren = iChildPtr->getChildren(false);
+					for (QtGumboNodeRef node : fontTagChildren) {
 						if (node->isElement()) {
 							switch (node->getTag()) {
 								case HtmlTag::B: {
@@ -454,10 +457,10 @@ void ForumPageParser::parseMessage(const QtGumboNodes &nodes, IPostObjectList &p
 					// <table class="forum-quote">
 					// <table class="forum-code">
 					// <table class="forum-spoiler">
-					if (iChildPtr->getClassAttribute() == "forum-quote"
-						|| iChildPtr->getClassAttribute() == "forum-code") {
+					if (iChildPtr->getClassAttributeView() == "forum-quote"
+						|| iChildPtr->getClassAttributeView() == "forum-code") {
 						postObjects << parseQuote(*iChild);
-					} else if (iChildPtr->getClassAttribute() == "forum-spoiler") {
+					} else if (iChildPtr->getClassAttributeView() == "forum-spoiler") {
 						postObjects << parseSpoiler(*iChild);
 					} else {
 						BFR_RETURN_VOID_IF(true, "Invalid quote node class");
@@ -531,10 +534,10 @@ void ForumPageParser::parseMessage(const QtGumboNodes &nodes, IPostObjectList &p
 		} else if (iChildPtr->isText()) {
 			// FIXME: ugly hack to remove ':' from the quote body beginning
 			QString text = iChildPtr->getInnerText().trimmed();
-			if (m_textQuoteFlag) {
+			if (stripLeadingColon) {
 				text = text.remove(0, 1);
 				text = text.trimmed();
-				m_textQuoteFlag = false;
+				stripLeadingColon = false;
 			}
 
 			postObjects << PostPlainTextPtr(new PostPlainText(text));
@@ -549,7 +552,7 @@ void ForumPageParser::parseMessage(const QtGumboNodes &nodes, IPostObjectList &p
 	}
 }
 
-QString ForumPageParser::getPostLastEdit(const QtGumboNodePtr &postEntryNode) const {
+QString ForumPageParser::getPostLastEdit(QtGumboNodeRef postEntryNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(QString);
 
@@ -557,23 +560,23 @@ QString ForumPageParser::getPostLastEdit(const QtGumboNodePtr &postEntryNode) co
 
 	// Read post last edit info (optional)
 	QString lastEditStr;
-	QtGumboNodePtr postLastEditNode = postEntryNode->getElementByClass("forum-post-lastedit", HtmlTag::DIV);
+	QtGumboNodeRef postLastEditNode = postEntryNode->getElementByClass("forum-post-lastedit", HtmlTag::DIV);
 	if (!postLastEditNode || !postLastEditNode->isValid())
 		return QString();
 
 	BFR_RETURN_DEFAULT_IF(postLastEditNode->getChildElementCount() != 1, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(postLastEditNode->getClassAttribute() != "forum-post-lastedit", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postLastEditNode->getClassAttributeView() != "forum-post-lastedit", "Invalid node class");
 
-	QtGumboNodePtr postLastEditSpanNode = postLastEditNode->getElementByClass("forum-post-lastedit", HtmlTag::SPAN);
+	QtGumboNodeRef postLastEditSpanNode = postLastEditNode->getElementByClass("forum-post-lastedit", HtmlTag::SPAN);
 	BFR_RETURN_DEFAULT_IF(!postLastEditSpanNode || !postLastEditSpanNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(postLastEditSpanNode->getChildElementCount() < 2, "Invalid child element count");
 
-	QtGumboNodePtr postLastEditUserNode
+	QtGumboNodeRef postLastEditUserNode
 		= postLastEditSpanNode->getElementByClass("forum-post-lastedit-user", HtmlTag::SPAN);
 	BFR_RETURN_DEFAULT_IF(!postLastEditUserNode || !postLastEditUserNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(postLastEditUserNode->getChildElementCount() != 1, "Invalid child element count");
 
-	QtGumboNodePtr posLastEditUserLinkNode
+	QtGumboNodeRef posLastEditUserLinkNode
 		= postLastEditUserNode->getElementByTag({ { HtmlTag::UNKNOWN, 1 }, { HtmlTag::A, 0 } });
 	BFR_RETURN_DEFAULT_IF(!posLastEditUserLinkNode || !posLastEditUserLinkNode->isValid(), "Invalid node");
 
@@ -583,14 +586,14 @@ QString ForumPageParser::getPostLastEdit(const QtGumboNodePtr &postEntryNode) co
 	QString userNameHrefStr = postLastEditUserLink->m_urlStr;
 	QString userNameStr = postLastEditUserLink->m_title;
 
-	QtGumboNodePtr postLastEditDateNode
+	QtGumboNodeRef postLastEditDateNode
 		= postLastEditSpanNode->getElementByClass("forum-post-lastedit-date", HtmlTag::SPAN);
 	BFR_RETURN_DEFAULT_IF(!postLastEditDateNode || !postLastEditDateNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(postLastEditDateNode->getChildElementCount() != 0, "Invalid child element count");
 	QString lastEditDateStr = postLastEditDateNode->getChildrenInnerText();
 
 	QString lastEditReasonStr;
-	QtGumboNodePtr postLastEditReasonNode
+	QtGumboNodeRef postLastEditReasonNode
 		= postLastEditSpanNode->getElementByClass("forum-post-lastedit-reason", HtmlTag::SPAN);
 	if (postLastEditReasonNode && postLastEditReasonNode->isValid()) {
 		BFR_RETURN_DEFAULT_IF(postLastEditReasonNode->getChildElementCount() != 1, "Invalid child element count");
@@ -599,7 +602,7 @@ QString ForumPageParser::getPostLastEdit(const QtGumboNodePtr &postEntryNode) co
 		BFR_RETURN_DEFAULT_IF(lastEditReasonStr != "()", "Invalid last edit reason string format");
 		lastEditReasonStr.clear();
 
-		QtGumboNodePtr reasonSpanNode = postLastEditReasonNode->getElementByTag({ HtmlTag::SPAN, 0 });
+		QtGumboNodeRef reasonSpanNode = postLastEditReasonNode->getElementByTag({ HtmlTag::SPAN, 0 });
 		BFR_RETURN_DEFAULT_IF(!reasonSpanNode || !reasonSpanNode->isValid(), "Invalid node");
 		lastEditReasonStr = "(" + reasonSpanNode->getChildrenInnerText() + ")";
 	}
@@ -611,7 +614,7 @@ QString ForumPageParser::getPostLastEdit(const QtGumboNodePtr &postEntryNode) co
 	return lastEditStr;
 }
 
-QString ForumPageParser::getPostUserSignature(const QtGumboNodePtr &postEntryNode) const {
+QString ForumPageParser::getPostUserSignature(QtGumboNodeRef postEntryNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(QString);
 
@@ -619,20 +622,20 @@ QString ForumPageParser::getPostUserSignature(const QtGumboNodePtr &postEntryNod
 
 	// Read user signature
 	QString userSignatureStr;
-	QtGumboNodePtr postSignatureNode = postEntryNode->getElementByClass("forum-user-signature");
+	QtGumboNodeRef postSignatureNode = postEntryNode->getElementByClass("forum-user-signature");
 	if (!postSignatureNode || !postSignatureNode->isValid())
 		return QString();
 
 	BFR_RETURN_DEFAULT_IF(postSignatureNode->getChildElementCount() != 2, "Invalid child node count");
-	BFR_RETURN_DEFAULT_IF(postSignatureNode->getClassAttribute() != "forum-user-signature", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(postSignatureNode->getClassAttributeView() != "forum-user-signature", "Invalid node class");
 
-	QtGumboNodePtr spanNode = postSignatureNode->getElementByTag({ HtmlTag::SPAN, 0 });
+	QtGumboNodeRef spanNode = postSignatureNode->getElementByTag({ HtmlTag::SPAN, 0 });
 	BFR_RETURN_DEFAULT_IF(!spanNode || !spanNode->isValid(), "Invalid node");
 
 	userSignatureStr = spanNode->getChildrenInnerText();
 
 	// Parse HTML user signatures
-	QtGumboNodes children = spanNode->getChildren();
+	QtGumboNodeRange children = spanNode->getChildren();
 	for (auto iChild = children.begin(); iChild != children.end(); ++iChild) {
 		auto iChildPtr = *iChild;
 		switch (iChildPtr->getTag()) {
@@ -676,7 +679,7 @@ QString ForumPageParser::getPostUserSignature(const QtGumboNodePtr &postEntryNod
 	return userSignatureStr;
 }
 
-IPostObjectList ForumPageParser::getPostAttachments(const QtGumboNodePtr &postEntryNode) const {
+IPostObjectList ForumPageParser::getPostAttachments(QtGumboNodeRef postEntryNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(IPostObjectList);
 
@@ -685,11 +688,11 @@ IPostObjectList ForumPageParser::getPostAttachments(const QtGumboNodePtr &postEn
 	// Read post file attachments
 	IPostObjectList result;
 
-	QtGumboNodePtr attachmentsNode = postEntryNode->getElementByClass("forum-post-attachments");
+	QtGumboNodeRef attachmentsNode = postEntryNode->getElementByClass("forum-post-attachments");
 	if (!attachmentsNode || !attachmentsNode->isValid())
 		return IPostObjectList();
 
-	QtGumboNodePtr labelNode = attachmentsNode->getElementByTag({ HtmlTag::LABEL, 0 });
+	QtGumboNodeRef labelNode = attachmentsNode->getElementByTag({ HtmlTag::LABEL, 0 });
 	BFR_RETURN_DEFAULT_IF(!labelNode || !labelNode->isValid(), "Invalid node");
 
 	QString attachmentsLabelStr = labelNode->getChildrenInnerText();
@@ -698,13 +701,13 @@ IPostObjectList ForumPageParser::getPostAttachments(const QtGumboNodePtr &postEn
 	result << PostRichTextPtr(new PostRichText(attachmentsLabelStr, "black", true, false, false, false));
 	result << PostLineBreakPtr(new PostLineBreak());
 
-	QtGumboNodes children = attachmentsNode->getElementsByClass("forum-post-attachment", HtmlTag::DIV);
+	QtGumboNodeRefs children = attachmentsNode->getElementsByClass("forum-post-attachment", HtmlTag::DIV);
 	for (auto iChild = children.begin(); iChild != children.end(); ++iChild) {
-		QtGumboNodePtr attachNode = (*iChild)->getElementByClass("forum-attach", HtmlTag::DIV);
+		QtGumboNodeRef attachNode = (*iChild)->getElementByClass("forum-attach", HtmlTag::DIV);
 		BFR_RETURN_DEFAULT_IF(!attachNode || !attachNode->isValid(), "Invalid node");
 
 		// FIXME: support other attachment types (if exists)
-		QtGumboNodePtr imgNode = attachNode->getElementByClass("popup_image", HtmlTag::IMG);
+		QtGumboNodeRef imgNode = attachNode->getElementByClass("popup_image", HtmlTag::IMG);
 		BFR_RETURN_DEFAULT_IF(!imgNode || !imgNode->isValid(), "Invalid node");
 
 		result << parseImage(imgNode);
@@ -713,49 +716,49 @@ IPostObjectList ForumPageParser::getPostAttachments(const QtGumboNodePtr &postEn
 	return result;
 }
 
-int ForumPageParser::getLikeCounterValue(const QtGumboNodePtr &trNode2) const {
+int ForumPageParser::getLikeCounterValue(QtGumboNodeRef trNode2) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE_N_VALUE(int, -1);
 
 	BFR_RETURN_DEFAULT_IF(!trNode2 || !trNode2->isValid(), "Invalid node");
 
 	// tr2:
-	QtGumboNodePtr contactsNode = trNode2->getElementByClass("forum-cell-contact", HtmlTag::TD);
+	QtGumboNodeRef contactsNode = trNode2->getElementByClass("forum-cell-contact", HtmlTag::TD);
 	BFR_RETURN_DEFAULT_IF(!contactsNode || !contactsNode->isValid(), "Invalid node");
-	BFR_RETURN_DEFAULT_IF(contactsNode->getClassAttribute() != "forum-cell-contact", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(contactsNode->getClassAttributeView() != "forum-cell-contact", "Invalid node class");
 
-	QtGumboNodePtr actionsNode = trNode2->getElementByClass("forum-cell-actions", HtmlTag::TD);
+	QtGumboNodeRef actionsNode = trNode2->getElementByClass("forum-cell-actions", HtmlTag::TD);
 	BFR_RETURN_DEFAULT_IF(!actionsNode || !actionsNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(actionsNode->getChildElementCount() != 1, "Invalid child element node");
-	BFR_RETURN_DEFAULT_IF(actionsNode->getClassAttribute() != "forum-cell-actions", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(actionsNode->getClassAttributeView() != "forum-cell-actions", "Invalid node class");
 
 	// Get the "like" count
 	// NOTE: it is type on the site, not my own
-	QtGumboNodePtr actionLinksNode = actionsNode->getElementByClass("conainer-action-links", HtmlTag::DIV);
+	QtGumboNodeRef actionLinksNode = actionsNode->getElementByClass("conainer-action-links", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!actionLinksNode || !actionLinksNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(actionLinksNode->getChildElementCount() != 2, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(actionLinksNode->getClassAttribute() != "conainer-action-links", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(actionLinksNode->getClassAttributeView() != "conainer-action-links", "Invalid node class");
 
-	QtGumboNodePtr floatLeftNode = actionLinksNode->getElementByClass("float-left", HtmlTag::DIV);
+	QtGumboNodeRef floatLeftNode = actionLinksNode->getElementByClass("float-left", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!floatLeftNode || !floatLeftNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(floatLeftNode->getChildElementCount() != 1, "Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(floatLeftNode->getClassAttribute() != "float-left", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(floatLeftNode->getClassAttributeView() != "float-left", "Invalid node class");
 
-	QtGumboNodePtr likeNode = floatLeftNode->getElementByClass("like", HtmlTag::DIV);
+	QtGumboNodeRef likeNode = floatLeftNode->getElementByClass("like", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!likeNode || !likeNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(likeNode->getChildElementCount() != 1, "Invalid node child element count");
-	BFR_RETURN_DEFAULT_IF(likeNode->getClassAttribute() != "like", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(likeNode->getClassAttributeView() != "like", "Invalid node class");
 
-	QtGumboNodePtr likeWidgetNode = likeNode->getElementByClass("like__widget", HtmlTag::DIV);
+	QtGumboNodeRef likeWidgetNode = likeNode->getElementByClass("like__widget", HtmlTag::DIV);
 	BFR_RETURN_DEFAULT_IF(!likeWidgetNode || !likeWidgetNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(likeWidgetNode->getChildElementCount() < 2 || likeWidgetNode->getChildElementCount() > 5,
 		"Invalid child element count");
-	BFR_RETURN_DEFAULT_IF(likeWidgetNode->getClassAttribute() != "like__widget", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(likeWidgetNode->getClassAttributeView() != "like__widget", "Invalid node class");
 
-	QtGumboNodePtr likeCounterNode = likeWidgetNode->getElementByClass("like__counter", HtmlTag::SPAN);
+	QtGumboNodeRef likeCounterNode = likeWidgetNode->getElementByClass("like__counter", HtmlTag::SPAN);
 	BFR_RETURN_DEFAULT_IF(!likeCounterNode || !likeCounterNode->isValid(), "Invalid node");
 	BFR_RETURN_DEFAULT_IF(likeCounterNode->getChildElementCount() != 0, "Invalid child element class");
-	BFR_RETURN_DEFAULT_IF(likeCounterNode->getClassAttribute() != "like__counter", "Invalid node class");
+	BFR_RETURN_DEFAULT_IF(likeCounterNode->getClassAttributeView() != "like__counter", "Invalid node class");
 	BFR_RETURN_DEFAULT_IF(likeCounterNode->getTextChildrenCount() != 1, "Invalid text child element count");
 
 	QString likeCounterStr = likeCounterNode->getChildrenInnerText();
@@ -765,7 +768,7 @@ int ForumPageParser::getLikeCounterValue(const QtGumboNodePtr &trNode2) const {
 	return likeCount;
 }
 
-int ForumPageParser::getPostId(const QtGumboNodePtr &msdivNode) const {
+int ForumPageParser::getPostId(QtGumboNodeRef msdivNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE_N_VALUE(int, -1);
 
@@ -781,19 +784,19 @@ int ForumPageParser::getPostId(const QtGumboNodePtr &msdivNode) const {
 	return messageId;
 }
 
-void ForumPageParser::findPageCount(const QString &rawData, int &pageCount) const {
+void ForumPageParser::findPageCount(const QByteArray &rawData, int &pageCount) const {
 
 	pageCount = 0;
 
-	// NOTE: alternative method
-	const QString PAGES_STR = "pages: ";
+	// NOTE: alternative method; page count expression is ASCII-only, so the raw bytes are scanned, see probePageCount()
+	static const QByteArray PAGES_STR = "pages: ";
 	int pagesIdxBegin = rawData.indexOf(PAGES_STR);
 	int pagesIdxEnd = rawData.indexOf(",", pagesIdxBegin);
 	BFR_RETURN_VOID_IF(pagesIdxBegin < 0, "No page count expession found");
 	BFR_RETURN_VOID_IF(pagesIdxEnd <= pagesIdxBegin, "Invalid page count expression");
 	int pageCountStrSize = pagesIdxEnd - pagesIdxBegin - PAGES_STR.size();
 	BFR_RETURN_VOID_IF(pageCountStrSize <= 0, "Negative page count");
-	QString pageCountStr = rawData.mid(pagesIdxBegin + PAGES_STR.size(), pageCountStrSize);
+	QByteArray pageCountStr = rawData.mid(pagesIdxBegin + PAGES_STR.size(), pageCountStrSize);
 	bool pageCountOk = false;
 	pageCount = pageCountStr.toInt(&pageCountOk);
 	if (!pageCountOk)
@@ -801,38 +804,62 @@ void ForumPageParser::findPageCount(const QString &rawData, int &pageCount) cons
 	BFR_RETURN_VOID_IF(!pageCountOk, "Invalid page count string format: not a number");
 }
 
-void ForumPageParser::fillPostList(const QtGumboNodePtr &node, PostList &posts) const {
+bool ForumPageParser::probePageCount(const QByteArray &rawData, int from, int &pageCount) const {
+
+	// NOTE: page count expression is ASCII-only, so the raw bytes of any supported page encoding can be scanned;
+	//       expression may be split between the chunks, so start a bit before the last chunk
+	static const QByteArray PAGES_STR = "pages: ";
+	static const int MaxExpressionSize = 32;
+
+	int pagesIdxBegin = rawData.indexOf(PAGES_STR, qMax(0, from - MaxExpressionSize));
+	if (pagesIdxBegin < 0)
+		return false;
+	int pagesIdxEnd = rawData.indexOf(',', pagesIdxBegin);
+	if (pagesIdxEnd < 0)
+		return false;
+
+	int pageCountStrSize = pagesIdxEnd - pagesIdxBegin - PAGES_STR.size();
+	if ((pageCountStrSize <= 0) || (pageCountStrSize > MaxExpressionSize - PAGES_STR.size()))
+		return false;
+
+	bool pageCountOk = false;
+	int pageCountTemp = rawData.mid(pagesIdxBegin + PAGES_STR.size(), pageCountStrSize).toInt(&pageCountOk);
+	if (!pageCountOk || (pageCountTemp <= 0))
+		return false;
+
+	pageCount = pageCountTemp;
+	return true;
+}
+
+void ForumPageParser::fillPostList(const QtGumboDocument &document, PostList &posts) const {
 
-	BFR_RETURN_VOID_IF(!node || !node->isValid(), "Invalid input parameters");
+	QtGumboNodeRef rootNode = document.rootNode();
+	BFR_RETURN_VOID_IF(!rootNode || !rootNode->isValid(), "Invalid input parameters");
 
 	// XPath: *[@id="msdiv4453758"]
 
 	// Find div nodes with msdiv id
-	QtGumboNodes msdivNodes;
-	findMsdivNodesRecursively(node, msdivNodes);
+	QtGumboNodeRefs msdivNodes;
+	findMsdivNodes(document, msdivNodes);
 
 	// table --> tbody --> tr | tr --> td | td
 	for (int i = 0; i < msdivNodes.size(); ++i) {
-		QtGumboNodePtr msdivNode = msdivNodes[i];
+		QtGumboNodeRef msdivNode = msdivNodes[i];
 		BFR_RETURN_VOID_IF(!msdivNode || !msdivNode->isValid(), "Invalid node");
 		BFR_RETURN_VOID_IF(msdivNode->getChildElementCount() != 1, "Invalid child element count");
 
-		QtGumboNodePtr tbodyNode = msdivNode->getElementByTag({ { HtmlTag::TABLE, 1 }, { HtmlTag::TBODY, 1 } });
+		QtGumboNodeRef tbodyNode = g_postTableBodySelector.selectFirst(msdivNode);
 		BFR_RETURN_VOID_IF(!tbodyNode || !tbodyNode->isValid(), "Invalid node");
 
-		// two tr tags
-		int idxTr1 = 0;
-		QtGumboNodePtr trNode1 = tbodyNode->getElementByTag({ HtmlTag::TR, idxTr1 }, &idxTr1);
+		// two tr tags: the first and the second child elements of tbody
+		QtGumboNodeRef trNode1 = g_postFirstRowSelector.selectFirst(tbodyNode);
 		BFR_RETURN_VOID_IF(!trNode1 || !trNode1->isValid(), "Invalid node");
 
-		int idxTr2 = idxTr1 + 1;
-		QtGumboNodePtr trNode2 = tbodyNode->getElementByTag({ HtmlTag::TR, idxTr2 }, &idxTr2);
-		BFR_RETURN_VOID_IF(!trNode2 || !trNode1->isValid(), "Invalid node");
+		QtGumboNodeRef trNode2 = g_postSecondRowSelector.selectFirst(tbodyNode);
+		BFR_RETURN_VOID_IF(!trNode2 || !trNode2->isValid(), "Invalid node");
 
 		BFR_RETURN_VOID_IF(trNode1->getChildElementCount() != 2, "Invalid child element count");
 		BFR_RETURN_VOID_IF(trNode2->getChildElementCount() != 2, "Invalid child element count");
-		BFR_RETURN_VOID_IF(idxTr1 != 0, "Invalid node index");
-		BFR_RETURN_VOID_IF(idxTr2 != 1, "Invalid node index");
 
 		// each tr tag has two child td tags
 		// tr1:
@@ -851,7 +878,7 @@ void ForumPageParser::fillPostList(const QtGumboNodePtr &node, PostList &posts)
 	}
 }
 
-PostHyperlinkPtr ForumPageParser::parseHyperlink(const QtGumboNodePtr &aNode) const {
+PostHyperlinkPtr ForumPageParser::parseHyperlink(QtGumboNodeRef aNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostHyperlinkPtr);
 	BFR_RETURN_DEFAULT_IF(!aNode || !aNode->isValid() || !aNode->isElement(), "Invalid input parameters");
@@ -873,7 +900,7 @@ PostHyperlinkPtr ForumPageParser::parseHyperlink(const QtGumboNodePtr &aNode) co
 	return PostHyperlinkPtr(new PostHyperlink(urlStr, titleStr, tipStr, relStr));
 }
 
-PostImagePtr ForumPageParser::parseImage(const QtGumboNodePtr &imgNode) const {
+PostImagePtr ForumPageParser::parseImage(QtGumboNodeRef imgNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostImagePtr);
 	BFR_RETURN_DEFAULT_IF(!imgNode || !imgNode->isValid() || !imgNode->isElement(), "Invalid input parameters");
@@ -928,7 +955,7 @@ PostImagePtr ForumPageParser::parseImage(const QtGumboNodePtr &imgNode) const {
 	return result;
 }
 
-PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const {
+PostQuotePtr ForumPageParser::parseQuote(QtGumboNodeRef tableNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostQuotePtr);
 
@@ -937,12 +964,12 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 	PostQuotePtr result(new PostQuote);
 
 	// Read the quote title
-	QtGumboNodePtr theadTrThNode
+	QtGumboNodeRef theadTrThNode
 		= tableNode->getElementByTag({ { HtmlTag::THEAD, 0 }, { HtmlTag::TR, 0 }, { HtmlTag::TH, 0 } });
 	BFR_RETURN_DEFAULT_IF(!theadTrThNode || !theadTrThNode->isValid(), "Invalid node");
 	result->m_title = theadTrThNode->getChildrenInnerText();
 
-	QtGumboNodePtr tbodyTrTdNode
+	QtGumboNodeRef tbodyTrTdNode
 		= tableNode->getElementByTag({ { HtmlTag::TBODY, 1 }, { HtmlTag::TR, 0 }, { HtmlTag::TD, 0 } });
 	BFR_RETURN_DEFAULT_IF(!tbodyTrTdNode || !tbodyTrTdNode->isValid(), "Invalid node");
 
@@ -952,11 +979,12 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 	// NOTE: optional
 	const QString QUOTE_WRITE_VERB = QCoreApplication::translate("Post", "wrote");
 	int tbodyTrTdNodeChildIndex = 0;
-	QtGumboNodePtr tbodyTrTdANode = tbodyTrTdNode->getElementByTag({ HtmlTag::A, 0 });
+	bool stripLeadingColon = false;
+	QtGumboNodeRef tbodyTrTdANode = tbodyTrTdNode->getElementByTag({ HtmlTag::A, 0 });
 	bool tbodyTrTdANodeValid = tbodyTrTdANode && tbodyTrTdANode->isValid();
 	QString tbodyTrTdANodeText = tbodyTrTdANodeValid ? tbodyTrTdANode->getChildrenInnerText().trimmed() : QString();
 	if (tbodyTrTdANodeValid && (tbodyTrTdANodeText.compare(QUOTE_WRITE_VERB, Qt::CaseInsensitive) == 0)) {
-		QtGumboNodePtr tbodyTrTdBNode = tbodyTrTdNode->getElementByTag({ HtmlTag::B, 0 });
+		QtGumboNodeRef tbodyTrTdBNode = tbodyTrTdNode->getElementByTag({ HtmlTag::B, 0 });
 		if (tbodyTrTdBNode && tbodyTrTdBNode->isValid()) {
 			result->m_userName = tbodyTrTdBNode->getChildrenInnerText();
 			tbodyTrTdNodeChildIndex++;
@@ -975,9 +1003,9 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 		// Find the quote body start
 		BFR_RETURN_DEFAULT_IF(
 			tbodyTrTdNodeChildIndex >= tbodyTrTdNode->getChildElementCount(false), "Invalid node index");
-		QtGumboNodes tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
+		QtGumboNodeRange tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
 		for (int i = tbodyTrTdNodeChildIndex; i < tbodyTrTdChildren.size(); ++i) {
-			QtGumboNodePtr temp = tbodyTrTdChildren[i];
+			QtGumboNodeRef temp = tbodyTrTdChildren[i];
 			if (temp->isText()) {
 				QString tempText = temp->getInnerText().trimmed();
 				if (tempText == ":") {
@@ -985,7 +1013,7 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 					break;
 				}
 				if (tempText.startsWith(":")) {
-					m_textQuoteFlag = true;
+					stripLeadingColon = true;
 					break;
 				}
 			}
@@ -996,7 +1024,7 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 	// NOTE: quote text is HTML too
 	// FIXME: temponary workaround! i will investigate the problem in future
 	//    BFR_RETURN_DEFAULT_IF(tbodyTrTdNodeChildIndex >= tbodyTrTdNode->getChildElementCount(false), "Invalid node index");
-	QtGumboNodes tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
+	QtGumboNodeRange tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
 
 #ifdef BFR_PRINT_DEBUG_OUTPUT
 	SystemLogger->info("-------------------------------------");
@@ -1015,11 +1043,11 @@ PostQuotePtr ForumPageParser::parseQuote(const QtGumboNodePtr &tableNode) const
 	SystemLogger->info("-------------------------------------");
 #endif
 
-	parseMessage(tbodyTrTdChildren.mid(tbodyTrTdNodeChildIndex), result->m_data);
+	parseMessage(tbodyTrTdChildren.mid(tbodyTrTdNodeChildIndex), result->m_data, stripLeadingColon);
 	return result;
 }
 
-PostSpoilerPtr ForumPageParser::parseSpoiler(const QtGumboNodePtr &tableNode) const {
+PostSpoilerPtr ForumPageParser::parseSpoiler(QtGumboNodeRef tableNode) const {
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE(PostSpoilerPtr);
 
@@ -1028,7 +1056,7 @@ PostSpoilerPtr ForumPageParser::parseSpoiler(const QtGumboNodePtr &tableNode) co
 	PostSpoilerPtr result(new PostSpoiler);
 
 	// Read the quote title
-	QtGumboNodePtr theadTrThNode = tableNode->getElementByTag(
+	QtGumboNodeRef theadTrThNode = tableNode->getElementByTag(
 		{ { HtmlTag::THEAD, 0 }, { HtmlTag::TR, 0 }, { HtmlTag::TH, 0 }, { HtmlTag::DIV, 0 } });
 	BFR_RETURN_DEFAULT_IF(!theadTrThNode || !theadTrThNode->isValid(), "Invalid node");
 	result->m_title = theadTrThNode->getChildrenInnerText();
@@ -1039,13 +1067,13 @@ PostSpoilerPtr ForumPageParser::parseSpoiler(const QtGumboNodePtr &tableNode) co
 	result->m_title = result->m_title.remove(result->m_title.size() - 1, 1);
 	result->m_title = result->m_title.trimmed();
 
-	QtGumboNodePtr tbodyTrTdNode
+	QtGumboNodeRef tbodyTrTdNode
 		= tableNode->getElementByTag({ { HtmlTag::TBODY, 1 }, { HtmlTag::TR, 0 }, { HtmlTag::TD, 0 } });
 	BFR_RETURN_DEFAULT_IF(!tbodyTrTdNode || !tbodyTrTdNode->isValid(), "Invalid node");
 
 	// Read the spoiler body
 	// NOTE: spoiler text is HTML too
-	QtGumboNodes tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
+	QtGumboNodeRange tbodyTrTdChildren = tbodyTrTdNode->getChildren(false);
 
 #ifdef BFR_PRINT_DEBUG_OUTPUT
 	SystemLogger->info("-------------------------------------");
@@ -1091,8 +1119,8 @@ result_code::Type ForumPageParser::getPageCount(const QByteArray &rawData, int &
 
 	BFR_DECLARE_DEFAULT_RETURN_TYPE_N_VALUE(result_code::Type, result_code::Type::Fail);
 
-	QByteArray utfData = convertHtmlToUft8(rawData);
-	BFR_RETURN_DEFAULT_IF(utfData.isEmpty(), "Unable to convert HTML page contents to UTF-8");
+	// NOTE: no need to convert the whole page to UTF-8 just to find the ASCII expression
+	BFR_RETURN_DEFAULT_IF(rawData.isEmpty(), "HTML page contents are empty");
 
 	findPageCount(rawData, pageCount);
 
@@ -1106,10 +1134,22 @@ result_code::Type ForumPageParser::getPagePosts(const QByteArray &rawData, PostL
 	QByteArray utfData = convertHtmlToUft8(rawData);
 	BFR_RETURN_DEFAULT_IF(utfData.isEmpty(), "Unable to convert HTML page contents to UTF-8");
 
-	m_htmlDocument.reset(new QtGumboDocument(utfData));
+	return getPagePostsUtf8(utfData, userPosts);
+}
+
+result_code::Type ForumPageParser::getPagePostsUtf8(const QByteArray &utf8Data, PostList &userPosts) {
+	BFR_DECLARE_DEFAULT_RETURN_TYPE_N_VALUE(result_code::Type, result_code::Type::Fail);
+	BFR_RETURN_DEFAULT_IF(utf8Data.isEmpty(), "HTML page contents are empty");
+
+	// Only post divs are looked up by id, and classes are checked among the node children
+	QtGumboIndexOptions indexOptions;
+	indexOptions.m_idPrefixes << g_msdivIdPrefix;
+	indexOptions.m_indexClasses = false;
+
+	const QtGumboDocument htmlDocument(utf8Data, indexOptions);
 
 	// Parse web page contents
-	fillPostList(m_htmlDocument->rootNode(), userPosts);
+	fillPostList(htmlDocument, userPosts);
 
 	// TODO: implement error handling with different return code
 	return result_code::Type::Ok;
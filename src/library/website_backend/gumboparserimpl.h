@@ -45,37 +45,47 @@ class ForumPageParser : public IForumPageReader {
 		QString m_city;
 	};
 
-	QtGumboDocumentPtr m_htmlDocument;
-
-	mutable bool m_textQuoteFlag = false;
+	// NOTE: parser keeps no state between the calls, and the parsed document is owned by the call itself,
+	//       so the pages can be parsed on different threads simultaneously
 
 private:
-	void printTagsRecursively(const QtGumboNodePtr &node, int &level) const;
-	void findMsdivNodesRecursively(const QtGumboNodePtr &node, QVector<QtGumboNodePtr> &msdivNodes) const;
-	void findPageCount(const QString &rawData, int &pageCount) const;
-	UserBaseInfo getUserBaseInfo(const QtGumboNodePtr &userInfoNode) const;
-	UserAdditionalInfo getUserAdditionalInfo(const QtGumboNodePtr &userInfoNode) const;
-	PostImagePtr getUserAvatar(const QtGumboNodePtr &userInfoNode) const;
-	UserPtr getPostUser(const QtGumboNodePtr &trNode1) const;
-	PostPtr getPostValue(const QtGumboNodePtr &trNode1) const;
-	QString getPostLastEdit(const QtGumboNodePtr &postEntryNode) const;
-	QString getPostUserSignature(const QtGumboNodePtr &postEntryNode) const;
-	IPostObjectList getPostAttachments(const QtGumboNodePtr &postEntryNode) const;
-	int getLikeCounterValue(const QtGumboNodePtr &trNode2) const;
-	int getPostId(const QtGumboNodePtr &msdivNode) const;
-	void fillPostList(const QtGumboNodePtr &node, PostList &posts) const;
+	void printTags(QtGumboNodeRef node) const;
+	void findPageCount(const QByteArray &rawData, int &pageCount) const;
+	UserBaseInfo getUserBaseInfo(QtGumboNodeRef userInfoNode) const;
+	UserAdditionalInfo getUserAdditionalInfo(QtGumboNodeRef userInfoNode) const;
+	PostImagePtr getUserAvatar(QtGumboNodeRef userInfoNode) const;
+	UserPtr getPostUser(QtGumboNodeRef trNode1) const;
+	PostPtr getPostValue(QtGumboNodeRef trNode1) const;
+	QString getPostLastEdit(QtGumboNodeRef postEntryNode) const;
+	QString getPostUserSignature(QtGumboNodeRef postEntryNode) const;
+	IPostObjectList getPostAttachments(QtGumboNodeRef postEntryNode) const;
+	int getLikeCounterValue(QtGumboNodeRef trNode2) const;
+	int getPostId(QtGumboNodeRef msdivNode) const;
+	void fillPostList(const QtGumboDocument &document, PostList &posts) const;
 
-	PostHyperlinkPtr parseHyperlink(const QtGumboNodePtr &aNode) const;
-	PostImagePtr parseImage(const QtGumboNodePtr &imgNode) const;
-	PostQuotePtr parseQuote(const QtGumboNodePtr &tableNode) const;
-	PostSpoilerPtr parseSpoiler(const QtGumboNodePtr &tableNode) const;
+	PostHyperlinkPtr parseHyperlink(QtGumboNodeRef aNode) const;
+	PostImagePtr parseImage(QtGumboNodeRef imgNode) const;
+	PostQuotePtr parseQuote(QtGumboNodeRef tableNode) const;
+	PostSpoilerPtr parseSpoiler(QtGumboNodeRef tableNode) const;
 
-	void parseMessage(const QtGumboNodes &nodes, IPostObjectList &postObjects) const;
+	// stripLeadingColon: remove ':' from the first text node, i.e. the rest of quote header "X wrote:"
+	void parseMessage(
+		const QtGumboNodeRange &nodes, IPostObjectList &postObjects, bool stripLeadingColon = false) const;
 
 public:
 	// IForumPageReader implementation
 	result_code::Type getPageCount(const QByteArray &rawData, int &pageCount) override;
 	result_code::Type getPagePosts(const QByteArray &rawData, PostList &userPosts) override;
+	result_code::Type getPagePostsUtf8(const QByteArray &utf8Data, PostList &userPosts) override;
+
+	// Look for the page count expression in the partially downloaded page raw bytes;
+	// from is the offset of the last received chunk, so the already scanned bytes will not be scanned again.
+	// Returns false if more page data is required
+	bool probePageCount(const QByteArray &rawData, int from, int &pageCount) const;
+
+	// Collect the post div nodes, i.e. ones with "msdiv<number>" id; nodes with malformed id are skipped.
+	// NOTE: the document must index the "msdiv" id prefix
+	void findMsdivNodes(const QtGumboDocument &document, QtGumboNodeRefs &msdivNodes) const;
 };
 }
 
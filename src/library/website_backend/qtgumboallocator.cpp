@@ -0,0 +1,153 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "qtgumboallocator.h"
+
+#include <QtCore/QMutexLocker>
+
+#include <cstddef>
+
+namespace {
+const size_t Alignment = alignof(std::max_align_t);
+
+size_t alignedSize(size_t size) { return (size + Alignment - 1) & ~(Alignment - 1); }
+}
+
+QtGumboAllocator::QtGumboAllocator() : m_blockIndex(0), m_offset(0)
+{
+}
+
+void *QtGumboAllocator::allocate(size_t size) {
+
+	size = alignedSize(size ? size : 1);
+
+	while (m_blockIndex < m_blocks.size()) {
+		Block &block = m_blocks[m_blockIndex];
+		if (m_offset + size <= block.m_size) {
+			void *result = block.m_data.get() + m_offset;
+			m_offset += size;
+			return result;
+		}
+
+		// Try the next retained block
+		m_blockIndex++;
+		m_offset = 0;
+	}
+
+	// NOTE: huge allocation (e.g. long text node) gets its own block
+	Block block;
+	block.m_size = qMax(size, BlockSize);
+	block.m_data.reset(new char[block.m_size]);
+	m_blocks.push_back(std::move(block));
+
+	m_blockIndex = m_blocks.size() - 1;
+	m_offset = size;
+	return m_blocks.back().m_data.get();
+}
+
+void QtGumboAllocator::reset() {
+
+	// Keep the regular blocks up to the limit, to not hold the memory of the single huge page forever
+	size_t retainedSize = 0;
+	std::vector<Block> retainedBlocks;
+	for (Block &block : m_blocks) {
+		if ((block.m_size != BlockSize) || (retainedSize + block.m_size > MaxRetainedSize))
+			continue;
+
+		retainedSize += block.m_size;
+		retainedBlocks.push_back(std::move(block));
+	}
+	m_blocks.swap(retainedBlocks);
+
+	m_blockIndex = 0;
+	m_offset = 0;
+}
+
+size_t QtGumboAllocator::capacity() const {
+
+	size_t result = 0;
+	for (const Block &block : m_blocks)
+		result += block.m_size;
+	return result;
+}
+
+GumboOptions QtGumboAllocator::options() const {
+
+	GumboOptions result = kGumboDefaultOptions;
+	result.allocator = &QtGumboAllocator::gumboAllocate;
+	result.deallocator = &QtGumboAllocator::gumboDeallocate;
+	result.userdata = const_cast<QtGumboAllocator *>(this);
+	return result;
+}
+
+void *QtGumboAllocator::gumboAllocate(void *userdata, size_t size) {
+
+	return static_cast<QtGumboAllocator *>(userdata)->allocate(size);
+}
+
+void QtGumboAllocator::gumboDeallocate(void *userdata, void *ptr) {
+
+	// NOTE: memory is released at once by reset()
+	Q_UNUSED(userdata);
+	Q_UNUSED(ptr);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+QtGumboAllocatorPool &QtGumboAllocatorPool::globalInstance() {
+
+	// Since it's a static variable, if the class has already been created,
+	// it won't be created again.
+	// And it **is** thread-safe in C++11.
+	static QtGumboAllocatorPool instance;
+	return instance;
+}
+
+QtGumboAllocatorPtr QtGumboAllocatorPool::acquire() {
+
+	QMutexLocker locker(&m_mutex);
+
+	if (m_allocators.empty())
+		return QtGumboAllocatorPtr(new QtGumboAllocator);
+
+	QtGumboAllocatorPtr result = std::move(m_allocators.back());
+	m_allocators.pop_back();
+	m_pooledSize -= result->capacity();
+	return result;
+}
+
+void QtGumboAllocatorPool::release(QtGumboAllocatorPtr allocator) {
+
+	if (!allocator)
+		return;
+
+	allocator->reset();
+	const size_t allocatorSize = allocator->capacity();
+
+	QMutexLocker locker(&m_mutex);
+
+	if (m_pooledSize + allocatorSize <= MaxPooledSize) {
+		m_pooledSize += allocatorSize;
+		m_allocators.push_back(std::move(allocator));
+	}
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_QTGUMBOALLOCATOR_H__
+#define __BFR_QTGUMBOALLOCATOR_H__
+
+#include <QtCore/QMutex>
+
+#include <memory>
+#include <vector>
+
+#include <gumbo-parser/src/gumbo.h>
+
+// Bump allocator for the Gumbo parse output: memory is taken from the big blocks sequentially,
+// free is a no-op, and everything is released at once by reset().
+// NOTE: Gumbo grows vectors and string buffers by allocate-copy-free, so the dropped buffers stay in the blocks
+//       until reset(); it's still much cheaper than malloc/free per node and the whole tree walk on destroy
+class QtGumboAllocator {
+	// Delete copy and move constructors and assign operators
+	QtGumboAllocator(QtGumboAllocator const &) = delete; // Copy construct
+	QtGumboAllocator(QtGumboAllocator &&) = delete; // Move construct
+	QtGumboAllocator &operator=(QtGumboAllocator const &) = delete; // Copy assign
+	QtGumboAllocator &operator=(QtGumboAllocator &&) = delete; // Move assign
+
+public:
+	static constexpr size_t BlockSize = 256 * 1024;
+	// Blocks kept by reset() for the next document; the rest is returned to the system
+	static constexpr size_t MaxRetainedSize = 4 * 1024 * 1024;
+
+	QtGumboAllocator();
+	~QtGumboAllocator() = default;
+
+	void *allocate(size_t size);
+	void reset();
+
+	// Total size of the allocated blocks
+	size_t capacity() const;
+	// Parse options with this allocator plugged in
+	GumboOptions options() const;
+
+private:
+	struct Block {
+		std::unique_ptr<char[]> m_data;
+		size_t m_size;
+	};
+
+	static void *gumboAllocate(void *userdata, size_t size);
+	static void gumboDeallocate(void *userdata, void *ptr);
+
+	std::vector<Block> m_blocks;
+	// Current block and the free space start in it
+	size_t m_blockIndex;
+	size_t m_offset;
+};
+
+using QtGumboAllocatorPtr = std::unique_ptr<QtGumboAllocator>;
+
+// Free allocators of the already destroyed documents, to reuse their blocks for the next pages.
+// NOTE: idle allocators keep at most MaxPooledSize bytes in total (16 MB) for the whole process lifetime,
+//       regardless of the parser worker count and the size of the pages parsed in the past
+class QtGumboAllocatorPool {
+	// Delete copy and move constructors and assign operators
+	QtGumboAllocatorPool(QtGumboAllocatorPool const &) = delete; // Copy construct
+	QtGumboAllocatorPool(QtGumboAllocatorPool &&) = delete; // Move construct
+	QtGumboAllocatorPool &operator=(QtGumboAllocatorPool const &) = delete; // Copy assign
+	QtGumboAllocatorPool &operator=(QtGumboAllocatorPool &&) = delete; // Move assign
+
+public:
+	// Total size of the blocks retained by the pooled allocators; allocators beyond it are just deleted
+	static constexpr size_t MaxPooledSize = 4 * QtGumboAllocator::MaxRetainedSize;
+
+protected:
+	QMutex m_mutex;
+	std::vector<QtGumboAllocatorPtr> m_allocators;
+	size_t m_pooledSize = 0;
+
+	QtGumboAllocatorPool() = default;
+	~QtGumboAllocatorPool() = default;
+
+public:
+	static QtGumboAllocatorPool &globalInstance();
+
+public:
+	QtGumboAllocatorPtr acquire();
+	void release(QtGumboAllocatorPtr allocator);
+};
+
+#endif // __BFR_QTGUMBOALLOCATOR_H__
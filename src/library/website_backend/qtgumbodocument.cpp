@@ -27,65 +27,84 @@
 
 #include <iostream>
 
-bool QtGumboDocument::parse() {
+bool QtGumboDocument::parse(const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions) {
 
-	GumboOptions options = kGumboDefaultOptions;
-
-	// Parse web page contents
-	m_output = gumbo_parse_with_options(&options, m_rawHtmlData.constData(), m_rawHtmlData.length());
-	Q_ASSERT(!!m_output);
-	if (!m_output)
-		return false;
-
-	m_documentNode = QtGumboNodePool::globalInstance().getNode(m_output->document);
-	m_rootNode = QtGumboNodePool::globalInstance().getNode(m_output->root);
-	return true;
+	m_arena = QtGumboNodeArena::create(utf8Data, indexOptions);
+	return !!m_arena;
 }
 
-QtGumboDocument::QtGumboDocument() : m_output(nullptr)
+QtGumboDocument::QtGumboDocument()
 {
 }
 
-QtGumboDocument::QtGumboDocument(const QString &rawData) {
+QtGumboDocument::QtGumboDocument(const QString &rawData, const QtGumboIndexOptions &indexOptions) {
 
-	QTextCodec *htmlCodec = QTextCodec::codecForHtml(rawData.toLocal8Bit());
+	// Convert to UTF-8: Gumbo library understands only this encoding
+#if defined(Q_OS_WIN)
+	const QByteArray localData = rawData.toLocal8Bit();
+	QTextCodec *htmlCodec = QTextCodec::codecForHtml(localData);
 
 #ifdef BFR_PRINT_DEBUG_OUTPUT
 	SystemLogger->info("HTML encoding/charset is '{}'", htmlCodec->name().toStdString());
 #endif
 
-	// Convert to UTF-8: Gumbo library understands only this encoding
-#if defined(Q_OS_WIN)
-	QString htmlFileString = htmlCodec->toUnicode(rawData.toLocal8Bit());
-	m_rawHtmlData = htmlFileString.toUtf8();
+	QString htmlFileString = htmlCodec->toUnicode(localData);
+	parse(htmlFileString.toUtf8(), indexOptions);
 #elif defined(Q_OS_UNIX) || defined(Q_OS_ANDROID)
-	Q_UNUSED(htmlCodec);
-	m_rawHtmlData = rawData.toUtf8();
+	// NOTE: the codec is not used here, so the page is not sniffed for it
+	parse(rawData.toUtf8(), indexOptions);
 #else
 #error "Unsupported platform, needs testing"
 #endif
+}
+
+QtGumboDocument::QtGumboDocument(const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions) {
+
+	parse(utf8Data, indexOptions);
+}
+
+// NOTE: parse tree is owned by the arena, which is freed along with the last node pointer
+QtGumboDocument::~QtGumboDocument()
+{
+}
+
+QtGumboNodePtr QtGumboDocument::rootNode() const { return m_arena ? m_arena->rootNode() : QtGumboNodePtr(); }
+
+QtGumboNodePtr QtGumboDocument::documentNode() const { return m_arena ? m_arena->documentNode() : QtGumboNodePtr(); }
+
+QtGumboNodeRef QtGumboDocument::elementById(std::string_view id) const {
+
+	return m_arena ? m_arena->index().elementById(id) : QtGumboNodeRef();
+}
 
-	parse();
+QtGumboNodeRefs QtGumboDocument::elementsByIdPrefix(std::string_view prefix) const {
+
+	return m_arena ? m_arena->index().elementsByIdPrefix(prefix) : QtGumboNodeRefs();
+}
+
+QtGumboNodeRefs QtGumboDocument::elementsByClass(std::string_view classToken) const {
+
+	return m_arena ? m_arena->index().elementsByClass(classToken) : QtGumboNodeRefs();
 }
 
-QtGumboDocument::~QtGumboDocument() {
+QtGumboNodeRefs QtGumboDocument::select(const QtGumboSelector &selector) const {
 
-	if (m_output)
-		gumbo_destroy_output(&kGumboDefaultOptions, m_output);
+	return m_arena ? selector.select(m_arena->documentNode()) : QtGumboNodeRefs();
 }
 
-QtGumboNodePtr QtGumboDocument::rootNode() const { return m_rootNode; }
+QtGumboNodeRef QtGumboDocument::selectFirst(const QtGumboSelector &selector) const {
 
-QtGumboNodePtr QtGumboDocument::documentNode() const { return m_documentNode; }
+	return m_arena ? selector.selectFirst(m_arena->documentNode()) : QtGumboNodeRef();
+}
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------------
 
-static std::string nonbreaking_inline  = "|a|abbr|acronym|b|bdo|big|cite|code|dfn|em|font|i|img|kbd|nobr|s|small|span|strike|strong|sub|sup|tt|";
-static std::string empty_tags          = "|area|base|basefont|bgsound|br|command|col|embed|event-source|frame|hr|image|img|input|keygen|link|menuitem|meta|param|source|spacer|track|wbr|";
-static std::string preserve_whitespace = "|pre|textarea|script|style|";
-static std::string special_handling    = "|html|body|";
-static std::string no_entity_sub       = "|script|style|";
-static std::string treat_like_inline   = "|p|";
+static const std::string nonbreaking_inline  = "|a|abbr|acronym|b|bdo|big|cite|code|dfn|em|font|i|img|kbd|nobr|s|small|span|strike|strong|sub|sup|tt|";
+static const std::string empty_tags          = "|area|base|basefont|bgsound|br|command|col|embed|event-source|frame|hr|image|img|input|keygen|link|menuitem|meta|param|source|spacer|track|wbr|";
+static const std::string preserve_whitespace = "|pre|textarea|script|style|";
+static const std::string special_handling    = "|html|body|";
+static const std::string no_entity_sub       = "|script|style|";
+static const std::string treat_like_inline   = "|p|";
 
 static inline void rtrim(std::string &s) { s.erase(s.find_last_not_of(" \n\r\t") + 1); }
 
@@ -360,14 +379,15 @@ static std::string prettyprint(GumboNode *node, int lvl, const std::string inden
 void QtGumboDocument::prettify() const {
 
 	std::string indent_chars = "  ";
-	std::cout << prettyprint(m_output->document, 0, indent_chars) << std::endl;
+	Q_ASSERT(!!m_arena);
+	if (!m_arena)
+		return;
+
+	std::cout << prettyprint(m_arena->output()->document, 0, indent_chars) << std::endl;
 }
 
 QtGumboDocument &QtGumboDocument::operator=(QtGumboDocument other) {
 
-	std::swap(m_rawHtmlData, other.m_rawHtmlData);
-	std::swap(m_output, other.m_output);
-	std::swap(m_documentNode, other.m_documentNode);
-	std::swap(m_rootNode, other.m_rootNode);
+	std::swap(m_arena, other.m_arena);
 	return *this;
 }
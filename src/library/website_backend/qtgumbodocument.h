@@ -25,27 +25,39 @@
 #define __BFR_QTGUMBODOCUMENT_H__
 
 #include "qtgumbonode.h"
+#include "qtgumbonodeindex.h"
+#include "qtgumboselector.h"
 
 class QtGumboDocument;
 using QtGumboDocumentPtr = std::shared_ptr<QtGumboDocument>;
 
 class QtGumboDocument {
-	QByteArray m_rawHtmlData;
+	// Raw HTML data, parse tree and node wrappers
+	QtGumboNodeArenaPtr m_arena;
 
-	GumboOutput *m_output;
-
-	QtGumboNodePtr m_documentNode;
-	QtGumboNodePtr m_rootNode;
-
-	bool parse();
+	bool parse(const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions);
 
 public:
 	QtGumboDocument();
-	QtGumboDocument(const QString &rawData);
+	QtGumboDocument(const QString &rawData, const QtGumboIndexOptions &indexOptions = QtGumboIndexOptions());
+	// UTF-8 HTML data is passed to Gumbo as is, without any conversion or copy: the document shares the data.
+	// NOTE: QByteArray::fromRawData() can be used to parse the external buffer, e.g. memory-mapped file,
+	//       which must stay alive and unmodified while the document is alive then
+	explicit QtGumboDocument(
+		const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions = QtGumboIndexOptions());
 	~QtGumboDocument();
 
 	QtGumboNodePtr documentNode() const;
 	QtGumboNodePtr rootNode() const;
+
+	// Direct lookups by the index built on parsing, see QtGumboIndexOptions
+	QtGumboNodeRef elementById(std::string_view id) const;
+	QtGumboNodeRefs elementsByIdPrefix(std::string_view prefix) const;
+	QtGumboNodeRefs elementsByClass(std::string_view classToken) const;
+
+	// Compiled selector queries over the whole document, e.g. "html > body div.forum-post"
+	QtGumboNodeRefs select(const QtGumboSelector &selector) const;
+	QtGumboNodeRef selectFirst(const QtGumboSelector &selector) const;
 	// FIXME: implement errors list getter
 
 	void prettify() const;
@@ -22,56 +22,149 @@
  * SOFTWARE.
 */
 #include "qtgumbonode.h"
+#include "qtgumbonodeindex.h"
+#include "qtgumbotreewalker.h"
 
 namespace {
-const char* const ID_ATTRIBUTE 		= u8"id";
-const char* const CLASS_ATTRIBUTE 	= u8"class";
+const QLatin1String ID_ATTRIBUTE 	{ "id" };
+const QLatin1String CLASS_ATTRIBUTE { "class" };
+
+const GumboVector *gumboNodeChildren(const GumboNode *node) {
+
+	switch (node->type) {
+		case GUMBO_NODE_DOCUMENT:
+			return &node->v.document.children;
+		case GUMBO_NODE_ELEMENT:
+		case GUMBO_NODE_TEMPLATE:
+			return &node->v.element.children;
+		default:
+			return nullptr;
+	}
+}
+
+#ifdef QT_GUMBO_METADATA
+QtGumboNodeRawPtrs rawNodePointers(const QtGumboNodeRange &nodes) {
+
+	QtGumboNodeRawPtrs result;
+	for (QtGumboNodeRef node : nodes)
+		result << node.get();
+	return result;
+}
+#endif
 }
 
 #ifdef QT_GUMBO_METADATA
-void QtGumboNode::fillMetadata(QtGumboNodePropsPtr props) {
+template <typename T, typename Getter>
+const T &QtGumboNodeProps::cached(std::optional<T> &field, Getter getter) const {
+
+	// NOTE: the field is never changed after it's filled, so the reference stays valid without the lock
+	QMutexLocker locker(&m_mutex);
+	if (!field)
+		field = getter();
+	return *field;
+}
+
+bool QtGumboNodeProps::isValid() const { return m_node->isValid(); }
+
+QtGumboNodeType QtGumboNodeProps::type() const { return m_node->getType(); }
+
+const QtGumboNode *QtGumboNodeProps::parent() const { return m_node->getParent().get(); }
+
+size_t QtGumboNodeProps::parentIndex() const { return m_node->getParentIndex(); }
+
+HtmlTag QtGumboNodeProps::tag() const { return m_node->isElement() ? m_node->getTag() : HtmlTag::UNKNOWN; }
+
+const QtGumboNodePath &QtGumboNodeProps::path() const {
+
+	return cached(m_path, [this]() { return m_node->getPath(); });
+}
+
+const QString &QtGumboNodeProps::tagName() const {
+
+	return cached(m_tagName, [this]() { return m_node->isElement() ? m_node->getTagName() : QString(); });
+}
 
-	props->m_isValid = isValid();
-	props->m_type = getType();
-	props->m_path = getPath();
+const QString &QtGumboNodeProps::html() const {
 
-	props->m_parent = getParent();
-	props->m_parentIndex = getParentIndex();
+	return cached(m_html, [this]() { return m_node->isElement() ? m_node->getHtml() : QString(); });
+}
+
+const QtStringMap &QtGumboNodeProps::attributes() const {
 
-	if (isElement()) {
-		props->m_tag = getTag();
-		props->m_tagName = getTagName();
-		props->m_html = getHtml();
+	return cached(m_attributes, [this]() {
+		QtStringMap result;
+		if (!m_node->isElement())
+			return result;
 
-		for (unsigned int i = 0; i < m_node->v.element.attributes.length; ++i) {
-			GumboAttribute *attr = static_cast<GumboAttribute *>(m_node->v.element.attributes.data[i]);
+		const GumboVector &attributes = m_node->m_node->v.element.attributes;
+		for (unsigned int i = 0; i < attributes.length; ++i) {
+			GumboAttribute *attr = static_cast<GumboAttribute *>(attributes.data[i]);
 			Q_ASSERT(attr != nullptr);
 			if (!attr)
 				continue;
 
-			props->m_attributes.insert(attr->name, QString::fromUtf8(attr->value));
+			result.insert(attr->name, QString::fromUtf8(attr->value));
 		}
+		return result;
+	});
+}
 
-		props->m_id = getIdAttribute();
-		props->m_class = getClassAttribute();
+const QString &QtGumboNodeProps::id() const {
 
-		props->m_children = getChildren(false);
-		props->m_elementChildren = getChildren(true);
-		props->m_textChildren = getTextChildren();
-		props->m_childrenText = getChildrenInnerText();
-	}
+	return cached(m_id, [this]() { return m_node->isElement() ? m_node->getIdAttribute() : QString(); });
+}
 
-	if (isText()) {
-		props->m_text = getInnerText();
-	}
+const QString &QtGumboNodeProps::className() const {
+
+	return cached(m_class, [this]() { return m_node->isElement() ? m_node->getClassAttribute() : QString(); });
 }
 
-void QtGumboNode::setMetadata(QtGumboNodePropsPtr props) { m_props = props; }
-#endif
+const QString &QtGumboNodeProps::text() const {
 
-QtGumboNode::QtGumboNode(GumboNode *node) : m_node(node)
-{
+	return cached(m_text, [this]() { return m_node->isText() ? m_node->getInnerText() : QString(); });
+}
+
+const QString &QtGumboNodeProps::childrenText() const {
+
+	return cached(m_childrenText, [this]() { return m_node->isElement() ? m_node->getChildrenInnerText() : QString(); });
+}
+
+const QtGumboNodeRawPtrs &QtGumboNodeProps::children() const {
+
+	return cached(m_children, [this]() {
+		return m_node->isElement() ? rawNodePointers(m_node->getChildren(false)) : QtGumboNodeRawPtrs();
+	});
+}
+
+const QtGumboNodeRawPtrs &QtGumboNodeProps::elementChildren() const {
+
+	return cached(m_elementChildren, [this]() {
+		return m_node->isElement() ? rawNodePointers(m_node->getChildren(true)) : QtGumboNodeRawPtrs();
+	});
+}
+
+const QtGumboNodeRawPtrs &QtGumboNodeProps::textChildren() const {
+
+	return cached(m_textChildren, [this]() {
+		return m_node->isElement() ? rawNodePointers(m_node->getTextChildren()) : QtGumboNodeRawPtrs();
+	});
+}
+
+QtGumboNode::~QtGumboNode() { delete m_props.load(std::memory_order_acquire); }
+
+const QtGumboNodeProps &QtGumboNode::metadata() const {
+
+	QtGumboNodeProps *props = m_props.load(std::memory_order_acquire);
+	if (props)
+		return *props;
+
+	// NOTE: nodes are shared between threads, so only the first of the concurrently created props is kept
+	std::unique_ptr<QtGumboNodeProps> newProps(new QtGumboNodeProps(this));
+	if (m_props.compare_exchange_strong(props, newProps.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+		return *newProps.release();
+	return *props;
 }
+#endif
 
 bool QtGumboNode::isValid() const { return (m_node != nullptr); }
 
@@ -140,16 +233,16 @@ QtGumboNodeType QtGumboNode::getType() const {
 	return result;
 }
 
-QtGumboNodePtr QtGumboNode::getParent() const {
+QtGumboNodeRef QtGumboNode::getParent() const {
 
 	Q_ASSERT(isValid());
 	if (!isValid())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 
-	if (!m_node->parent)
-		return QtGumboNodePtr();
+	if (m_parentIndex < 0)
+		return QtGumboNodeRef();
 
-	return QtGumboNodePool::globalInstance().getNode(m_node->parent);
+	return QtGumboNodeRef(&m_arena->nodeAt(m_parentIndex));
 }
 
 size_t QtGumboNode::getParentIndex() const {
@@ -212,130 +305,187 @@ QString QtGumboNode::getTagName() const {
 	return QString(gumbo_normalized_tagname(m_node->v.element.tag));
 }
 
-bool QtGumboNode::hasAttribute(const QString &name) const {
+const GumboAttribute *QtGumboNode::findAttribute(const char *name, size_t length) const {
 
 	Q_ASSERT(isElement());
 	if (!isElement())
-		return false;
-	Q_ASSERT(!name.isEmpty());
-	if (name.isEmpty())
-		return false;
+		return nullptr;
+	Q_ASSERT(name && (length > 0));
+	if (!name || (length == 0))
+		return nullptr;
+
+	// NOTE: same as gumbo_get_attribute(), but the name isn't required to be null-terminated
+	const GumboVector *attributes = &m_node->v.element.attributes;
+	for (unsigned int i = 0; i < attributes->length; ++i) {
+		auto attr = static_cast<const GumboAttribute *>(attributes->data[i]);
+		if ((qstrnicmp(attr->name, name, static_cast<uint>(length)) == 0) && (attr->name[length] == '\0'))
+			return attr;
+	}
+	return nullptr;
+}
 
-	GumboAttribute *attr = gumbo_get_attribute(&m_node->v.element.attributes, name.toUtf8().constData());
-	return (attr != nullptr);
+bool QtGumboNode::hasAttribute(const QString &name) const {
+
+	const QByteArray nameUtf8 = name.toUtf8();
+	return (findAttribute(nameUtf8.constData(), nameUtf8.size()) != nullptr);
+}
+
+bool QtGumboNode::hasAttribute(QLatin1String name) const {
+
+	return (findAttribute(name.data(), name.size()) != nullptr);
 }
 
+bool QtGumboNode::hasAttribute(const char *name) const { return hasAttribute(QLatin1String(name)); }
+
 QString QtGumboNode::getAttribute(const QString &name) const {
 
-	Q_ASSERT(isElement());
-	if (!isElement())
-		return QString();
-	Q_ASSERT(!name.isEmpty());
-	if (name.isEmpty())
-		return QString();
+	const QByteArray nameUtf8 = name.toUtf8();
+	const GumboAttribute *attr = findAttribute(nameUtf8.constData(), nameUtf8.size());
+	return attr ? QString::fromUtf8(attr->value) : QString();
+}
 
-	QString result;
-	GumboAttribute *attr = gumbo_get_attribute(&m_node->v.element.attributes, name.toUtf8().constData());
-	if (attr)
-		result = QString::fromUtf8(attr->value);
-	return result;
+QString QtGumboNode::getAttribute(QLatin1String name) const { return toString(getAttributeView(name)); }
+
+QString QtGumboNode::getAttribute(const char *name) const { return toString(getAttributeView(name)); }
+
+std::string_view QtGumboNode::getAttributeView(QLatin1String name) const {
+
+	const GumboAttribute *attr = findAttribute(name.data(), name.size());
+	return attr ? std::string_view(attr->value) : std::string_view();
 }
 
+std::string_view QtGumboNode::getAttributeView(const char *name) const { return getAttributeView(QLatin1String(name)); }
+
 bool QtGumboNode::hasIdAttribute() const { return hasAttribute(ID_ATTRIBUTE); }
 
 bool QtGumboNode::hasClassAttribute() const { return hasAttribute(CLASS_ATTRIBUTE); }
 
-QString QtGumboNode::getIdAttribute() const { return getAttribute(ID_ATTRIBUTE); }
+QString QtGumboNode::getIdAttribute() const { return toString(getIdAttributeView()); }
 
-QString QtGumboNode::getClassAttribute() const { return getAttribute(CLASS_ATTRIBUTE); }
+QString QtGumboNode::getClassAttribute() const { return toString(getClassAttributeView()); }
 
-size_t QtGumboNode::getAttributeCount() const {
+std::string_view QtGumboNode::getIdAttributeView() const { return getAttributeView(ID_ATTRIBUTE); }
 
-	Q_ASSERT(isElement());
-	if (!isElement())
-		return 0;
+std::string_view QtGumboNode::getClassAttributeView() const { return getAttributeView(CLASS_ATTRIBUTE); }
 
-	return m_node->v.element.attributes.length;
+bool QtGumboNode::hasClass(std::string_view className) const {
+
+	// NOTE: class names are ASCII, so the simple case-insensitive comparison is enough
+	std::string_view classValue = getClassAttributeView();
+	if (classValue.size() != className.size())
+		return false;
+
+	if (classValue.empty())
+		return true;
+
+	return (qstrnicmp(classValue.data(), className.data(), static_cast<uint>(className.size())) == 0);
 }
 
-QtGumboNodes QtGumboNode::getChildren(const bool elementsOnly) const {
+bool QtGumboNode::hasClassToken(std::string_view className) const {
 
-	Q_ASSERT(isElement());
-	if (!isElement())
-		return QtGumboNodes();
+	if (className.empty())
+		return false;
 
-	QtGumboNodes result;
-	GumboVector *children = &m_node->v.element.children;
-	for (unsigned int i = 0; i < children->length; ++i) {
-		GumboNode *childNode = static_cast<GumboNode *>(children->data[i]);
-		if (elementsOnly && (childNode->type != GUMBO_NODE_ELEMENT))
-			continue;
+	std::string_view classValue = getClassAttributeView();
+	size_t pos = 0;
+	while (pos < classValue.size()) {
+		size_t end = classValue.find_first_of(" \t\n\f\r", pos);
+		if (end == std::string_view::npos)
+			end = classValue.size();
 
-		result << QtGumboNodePool::globalInstance().getNode(childNode);
+		if ((end - pos == className.size())
+			&& (qstrnicmp(classValue.data() + pos, className.data(), static_cast<uint>(className.size())) == 0)) {
+			return true;
+		}
+		pos = end + 1;
 	}
-
-	return result;
+	return false;
 }
 
-int QtGumboNode::getChildElementCount(const bool elementsOnly) const { return getChildren(elementsOnly).size(); }
+QString QtGumboNode::toString(std::string_view utf8Text) {
 
-QtGumboNodes QtGumboNode::getTextChildren() const {
+	return QString::fromUtf8(utf8Text.data(), static_cast<int>(utf8Text.size()));
+}
+
+size_t QtGumboNode::getAttributeCount() const {
 
 	Q_ASSERT(isElement());
 	if (!isElement())
-		return QtGumboNodes();
+		return 0;
 
-	QtGumboNodes result;
-	GumboVector *children = &m_node->v.element.children;
-	for (unsigned int i = 0; i < children->length; ++i) {
-		GumboNode *childNode = static_cast<GumboNode *>(children->data[i]);
-		if (childNode->type != GUMBO_NODE_TEXT)
-			continue;
+	return m_node->v.element.attributes.length;
+}
 
-		result << QtGumboNodePool::globalInstance().getNode(childNode);
-	}
-	return result;
+QtGumboNodeRange QtGumboNode::getChildren(const bool elementsOnly) const {
+
+	return getChildren(elementsOnly ? QtGumboNodeFilter::Elements : QtGumboNodeFilter::All);
 }
 
+QtGumboNodeRange QtGumboNode::getChildren(const QtGumboNodeFilter filter) const {
+
+	Q_ASSERT(isElement() || isDocument());
+	if (!isElement() && !isDocument())
+		return QtGumboNodeRange();
+
+	if (m_childCount == 0)
+		return QtGumboNodeRange();
+
+	const QtGumboNode *first = &m_arena->nodeAt(m_firstChild);
+	return QtGumboNodeRange(first, first + m_childCount, filter);
+}
+
+int QtGumboNode::getChildElementCount(const bool elementsOnly) const { return getChildren(elementsOnly).size(); }
+
+QtGumboNodeRange QtGumboNode::getTextChildren() const { return getChildren(QtGumboNodeFilter::Text); }
+
 int QtGumboNode::getTextChildrenCount() const { return getTextChildren().size(); }
 
-QString QtGumboNode::getInnerText() const {
+QString QtGumboNode::getInnerText() const { return toString(getInnerTextView()); }
+
+std::string_view QtGumboNode::getInnerTextView() const {
 
 	Q_ASSERT(isText());
 	if (!isText())
-		return QString();
+		return std::string_view();
 
-	return QString::fromUtf8(m_node->v.text.text);
+	return std::string_view(m_node->v.text.text);
 }
 
-QString QtGumboNode::getChildrenInnerText() {
+QString QtGumboNode::getChildrenInnerText() const {
 
 	Q_ASSERT(isElement());
 	if (!isElement())
 		return QString();
 
-	QString value;
-	GumboVector *nodeChildren = &m_node->v.element.children;
-	for (unsigned int i = 0; i < nodeChildren->length; ++i) {
-		GumboNode *childNode = static_cast<GumboNode *>(nodeChildren->data[i]);
-		if (childNode->type != GUMBO_NODE_TEXT)
-			continue;
-
-		value += QString::fromUtf8(childNode->v.text.text);
+	// NOTE: usually there is the single text child, which is converted directly;
+	//       several ones are concatenated as UTF-8 and converted once
+	std::string_view firstText;
+	QByteArray value;
+	int textCount = 0;
+	for (QtGumboNodeRef child : getTextChildren()) {
+		std::string_view text = child->getInnerTextView();
+		if (textCount == 0) {
+			firstText = text;
+		} else {
+			if (textCount == 1)
+				value.append(firstText.data(), static_cast<int>(firstText.size()));
+			value.append(text.data(), static_cast<int>(text.size()));
+		}
+		textCount++;
 	}
-	return value;
+	return (textCount > 1) ? QString::fromUtf8(value) : toString(firstText);
 }
 
-QtGumboNodePtr QtGumboNode::getElementByTag(const HtmlTagDescription &tagDesc, int *foundPos) {
+QtGumboNodeRef QtGumboNode::getElementByTag(const HtmlTagDescription &tagDesc, int *foundPos) const {
 
 	Q_ASSERT(isValid());
 	if (!isValid())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 	Q_ASSERT(tagDesc.second >= 0);
 	if (tagDesc.second < 0)
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 
-	QtGumboNodes children = getChildren();
+	QtGumboNodeRange children = getChildren();
 	// NOTE: not all chilren are elements, so the assert below can fail:
 	//  Q_ASSERT(startPos < children.size()); if (startPos >= children.size()) return QtGumboNode();
 	int elementIndex = 0;
@@ -347,29 +497,29 @@ QtGumboNodePtr QtGumboNode::getElementByTag(const HtmlTagDescription &tagDesc, i
 		} else
 			elementIndex++;
 	}
-	return QtGumboNodePtr();
+	return QtGumboNodeRef();
 }
 
-QtGumboNodePtr QtGumboNode::getElementByTag(const HtmlTagDescriptions &tagDescsInitList, int *foundPos) {
+QtGumboNodeRef QtGumboNode::getElementByTag(const HtmlTagDescriptions &tagDescsInitList, int *foundPos) const {
 
 	Q_ASSERT(isElement());
 	if (!isElement())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 	Q_ASSERT(tagDescsInitList.size() > 0);
 	if (!tagDescsInitList.size())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 
 	if (foundPos)
 		*foundPos = 0;
 
-	auto node = QtGumboNodePool::globalInstance().getNode(m_node);
+	auto node = QtGumboNodeRef(this);
 	for (auto iItem : tagDescsInitList) {
 		//        Q_ASSERT(iItem->first != HtmlTag::UNKNOWN);
 		Q_ASSERT(iItem.second >= 0);
 
-		QtGumboNodes nodeChildren = node->getChildren(false);
+		QtGumboNodeRange nodeChildren = node->getChildren(false);
 		if (iItem.second >= nodeChildren.size()) {
-			node = QtGumboNodePtr();
+			node = QtGumboNodeRef();
 			break;
 		}
 
@@ -378,10 +528,10 @@ QtGumboNodePtr QtGumboNode::getElementByTag(const HtmlTagDescriptions &tagDescsI
 		node = nodeChildren[iItem.second];
 		Q_ASSERT(node->isElement());
 		if (!node->isElement())
-			return QtGumboNodePtr();
+			return QtGumboNodeRef();
 
 		if (node->getTag() != iItem.first) {
-			node = QtGumboNodePtr();
+			node = QtGumboNodeRef();
 			break;
 		}
 	}
@@ -389,70 +539,86 @@ QtGumboNodePtr QtGumboNode::getElementByTag(const HtmlTagDescriptions &tagDescsI
 	return node;
 }
 
-QtGumboNodePtr QtGumboNode::getElementByClass(const QString &className, const HtmlTag childTag) const {
+QtGumboNodeRef QtGumboNode::getElementByClass(const QString &className, const HtmlTag childTag) const {
 
 	Q_ASSERT(isValid());
 	if (!isValid())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
 	Q_ASSERT(!className.isEmpty());
 	if (className.isEmpty())
-		return QtGumboNodePtr();
+		return QtGumboNodeRef();
+
+	const QByteArray classNameUtf8 = className.toUtf8();
+	const std::string_view classNameView(classNameUtf8.constData(), classNameUtf8.size());
 
-	QtGumboNodes children = getChildren();
-	for (QtGumboNodes::iterator iChild = children.begin(); iChild != children.end(); ++iChild) {
-		if (((*iChild)->getTag() == childTag)
-			&& (QString::compare((*iChild)->getClassAttribute(), className, Qt::CaseInsensitive) == 0)) {
+	QtGumboNodeRange children = getChildren();
+	for (QtGumboNodeRange::const_iterator iChild = children.begin(); iChild != children.end(); ++iChild) {
+		if (((*iChild)->getTag() == childTag) && (*iChild)->hasClass(classNameView))
 			return *iChild;
-		}
 	}
-	return QtGumboNodePtr();
+	return QtGumboNodeRef();
 }
 
-QtGumboNodes QtGumboNode::getElementsByClass(const QString &className, const HtmlTag childTag) const {
+QtGumboNodeRefs QtGumboNode::getElementsByClass(const QString &className, const HtmlTag childTag) const {
 
 	Q_ASSERT(isValid());
 	if (!isValid())
-		return QtGumboNodes();
+		return QtGumboNodeRefs();
 	Q_ASSERT(!className.isEmpty());
 	if (className.isEmpty())
-		return QtGumboNodes();
+		return QtGumboNodeRefs();
 
-	QtGumboNodes result;
+	QtGumboNodeRefs result;
 
-	QtGumboNodes children = getChildren();
-	for (QtGumboNodes::iterator iChild = children.begin(); iChild != children.end(); ++iChild) {
-		if (((*iChild)->getTag() == childTag)
-			&& (QString::compare((*iChild)->getClassAttribute(), className, Qt::CaseInsensitive) == 0)) {
+	const QByteArray classNameUtf8 = className.toUtf8();
+	const std::string_view classNameView(classNameUtf8.constData(), classNameUtf8.size());
+
+	QtGumboNodeRange children = getChildren();
+	for (QtGumboNodeRange::const_iterator iChild = children.begin(); iChild != children.end(); ++iChild) {
+		if (((*iChild)->getTag() == childTag) && (*iChild)->hasClass(classNameView)) {
 			result << (*iChild);
 		}
 	}
 	return result;
 }
 
-QtGumboNodes QtGumboNode::getElementsByClassRecursive(const QString &className, const HtmlTag childTag) const {
+QtGumboNodeRefs QtGumboNode::getElementsByClassRecursive(const QString &className, const HtmlTag childTag) const {
+
+	QtGumboNodeRefs result;
+	appendElementsByClassRecursive(result, className, childTag);
+	return result;
+}
+
+void QtGumboNode::appendElementsByClassRecursive(
+	QtGumboNodeRefs &result, const QString &className, const HtmlTag childTag) const {
 
 	Q_ASSERT(isValid());
 	if (!isValid())
-		return QtGumboNodes();
+		return;
 	Q_ASSERT(!className.isEmpty());
 	if (className.isEmpty())
-		return QtGumboNodes();
-
-	QtGumboNodes result;
-
-	QtGumboNodes children = getChildren();
-	for (QtGumboNodes::iterator iChild = children.begin(); iChild != children.end(); ++iChild) {
-		if (((*iChild)->getTag() == childTag)
-			&& (QString::compare((*iChild)->getClassAttribute(), className, Qt::CaseInsensitive) == 0)) {
-			result << *iChild;
+		return;
+
+	const QByteArray classNameUtf8 = className.toUtf8();
+	const std::string_view classNameView(classNameUtf8.constData(), classNameUtf8.size());
+
+	// Indexed class: filter the subtree elements with its first token, instead of the subtree walk
+	const QtGumboNodeIndex &index = m_arena->index();
+	const std::string_view firstToken = classNameView.substr(0, classNameView.find_first_of(" \t\n\f\r"));
+	if (!firstToken.empty() && index.isClassIndexed(firstToken) && index.isSubtreeIndexed(QtGumboNodeRef(this))) {
+		for (QtGumboNodeRef node : index.elementsByClass(firstToken, QtGumboNodeRef(this))) {
+			if ((node->getTag() == childTag) && node->hasClass(classNameView))
+				result << node;
 		}
-
-		QtGumboNodes childResult = (*iChild)->getElementsByClassRecursive(className, childTag);
-		if (!childResult.empty())
-			result << childResult;
+		return;
 	}
 
-	return result;
+	QtGumboTreeWalker walker;
+	walker.walkPreOrder(QtGumboNodeRef(this), [&](QtGumboNodeRef node, int depth) {
+		if ((depth > 0) && (node->getTag() == childTag) && node->hasClass(classNameView))
+			result << node;
+		return QtGumboWalkAction::Continue;
+	});
 }
 
 size_t QtGumboNode::getTagLength() const {
@@ -491,31 +657,164 @@ QString QtGumboNode::getHtml() const {
 	return QString::fromUtf8(m_node->v.element.original_tag.data);
 }
 
-QtGumboNodePool &QtGumboNodePool::globalInstance() {
+// ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+QtGumboNodePtr QtGumboNodeRef::toSharedPtr() const {
+
+	if (!m_node)
+		return QtGumboNodePtr();
 
-	// Since it's a static variable, if the class has already been created,
-	// it won't be created again.
-	// And it **is** thread-safe in C++11.
-	static QtGumboNodePool instance;
-	return instance;
+	return m_node->m_arena->node(m_node->m_index);
 }
 
-QtGumboNodePtr QtGumboNodePool::getNode(GumboNode *node) {
+// ---------------------------------------------------------------------------------------------------------------------------------------------------
 
-	if (m_nodes.contains(node))
-		return m_nodes[node];
+int QtGumboNodeRange::size() const {
 
-	m_nodes[node] = QtGumboNodePtr(new QtGumboNode(node));
+	if (m_filter == QtGumboNodeFilter::All)
+		return static_cast<int>(m_last - m_first);
 
-#ifdef QT_GUMBO_METADATA
-	if (!m_nodeProps.contains(node)) {
-		auto props = QtGumboNodePropsPtr(new QtGumboNodeProps);
-		m_nodes[node]->fillMetadata(props);
-		m_nodes[node]->setMetadata(props);
+	return static_cast<int>(std::distance(begin(), end()));
+}
+
+bool QtGumboNodeRange::isEmpty() const { return (begin() == end()); }
+
+QtGumboNodeRef QtGumboNodeRange::operator[](int index) const {
+
+	Q_ASSERT((index >= 0) && (index < size()));
+	if (m_filter == QtGumboNodeFilter::All)
+		return QtGumboNodeRef(m_first + index);
 
-		m_nodeProps[node] = props;
+	auto iNode = begin();
+	std::advance(iNode, index);
+	return *iNode;
+}
+
+QtGumboNodeRange QtGumboNodeRange::mid(int pos) const {
+
+	Q_ASSERT(pos >= 0);
+	if (m_filter == QtGumboNodeFilter::All)
+		return QtGumboNodeRange((pos < m_last - m_first) ? m_first + pos : m_last, m_last, m_filter);
+
+	auto iNode = begin();
+	for (; (pos > 0) && (iNode != end()); --pos)
+		++iNode;
+	return QtGumboNodeRange(iNode.m_node, m_last, m_filter);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+QtGumboNodeArena::QtGumboNodeArena(const QByteArray &utf8Data)
+	: m_utf8Data(utf8Data)
+	, m_allocator(QtGumboAllocatorPool::globalInstance().acquire())
+	, m_output(nullptr)
+	, m_nodeCount(0)
+	, m_rootIndex(-1)
+	, m_index(new QtGumboNodeIndex)
+{
+}
+
+QtGumboNodeArena::~QtGumboNodeArena() {
+
+	// NOTE: no need to walk the whole tree with gumbo_destroy_output(), all the blocks are released at once
+	m_output = nullptr;
+	QtGumboAllocatorPool::globalInstance().release(std::move(m_allocator));
+}
+
+QtGumboNodeArenaPtr QtGumboNodeArena::create(const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions) {
+
+	// NOTE: constructor is private, so std::make_shared can't be used here
+	QtGumboNodeArenaPtr arena(new QtGumboNodeArena(utf8Data));
+	if (!arena->build())
+		return QtGumboNodeArenaPtr();
+
+	if (arena->m_rootIndex > 0)
+		arena->m_index->build(QtGumboNodeRef(&arena->m_nodes[arena->m_rootIndex]), indexOptions);
+
+	return arena;
+}
+
+bool QtGumboNodeArena::build() {
+
+	GumboOptions options = m_allocator->options();
+
+	// Parse web page contents
+	m_output = gumbo_parse_with_options(&options, m_utf8Data.constData(), m_utf8Data.length());
+	Q_ASSERT(!!m_output);
+	if (!m_output)
+		return false;
+
+	// Count the nodes first, to allocate the wrappers at once
+	std::vector<const GumboNode *> stack;
+	stack.push_back(m_output->document);
+	while (!stack.empty()) {
+		const GumboNode *node = stack.back();
+		stack.pop_back();
+		m_nodeCount++;
+
+		const GumboVector *children = gumboNodeChildren(node);
+		if (!children)
+			continue;
+		for (unsigned int i = 0; i < children->length; ++i)
+			stack.push_back(static_cast<const GumboNode *>(children->data[i]));
 	}
-#endif
 
-	return m_nodes[node];
+	m_nodes.reset(new QtGumboNode[m_nodeCount]);
+
+	// Breadth-first walk: the array itself is the queue, and the children of every node get consecutive indexes
+	m_nodes[0].m_node = m_output->document;
+	m_nodes[0].m_arena = this;
+	m_nodes[0].m_index = 0;
+
+	int tail = 1;
+	for (int head = 0; head < tail; ++head) {
+		QtGumboNode &wrapper = m_nodes[head];
+		const GumboVector *children = gumboNodeChildren(wrapper.m_node);
+		if (!children)
+			continue;
+
+		wrapper.m_firstChild = tail;
+		wrapper.m_childCount = static_cast<int>(children->length);
+		for (unsigned int i = 0; i < children->length; ++i) {
+			QtGumboNode &child = m_nodes[tail];
+			child.m_node = static_cast<GumboNode *>(children->data[i]);
+			child.m_arena = this;
+			child.m_index = tail;
+			child.m_parentIndex = head;
+
+			if (child.m_node == m_output->root)
+				m_rootIndex = tail;
+			tail++;
+		}
+	}
+	Q_ASSERT(tail == m_nodeCount);
+	Q_ASSERT(m_rootIndex > 0);
+
+	return true;
+}
+
+GumboOutput *QtGumboNodeArena::output() const { return m_output; }
+
+int QtGumboNodeArena::nodeCount() const { return m_nodeCount; }
+
+QtGumboNodePtr QtGumboNodeArena::node(int index) const {
+
+	Q_ASSERT((index >= 0) && (index < m_nodeCount));
+	if ((index < 0) || (index >= m_nodeCount))
+		return QtGumboNodePtr();
+
+	// NOTE: aliasing constructor: pointer to the array item, which shares the ownership of the whole arena
+	return QtGumboNodePtr(shared_from_this(), &m_nodes[index]);
 }
+
+const QtGumboNode &QtGumboNodeArena::nodeAt(int index) const {
+
+	Q_ASSERT((index >= 0) && (index < m_nodeCount));
+	return m_nodes[index];
+}
+
+QtGumboNodePtr QtGumboNodeArena::documentNode() const { return node(0); }
+
+QtGumboNodePtr QtGumboNodeArena::rootNode() const { return (m_rootIndex > 0) ? node(m_rootIndex) : QtGumboNodePtr(); }
+
+const QtGumboNodeIndex &QtGumboNodeArena::index() const { return *m_index; }
@@ -24,66 +24,119 @@
 #ifndef __BFR_QTGUMBONODE_H__
 #define __BFR_QTGUMBONODE_H__
 
+#include <QtCore/QByteArray>
 #include <QtCore/QString>
 #include <QtCore/QVector>
 #include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QTextCodec>
 
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 #include <gumbo-parser/src/gumbo.h>
 
 #include "html_tag.h"
+#include "qtgumboallocator.h"
 
 class QtGumboNode;
+class QtGumboNodeRef;
+class QtGumboNodeRange;
 using QtGumboNodePtr = std::shared_ptr<QtGumboNode>;
-using QtGumboNodes = QVector<QtGumboNodePtr>;
+using QtGumboNodeRawPtrs = QVector<const QtGumboNode *>;
+using QtGumboNodeRefs = QVector<QtGumboNodeRef>;
 using QtGumboNodePathItem = QPair<QString, size_t>;
 using QtGumboNodePath = QList<QtGumboNodePathItem>;
 
 enum class QtGumboNodeType { Invalid = -1, Document = 0, Element = 1, Text, CDATA, Comment, Whitespace, Template, Count };
+enum class QtGumboNodeFilter { All, Elements, Text };
 
 #ifdef QT_GUMBO_METADATA
 using QtStringMap = QMap<QString, QString>;
 
-struct QtGumboNodeProps {
-
-	bool m_isValid = false;
-
-	QtGumboNodeType m_type;
-	QtGumboNodePath m_path;
-
-	QtGumboNodePtr m_parent;
-	size_t m_parentIndex;
-
-	HtmlTag m_tag = HtmlTag::UNKNOWN;
-	QString m_tagName;
-	QString m_html;
-
-	QtStringMap m_attributes;
-	QString m_id;
-	QString m_class;
+// Debug metadata of the node: every field is computed on the first request only and then cached,
+// so the metadata costs nothing for the nodes nobody looks at. Thread-safe, like the node itself
+class QtGumboNodeProps {
 
+	// Delete copy and move constructors and assign operators
+	QtGumboNodeProps(QtGumboNodeProps const &) = delete; // Copy construct
+	QtGumboNodeProps(QtGumboNodeProps &&) = delete; // Move construct
+	QtGumboNodeProps &operator=(QtGumboNodeProps const &) = delete; // Copy assign
+	QtGumboNodeProps &operator=(QtGumboNodeProps &&) = delete; // Move assign
+
+	// NOTE: raw pointer, to not hold the arena owning both the node and its props
+	const QtGumboNode *m_node;
+
+	mutable QMutex m_mutex;
+	mutable std::optional<QtGumboNodePath> m_path;
+	mutable std::optional<QString> m_tagName;
+	mutable std::optional<QString> m_html;
+	mutable std::optional<QtStringMap> m_attributes;
+	mutable std::optional<QString> m_id;
+	mutable std::optional<QString> m_class;
 	// Text node only
-	QString m_text;
-
+	mutable std::optional<QString> m_text;
 	// Element only
-	QString m_childrenText;
+	mutable std::optional<QString> m_childrenText;
+	mutable std::optional<QtGumboNodeRawPtrs> m_children;
+	mutable std::optional<QtGumboNodeRawPtrs> m_elementChildren;
+	mutable std::optional<QtGumboNodeRawPtrs> m_textChildren;
 
-	QtGumboNodes m_children;
-	QtGumboNodes m_elementChildren;
-	QtGumboNodes m_textChildren;
-};
+	template <typename T, typename Getter> const T &cached(std::optional<T> &field, Getter getter) const;
+
+public:
+	explicit QtGumboNodeProps(const QtGumboNode *node) : m_node(node) {}
 
-using QtGumboNodePropsPtr = std::shared_ptr<QtGumboNodeProps>;
+	bool isValid() const;
+	QtGumboNodeType type() const;
+	const QtGumboNode *parent() const;
+	size_t parentIndex() const;
+	HtmlTag tag() const;
+
+	const QtGumboNodePath &path() const;
+	const QString &tagName() const;
+	const QString &html() const;
+	const QtStringMap &attributes() const;
+	const QString &id() const;
+	const QString &className() const;
+	const QString &text() const;
+	const QString &childrenText() const;
+	const QtGumboNodeRawPtrs &children() const;
+	const QtGumboNodeRawPtrs &elementChildren() const;
+	const QtGumboNodeRawPtrs &textChildren() const;
+};
 #endif
 
+class QtGumboNodeArena;
+class QtGumboNodeIndex;
+struct QtGumboIndexOptions;
+using QtGumboNodeArenaPtr = std::shared_ptr<QtGumboNodeArena>;
+
 class QtGumboNode {
 
-	GumboNode *m_node;
+	friend class QtGumboNodeArena;
+	friend class QtGumboNodeIndex;
+	friend class QtGumboNodeRef;
+	friend class QtGumboNodeProps;
+
+	GumboNode *m_node = nullptr;
+
+	// Owner arena and the node position in it
+	const QtGumboNodeArena *m_arena = nullptr;
+	int m_index = -1;
+	int m_parentIndex = -1;
+	// Children are stored in the arena contiguously, starting from this index
+	int m_firstChild = 0;
+	int m_childCount = 0;
 
 #ifdef QT_GUMBO_METADATA
-	QtGumboNodePropsPtr m_props;
+	// NOTE: created on the first metadata() call only
+	mutable std::atomic<QtGumboNodeProps *> m_props { nullptr };
 #endif
 
 private:
@@ -95,12 +148,12 @@ private:
 
 public:
 	QtGumboNode() = default;
-	QtGumboNode(GumboNode *node);
-	~QtGumboNode() = default;
-
 #ifdef QT_GUMBO_METADATA
-	void fillMetadata(QtGumboNodePropsPtr props);
-	void setMetadata(QtGumboNodePropsPtr props);
+	~QtGumboNode();
+
+	const QtGumboNodeProps &metadata() const;
+#else
+	~QtGumboNode() = default;
 #endif
 
 	bool isValid() const;
@@ -112,7 +165,7 @@ public:
 
 	QtGumboNodeType getType() const;
 
-	QtGumboNodePtr getParent() const;
+	QtGumboNodeRef getParent() const;
 	size_t getParentIndex() const;
 
 	QtGumboNodePath getPath() const;
@@ -121,33 +174,61 @@ public:
 	QString getTagName() const;
 
 	bool hasAttribute(const QString &name) const;
+	bool hasAttribute(QLatin1String name) const;
+	bool hasAttribute(const char *name) const;
 	bool hasIdAttribute() const;
 	bool hasClassAttribute() const;
 	size_t getAttributeCount() const;
 	QString getAttribute(const QString &name) const;
+	QString getAttribute(QLatin1String name) const;
+	QString getAttribute(const char *name) const;
 	QString getIdAttribute() const;
 	QString getClassAttribute() const;
-
-	QtGumboNodes getChildren(const bool elementsOnly = true) const;
-	QtGumboNodes getTextChildren() const;
+	// Whitespace-separated class attribute contains the specified token (case-insensitive)
+	bool hasClassToken(std::string_view className) const;
+
+	// UTF-8 views into the Gumbo parse tree: no conversion or copy, valid while the document is alive;
+	// null view if the attribute is absent
+	std::string_view getAttributeView(QLatin1String name) const;
+	std::string_view getAttributeView(const char *name) const;
+	std::string_view getIdAttributeView() const;
+	std::string_view getClassAttributeView() const;
+	std::string_view getInnerTextView() const;
+
+	static QString toString(std::string_view utf8Text);
+
+	// NOTE: children are returned as the view over the document arena, nothing is copied
+	QtGumboNodeRange getChildren(const bool elementsOnly = true) const;
+	QtGumboNodeRange getChildren(const QtGumboNodeFilter filter) const;
+	QtGumboNodeRange getTextChildren() const;
 	int getChildElementCount(const bool elementsOnly = true) const;
 	int getTextChildrenCount() const;
+	bool matches(const QtGumboNodeFilter filter) const;
 
 	QString getInnerText() const;
-	QString getChildrenInnerText();
+	QString getChildrenInnerText() const;
+
+private:
+	const GumboAttribute *findAttribute(const char *name, size_t length) const;
+	bool hasClass(std::string_view className) const;
+
+public:
 
 	// Non-recursive(!) search for the first child node with specified tag, from specified position (index of child)
 	using HtmlTagDescription = std::pair<HtmlTag, int>;
 	using HtmlTagDescriptions = std::initializer_list<HtmlTagDescription>;
-	QtGumboNodePtr getElementByTag(const HtmlTagDescription &tagDesc, int *foundPos = nullptr);
-	QtGumboNodePtr getElementByTag(const HtmlTagDescriptions &tagDescs, int *foundPos = nullptr);
+	QtGumboNodeRef getElementByTag(const HtmlTagDescription &tagDesc, int *foundPos = nullptr) const;
+	QtGumboNodeRef getElementByTag(const HtmlTagDescriptions &tagDescs, int *foundPos = nullptr) const;
 
 	// Non-recursive(!) search for the first child node with specified class name and tag (div by default)
-	QtGumboNodePtr getElementByClass(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
-	QtGumboNodes getElementsByClass(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
+	QtGumboNodeRef getElementByClass(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
+	QtGumboNodeRefs getElementsByClass(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
 
 	// Recursive search for the first child node with specified class name and tag (div by default)
-	QtGumboNodes getElementsByClassRecursive(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
+	QtGumboNodeRefs getElementsByClassRecursive(const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
+	// Same as above, but appends the found nodes to the specified list
+	void appendElementsByClassRecursive(
+		QtGumboNodeRefs &result, const QString &className, const HtmlTag childTag = HtmlTag::DIV) const;
 
 	// Tag text and position in raw HTML text
 	size_t getTagLength() const;
@@ -156,31 +237,164 @@ public:
 	QString getHtml() const;
 };
 
-class QtGumboNodePool
-{
-	// Delete copy and move constructors and assign operators
-	QtGumboNodePool(QtGumboNodePool const &) = delete; // Copy construct
-	QtGumboNodePool(QtGumboNodePool &&) = delete; // Move construct
-	QtGumboNodePool &operator=(QtGumboNodePool const &) = delete; // Copy assign
-	QtGumboNodePool &operator=(QtGumboNodePool &&) = delete; // Move assign
+// Non-owning node handle: a plain pointer to the node wrapper inside the document arena.
+// Trivially copyable, so passing it around costs neither allocation nor reference counting;
+// valid while the document or any QtGumboNodePtr of it is alive
+class QtGumboNodeRef {
 
-protected:
-	using NodeMap = QMap<GumboNode *, QtGumboNodePtr>;
-	NodeMap m_nodes;
+	const QtGumboNode *m_node = nullptr;
 
-#ifdef QT_GUMBO_METADATA
-	using MetainfoMap = QMap<GumboNode *, QtGumboNodePropsPtr>;
-	MetainfoMap m_nodeProps;
-#endif
+public:
+	QtGumboNodeRef() = default;
+	explicit QtGumboNodeRef(const QtGumboNode *node) : m_node(node) {}
+	QtGumboNodeRef(const QtGumboNodePtr &node) : m_node(node.get()) {}
+
+	const QtGumboNode *get() const { return m_node; }
+	const QtGumboNode *operator->() const { return m_node; }
+	const QtGumboNode &operator*() const { return *m_node; }
+	explicit operator bool() const { return (m_node != nullptr); }
+
+	// Owning pointer, which keeps the whole document alive
+	QtGumboNodePtr toSharedPtr() const;
+
+	friend bool operator==(const QtGumboNodeRef &lhs, const QtGumboNodeRef &rhs) { return (lhs.m_node == rhs.m_node); }
+	friend bool operator!=(const QtGumboNodeRef &lhs, const QtGumboNodeRef &rhs) { return (lhs.m_node != rhs.m_node); }
+};
+
+static_assert(std::is_trivially_copyable<QtGumboNodeRef>::value, "QtGumboNodeRef must be trivially copyable");
+
+// View over the node children, optionally filtered by node type.
+// Children of the node are contiguous in the document arena, so the view is just a pair of pointers
+class QtGumboNodeRange {
+
+	friend class QtGumboNode;
 
-	QtGumboNodePool() = default;
-	~QtGumboNodePool() = default;
+public:
+	class const_iterator {
+
+		friend class QtGumboNodeRange;
+
+		const QtGumboNode *m_node = nullptr;
+		const QtGumboNode *m_end = nullptr;
+		QtGumboNodeFilter m_filter = QtGumboNodeFilter::All;
+
+		const_iterator(const QtGumboNode *node, const QtGumboNode *end, const QtGumboNodeFilter filter)
+			: m_node(node), m_end(end), m_filter(filter) { skipFiltered(); }
+
+		void skipFiltered() {
+
+			while ((m_node != m_end) && !m_node->matches(m_filter))
+				++m_node;
+		}
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = QtGumboNodeRef;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const QtGumboNode *;
+		using reference = QtGumboNodeRef;
+
+		const_iterator() = default;
+
+		QtGumboNodeRef operator*() const { return QtGumboNodeRef(m_node); }
+		const QtGumboNode *operator->() const { return m_node; }
+
+		const_iterator &operator++() {
+
+			++m_node;
+			skipFiltered();
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+
+			const_iterator result = *this;
+			++(*this);
+			return result;
+		}
+
+		bool operator==(const const_iterator &other) const { return (m_node == other.m_node); }
+		bool operator!=(const const_iterator &other) const { return (m_node != other.m_node); }
+	};
+
+private:
+	const QtGumboNode *m_first = nullptr;
+	const QtGumboNode *m_last = nullptr;
+	QtGumboNodeFilter m_filter = QtGumboNodeFilter::All;
+
+	QtGumboNodeRange(const QtGumboNode *first, const QtGumboNode *last, const QtGumboNodeFilter filter)
+		: m_first(first), m_last(last), m_filter(filter) {}
 
 public:
-	QtGumboNodePtr getNode(GumboNode *node);
+	QtGumboNodeRange() = default;
+
+	const_iterator begin() const { return const_iterator(m_first, m_last, m_filter); }
+	const_iterator end() const { return const_iterator(m_last, m_last, m_filter); }
+
+	// NOTE: constant time for the unfiltered view, linear otherwise
+	int size() const;
+	bool isEmpty() const;
+	QtGumboNodeRef operator[](int index) const;
+	// View without the first pos items
+	QtGumboNodeRange mid(int pos) const;
+};
+
+inline bool QtGumboNode::matches(const QtGumboNodeFilter filter) const {
+
+	switch (filter) {
+		case QtGumboNodeFilter::Elements:
+			return (m_node->type == GUMBO_NODE_ELEMENT);
+		case QtGumboNodeFilter::Text:
+			return (m_node->type == GUMBO_NODE_TEXT);
+		default:
+			return true;
+	}
+}
+
+// Owner of the parsed HTML: UTF-8 text, Gumbo parse tree built on it and the node wrappers.
+// Wrappers are stored in the single array in breadth-first order, so children of any node are contiguous,
+// and both parent and child lookup is an O(1) indexing. Node pointers given out share the arena ownership:
+// the whole tree is freed at once, when the document and the last node pointer are gone
+class QtGumboNodeArena : public std::enable_shared_from_this<QtGumboNodeArena> {
+
+	// Delete copy and move constructors and assign operators
+	QtGumboNodeArena(QtGumboNodeArena const &) = delete; // Copy construct
+	QtGumboNodeArena(QtGumboNodeArena &&) = delete; // Move construct
+	QtGumboNodeArena &operator=(QtGumboNodeArena const &) = delete; // Copy assign
+	QtGumboNodeArena &operator=(QtGumboNodeArena &&) = delete; // Move assign
+
+	// NOTE: Gumbo nodes point into this buffer, so it must not be modified
+	QByteArray m_utf8Data;
+	// NOTE: parse output lives in the allocator blocks, which are recycled when the arena dies
+	QtGumboAllocatorPtr m_allocator;
+	GumboOutput *m_output;
+
+	std::unique_ptr<QtGumboNode[]> m_nodes;
+	int m_nodeCount;
+	int m_rootIndex;
+
+	std::unique_ptr<QtGumboNodeIndex> m_index;
+
+	explicit QtGumboNodeArena(const QByteArray &utf8Data);
+
+	bool build();
 
 public:
-	static QtGumboNodePool &globalInstance();
+	~QtGumboNodeArena();
+
+	// Parse UTF-8 encoded HTML and index it; returns null pointer on failure
+	static QtGumboNodeArenaPtr create(const QByteArray &utf8Data, const QtGumboIndexOptions &indexOptions);
+
+	GumboOutput *output() const;
+	int nodeCount() const;
+
+	QtGumboNodePtr node(int index) const;
+	const QtGumboNode &nodeAt(int index) const;
+
+	QtGumboNodePtr documentNode() const;
+	QtGumboNodePtr rootNode() const;
+
+	const QtGumboNodeIndex &index() const;
 };
 
 #endif // __BFR_QTGUMBONODE_H__
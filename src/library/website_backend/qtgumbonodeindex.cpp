@@ -0,0 +1,207 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "qtgumbonodeindex.h"
+#include "qtgumbotreewalker.h"
+
+namespace {
+bool isHtmlWhitespace(char c) { return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\f') || (c == '\r'); }
+
+bool startsWith(std::string_view text, std::string_view prefix) {
+
+	return (text.size() >= prefix.size()) && (text.compare(0, prefix.size(), prefix) == 0);
+}
+
+std::string_view toStringView(const QByteArray &text) { return std::string_view(text.constData(), text.size()); }
+}
+
+size_t QtGumboNodeIndex::CaseInsensitiveHash::operator()(std::string_view text) const {
+
+	// FNV-1a of the lower case ASCII text
+	quint64 result = 14695981039346656037ULL;
+	for (char c : text) {
+		result ^= static_cast<uchar>(((c >= 'A') && (c <= 'Z')) ? (c - 'A' + 'a') : c);
+		result *= 1099511628211ULL;
+	}
+	return static_cast<size_t>(result);
+}
+
+bool QtGumboNodeIndex::CaseInsensitiveEqual::operator()(std::string_view lhs, std::string_view rhs) const {
+
+	if (lhs.size() != rhs.size())
+		return false;
+	if (lhs.empty())
+		return true;
+
+	return (qstrnicmp(lhs.data(), rhs.data(), static_cast<uint>(lhs.size())) == 0);
+}
+
+void QtGumboNodeIndex::build(QtGumboNodeRef rootNode, const QtGumboIndexOptions &options) {
+
+	Q_ASSERT(rootNode && rootNode->isElement());
+	if (!rootNode || !rootNode->isElement())
+		return;
+
+	m_options = options;
+	for (const QByteArray &prefix : m_options.m_idPrefixes)
+		m_idPrefixNodes.emplace_back(prefix, QtGumboNodeRefs());
+
+	if (m_options.m_indexClasses) {
+		m_enter.assign(rootNode->m_arena->nodeCount(), -1);
+		m_exit.assign(rootNode->m_arena->nodeCount(), -1);
+	}
+
+	// Ancestors of the current node, to be closed with the exit number when the walk leaves them
+	std::vector<int> openNodes;
+	int elementNumber = 0;
+
+	// Pre-order walk, so every node list is in the document order
+	QtGumboTreeWalker walker;
+	walker.walkPreOrder(rootNode, [&](QtGumboNodeRef node, int depth) {
+		if (m_options.m_indexClasses) {
+			while (static_cast<int>(openNodes.size()) > depth) {
+				m_exit[openNodes.back()] = elementNumber;
+				openNodes.pop_back();
+			}
+			m_enter[node->m_index] = elementNumber++;
+			openNodes.push_back(node->m_index);
+		}
+		if (m_options.m_indexIds) {
+			std::string_view id = node->getIdAttributeView();
+			if (!id.empty())
+				addId(node, id);
+		}
+		if (m_options.m_indexClasses) {
+			std::string_view classValue = node->getClassAttributeView();
+			if (!classValue.empty())
+				addClasses(node, classValue);
+		}
+		return QtGumboWalkAction::Continue;
+	});
+
+	for (int nodeIndex : openNodes)
+		m_exit[nodeIndex] = elementNumber;
+}
+
+void QtGumboNodeIndex::addId(QtGumboNodeRef node, std::string_view id) {
+
+	if (!m_idPrefixNodes.empty()) {
+		auto iPrefix = std::find_if(m_idPrefixNodes.begin(), m_idPrefixNodes.end(),
+			[id](const auto &prefixNodes) { return startsWith(id, toStringView(prefixNodes.first)); });
+		if (iPrefix == m_idPrefixNodes.end())
+			return;
+
+		iPrefix->second << node;
+	}
+
+	// NOTE: id must be unique, but if it's not, the first element wins as in the browsers
+	if (m_ids.emplace(id, node).second)
+		m_orderedIds.emplace_back(id, node);
+}
+
+void QtGumboNodeIndex::addClasses(QtGumboNodeRef node, std::string_view classValue) {
+
+	size_t tokenStart = 0;
+	while (tokenStart < classValue.size()) {
+		if (isHtmlWhitespace(classValue[tokenStart])) {
+			tokenStart++;
+			continue;
+		}
+
+		size_t tokenEnd = tokenStart;
+		while ((tokenEnd < classValue.size()) && !isHtmlWhitespace(classValue[tokenEnd]))
+			tokenEnd++;
+
+		std::string_view token = classValue.substr(tokenStart, tokenEnd - tokenStart);
+		if (isClassIndexed(token)) {
+			QtGumboNodeRefs &nodes = m_classes[token];
+			// NOTE: the same token can be repeated in the single class attribute
+			if (nodes.isEmpty() || (nodes.last() != node))
+				nodes << node;
+		}
+		tokenStart = tokenEnd;
+	}
+}
+
+bool QtGumboNodeIndex::isClassIndexed(std::string_view classToken) const {
+
+	if (!m_options.m_indexClasses)
+		return false;
+	if (m_options.m_classes.isEmpty())
+		return true;
+
+	CaseInsensitiveEqual isEqual;
+	return std::any_of(m_options.m_classes.begin(), m_options.m_classes.end(),
+		[&](const QByteArray &className) { return isEqual(toStringView(className), classToken); });
+}
+
+QtGumboNodeRef QtGumboNodeIndex::elementById(std::string_view id) const {
+
+	auto iNode = m_ids.find(id);
+	return (iNode != m_ids.end()) ? iNode->second : QtGumboNodeRef();
+}
+
+QtGumboNodeRefs QtGumboNodeIndex::elementsByIdPrefix(std::string_view prefix) const {
+
+	for (const auto &prefixNodes : m_idPrefixNodes) {
+		if (toStringView(prefixNodes.first) == prefix)
+			return prefixNodes.second;
+	}
+
+	// Not the requested prefix: scan the ids only, not the whole document
+	QtGumboNodeRefs result;
+	for (const auto &idNode : m_orderedIds) {
+		if (startsWith(idNode.first, prefix))
+			result << idNode.second;
+	}
+	return result;
+}
+
+QtGumboNodeRefs QtGumboNodeIndex::elementsByClass(std::string_view classToken) const {
+
+	auto iNodes = m_classes.find(classToken);
+	return (iNodes != m_classes.end()) ? iNodes->second : QtGumboNodeRefs();
+}
+
+bool QtGumboNodeIndex::isSubtreeIndexed(QtGumboNodeRef subtreeRoot) const {
+
+	return subtreeRoot && (subtreeRoot->m_index < static_cast<int>(m_enter.size())) && (m_enter[subtreeRoot->m_index] >= 0);
+}
+
+QtGumboNodeRefs QtGumboNodeIndex::elementsByClass(std::string_view classToken, QtGumboNodeRef subtreeRoot) const {
+
+	Q_ASSERT(isSubtreeIndexed(subtreeRoot));
+	if (!isSubtreeIndexed(subtreeRoot))
+		return QtGumboNodeRefs();
+
+	auto iNodes = m_classes.find(classToken);
+	if (iNodes == m_classes.end())
+		return QtGumboNodeRefs();
+
+	// NOTE: nodes are in the document order, i.e. sorted by the enter number, and the subtree is the contiguous interval
+	const QtGumboNodeRefs &nodes = iNodes->second;
+	auto enterNumberLess = [this](QtGumboNodeRef node, int number) { return (m_enter[node->m_index] < number); };
+	auto iFirst = std::lower_bound(nodes.begin(), nodes.end(), m_enter[subtreeRoot->m_index] + 1, enterNumberLess);
+	auto iLast = std::lower_bound(iFirst, nodes.end(), m_exit[subtreeRoot->m_index], enterNumberLess);
+	return nodes.mid(static_cast<int>(iFirst - nodes.begin()), static_cast<int>(iLast - iFirst));
+}
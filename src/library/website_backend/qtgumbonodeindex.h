@@ -0,0 +1,100 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_QTGUMBONODEINDEX_H__
+#define __BFR_QTGUMBONODEINDEX_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "qtgumbonode.h"
+
+// What to index on the document construction; empty list means no limit
+struct QtGumboIndexOptions {
+	bool m_indexIds = true;
+	bool m_indexClasses = true;
+	// Index only the ids starting with one of these prefixes
+	QList<QByteArray> m_idPrefixes;
+	// Index only these class tokens (case-insensitive)
+	QList<QByteArray> m_classes;
+};
+
+// Element lookup tables of the single document, built in one pass in the document order.
+// Keys are the views into the Gumbo parse tree, so the index must not outlive its arena
+class QtGumboNodeIndex {
+	// Delete copy and move constructors and assign operators
+	QtGumboNodeIndex(QtGumboNodeIndex const &) = delete; // Copy construct
+	QtGumboNodeIndex(QtGumboNodeIndex &&) = delete; // Move construct
+	QtGumboNodeIndex &operator=(QtGumboNodeIndex const &) = delete; // Copy assign
+	QtGumboNodeIndex &operator=(QtGumboNodeIndex &&) = delete; // Move assign
+
+	struct CaseInsensitiveHash {
+		size_t operator()(std::string_view text) const;
+	};
+	struct CaseInsensitiveEqual {
+		bool operator()(std::string_view lhs, std::string_view rhs) const;
+	};
+
+	QtGumboIndexOptions m_options;
+
+	std::unordered_map<std::string_view, QtGumboNodeRef> m_ids;
+	// All the indexed ids in the document order, for the prefix search
+	std::vector<std::pair<std::string_view, QtGumboNodeRef>> m_orderedIds;
+	// Elements of the requested id prefixes
+	std::vector<std::pair<QByteArray, QtGumboNodeRefs>> m_idPrefixNodes;
+
+	std::unordered_map<std::string_view, QtGumboNodeRefs, CaseInsensitiveHash, CaseInsensitiveEqual> m_classes;
+
+	// Pre-order element numbers by the arena node index: descendants of the node are numbered
+	// from its enter number + 1 up to its exit number (exclusive); -1 for the nodes out of the root subtree.
+	// NOTE: filled only with classes indexed, as the scoped class lookup is the only user
+	std::vector<int> m_enter;
+	std::vector<int> m_exit;
+
+	void addId(QtGumboNodeRef node, std::string_view id);
+	void addClasses(QtGumboNodeRef node, std::string_view classValue);
+
+public:
+	QtGumboNodeIndex() = default;
+	~QtGumboNodeIndex() = default;
+
+	void build(QtGumboNodeRef rootNode, const QtGumboIndexOptions &options);
+
+	bool isClassIndexed(std::string_view classToken) const;
+
+	QtGumboNodeRef elementById(std::string_view id) const;
+	QtGumboNodeRefs elementsByIdPrefix(std::string_view prefix) const;
+	QtGumboNodeRefs elementsByClass(std::string_view classToken) const;
+	// Descendants of the specified node only: binary search over the pre-order numbers instead of the subtree walk;
+	// the node must be in the root element subtree, with classes indexed
+	bool isSubtreeIndexed(QtGumboNodeRef subtreeRoot) const;
+	QtGumboNodeRefs elementsByClass(std::string_view classToken, QtGumboNodeRef subtreeRoot) const;
+};
+
+#endif // __BFR_QTGUMBONODEINDEX_H__
@@ -0,0 +1,355 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#include "qtgumboselector.h"
+#include "qtgumbotreewalker.h"
+
+#include <utility>
+
+namespace {
+bool isWhitespace(char c) { return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\f') || (c == '\r'); }
+
+bool isIdentifierChar(char c) {
+
+	return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '-')
+		|| (c == '_') || (static_cast<uchar>(c) >= 0x80);
+}
+
+// Selector text reader
+class SelectorReader {
+	std::string_view m_text;
+	size_t m_pos = 0;
+
+public:
+	explicit SelectorReader(std::string_view text) : m_text(text) {}
+
+	bool atEnd() const { return (m_pos >= m_text.size()); }
+	char peek() const { return atEnd() ? '\0' : m_text[m_pos]; }
+	size_t pos() const { return m_pos; }
+
+	bool skip(char c) {
+
+		if (peek() != c)
+			return false;
+		m_pos++;
+		return true;
+	}
+
+	bool skipWhitespace() {
+
+		size_t start = m_pos;
+		while (!atEnd() && isWhitespace(m_text[m_pos]))
+			m_pos++;
+		return (m_pos != start);
+	}
+
+	std::string_view readIdentifier() {
+
+		size_t start = m_pos;
+		while (!atEnd() && isIdentifierChar(m_text[m_pos]))
+			m_pos++;
+		return m_text.substr(start, m_pos - start);
+	}
+
+	// Quoted string or identifier
+	std::string_view readValue() {
+
+		char quote = peek();
+		if ((quote != '"') && (quote != '\''))
+			return readIdentifier();
+
+		size_t start = ++m_pos;
+		while (!atEnd() && (m_text[m_pos] != quote))
+			m_pos++;
+		std::string_view result = m_text.substr(start, m_pos - start);
+		skip(quote);
+		return result;
+	}
+
+	int readNumber() {
+
+		int result = 0;
+		size_t start = m_pos;
+		while (!atEnd() && (m_text[m_pos] >= '0') && (m_text[m_pos] <= '9') && (m_pos - start < 9))
+			result = result * 10 + (m_text[m_pos++] - '0');
+		return (m_pos != start) ? result : -1;
+	}
+};
+
+QByteArray toByteArray(std::string_view text) { return QByteArray(text.data(), static_cast<int>(text.size())); }
+
+// 1-based index of the element among the element siblings
+int elementIndex(QtGumboNodeRef node) {
+
+	QtGumboNodeRef parent = node->getParent();
+	if (!parent || !parent->isElement())
+		return 1;
+
+	int result = 0;
+	for (QtGumboNodeRef sibling : parent->getChildren(QtGumboNodeFilter::Elements)) {
+		result++;
+		if (sibling == node)
+			break;
+	}
+	return result;
+}
+}
+
+QtGumboSelector::QtGumboSelector(std::string_view selector) {
+
+	if (!compile(selector))
+		m_steps.clear();
+}
+
+bool QtGumboSelector::isValid() const { return !m_steps.empty(); }
+
+QString QtGumboSelector::errorString() const { return m_errorString; }
+
+bool QtGumboSelector::compile(std::string_view selector) {
+
+	SelectorReader reader(selector);
+	auto fail = [&](const char *message) {
+		m_errorString = QString("%1 at position %2").arg(message).arg(reader.pos());
+		return false;
+	};
+
+	reader.skipWhitespace();
+	Combinator combinator = reader.skip('>') ? Combinator::Child : Combinator::Descendant;
+	reader.skipWhitespace();
+
+	while (true) {
+		Step step;
+		step.m_combinator = combinator;
+
+		bool hasSimpleSelector = false;
+		if (reader.skip('*')) {
+			hasSimpleSelector = true;
+		} else {
+			std::string_view tagName = reader.readIdentifier();
+			if (!tagName.empty()) {
+				GumboTag tag = gumbo_tagn_enum(tagName.data(), static_cast<unsigned int>(tagName.size()));
+				if (tag == GUMBO_TAG_UNKNOWN)
+					return fail("Unknown tag name");
+
+				step.m_anyTag = false;
+				step.m_tag = HtmlTag(tag);
+				hasSimpleSelector = true;
+			}
+		}
+
+		while (true) {
+			Condition condition;
+			if (reader.skip('.')) {
+				condition.m_type = Condition::Type::Class;
+				condition.m_value = toByteArray(reader.readIdentifier());
+			} else if (reader.skip('#')) {
+				condition.m_type = Condition::Type::Id;
+				condition.m_value = toByteArray(reader.readIdentifier());
+			} else if (reader.skip('[')) {
+				reader.skipWhitespace();
+				condition.m_name = toByteArray(reader.readIdentifier());
+				if (condition.m_name.isEmpty())
+					return fail("Attribute name expected");
+				reader.skipWhitespace();
+
+				condition.m_type = Condition::Type::AttributeExists;
+				if (reader.skip('^'))
+					condition.m_type = Condition::Type::AttributePrefix;
+				if (reader.skip('=')) {
+					if (condition.m_type != Condition::Type::AttributePrefix)
+						condition.m_type = Condition::Type::AttributeEquals;
+					reader.skipWhitespace();
+					condition.m_value = toByteArray(reader.readValue());
+					reader.skipWhitespace();
+				} else if (condition.m_type == Condition::Type::AttributePrefix) {
+					return fail("'=' expected");
+				}
+
+				if (!reader.skip(']'))
+					return fail("']' expected");
+			} else if (reader.skip(':')) {
+				if (reader.readIdentifier() != "nth-child" || !reader.skip('('))
+					return fail("Only :nth-child(n) pseudo-class is supported");
+
+				reader.skipWhitespace();
+				condition.m_type = Condition::Type::NthChild;
+				condition.m_index = reader.readNumber();
+				reader.skipWhitespace();
+				if ((condition.m_index <= 0) || !reader.skip(')'))
+					return fail("Positive :nth-child() index expected");
+			} else {
+				break;
+			}
+
+			if ((condition.m_type == Condition::Type::Class || condition.m_type == Condition::Type::Id)
+				&& condition.m_value.isEmpty()) {
+				return fail("Class or id name expected");
+			}
+
+			step.m_conditions.push_back(std::move(condition));
+			hasSimpleSelector = true;
+		}
+
+		if (!hasSimpleSelector)
+			return fail("Selector expected");
+		m_steps.push_back(std::move(step));
+
+		bool hasWhitespace = reader.skipWhitespace();
+		if (reader.atEnd())
+			break;
+
+		if (reader.skip('>')) {
+			combinator = Combinator::Child;
+			reader.skipWhitespace();
+		} else if (hasWhitespace) {
+			combinator = Combinator::Descendant;
+		} else {
+			return fail("Unexpected character");
+		}
+	}
+
+	bool childChainOnly = true;
+	for (const Step &step : m_steps)
+		childChainOnly = childChainOnly && (step.m_combinator == Combinator::Child);
+	m_maxDepth = childChainOnly ? static_cast<int>(m_steps.size()) : -1;
+	return true;
+}
+
+bool QtGumboSelector::matchesStep(const Step &step, QtGumboNodeRef node) const {
+
+	if (!node->isElement())
+		return false;
+	if (!step.m_anyTag && (node->getTag() != step.m_tag))
+		return false;
+
+	for (const Condition &condition : step.m_conditions) {
+		const std::string_view value(condition.m_value.constData(), condition.m_value.size());
+		const QLatin1String name(condition.m_name.constData(), condition.m_name.size());
+		switch (condition.m_type) {
+			case Condition::Type::Class:
+				if (!node->hasClassToken(value))
+					return false;
+				break;
+			case Condition::Type::Id:
+				if (node->getIdAttributeView() != value)
+					return false;
+				break;
+			case Condition::Type::AttributeExists:
+				if (!node->hasAttribute(name))
+					return false;
+				break;
+			case Condition::Type::AttributeEquals:
+				if (!node->hasAttribute(name) || (node->getAttributeView(name) != value))
+					return false;
+				break;
+			case Condition::Type::AttributePrefix: {
+				std::string_view attributeValue = node->getAttributeView(name);
+				if ((attributeValue.size() < value.size()) || (attributeValue.compare(0, value.size(), value) != 0))
+					return false;
+				break;
+			}
+			case Condition::Type::NthChild:
+				if (elementIndex(node) != condition.m_index)
+					return false;
+				break;
+		}
+	}
+	return true;
+}
+
+bool QtGumboSelector::matchesChain(QtGumboNodeRef node, int stepIndex, QtGumboNodeRef scope) const {
+
+	const Step &step = m_steps[stepIndex];
+	if (!matchesStep(step, node))
+		return false;
+
+	QtGumboNodeRef parent = node->getParent();
+	if (step.m_combinator == Combinator::Child) {
+		if (stepIndex == 0)
+			return (parent == scope);
+		return parent && (parent != scope) && matchesChain(parent, stepIndex - 1, scope);
+	}
+
+	if (stepIndex == 0)
+		return true;
+
+	// Descendant combinator: try every ancestor below the scope
+	for (; parent && (parent != scope); parent = parent->getParent()) {
+		if (matchesChain(parent, stepIndex - 1, scope))
+			return true;
+	}
+	return false;
+}
+
+bool QtGumboSelector::matches(QtGumboNodeRef node, QtGumboNodeRef scope) const {
+
+	Q_ASSERT(isValid());
+	if (!isValid() || !node || !scope || (node == scope))
+		return false;
+
+	// NOTE: the chain check stops at the scope, so the node must be its descendant
+	for (QtGumboNodeRef parent = node->getParent(); parent; parent = parent->getParent()) {
+		if (parent == scope)
+			return matchesChain(node, static_cast<int>(m_steps.size()) - 1, scope);
+	}
+	return false;
+}
+
+void QtGumboSelector::traverse(QtGumboNodeRef scope, QtGumboNodeRefs *result, QtGumboNodeRef *firstResult) const {
+
+	Q_ASSERT(isValid());
+	if (!isValid() || !scope)
+		return;
+
+	const int lastStep = static_cast<int>(m_steps.size()) - 1;
+
+	// Pre-order walk, so the result is in the document order
+	QtGumboTreeWalker walker;
+	walker.walkPreOrder(scope, [&](QtGumboNodeRef node, int depth) {
+		if ((depth > 0) && matchesChain(node, lastStep, scope)) {
+			if (firstResult) {
+				*firstResult = node;
+				return QtGumboWalkAction::Stop;
+			}
+			*result << node;
+		}
+
+		if ((m_maxDepth >= 0) && (depth >= m_maxDepth))
+			return QtGumboWalkAction::SkipChildren;
+		return QtGumboWalkAction::Continue;
+	});
+}
+
+QtGumboNodeRefs QtGumboSelector::select(QtGumboNodeRef scope) const {
+
+	QtGumboNodeRefs result;
+	traverse(scope, &result, nullptr);
+	return result;
+}
+
+QtGumboNodeRef QtGumboSelector::selectFirst(QtGumboNodeRef scope) const {
+
+	QtGumboNodeRef result;
+	traverse(scope, nullptr, &result);
+	return result;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_QTGUMBOSELECTOR_H__
+#define __BFR_QTGUMBOSELECTOR_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include <string_view>
+#include <vector>
+
+#include "qtgumbonode.h"
+
+// CSS selector compiled once into the matcher program, e.g. "div[id^=msdiv] > table > tbody > tr:nth-child(2)".
+// Supported: tag name or *, .class, #id, [attr], [attr=value], [attr^=value], :nth-child(n),
+// descendant and child combinators, and the leading '>' meaning the direct child of the search scope.
+// Matching goes right-to-left from every element of the single scope traversal; all the matched elements
+// must be the scope descendants (the scope may be the document node). Compiled selector is immutable, so it can be shared between threads
+class QtGumboSelector {
+public:
+	QtGumboSelector() = default;
+	explicit QtGumboSelector(std::string_view selector);
+
+	bool isValid() const;
+	QString errorString() const;
+
+	bool matches(QtGumboNodeRef node, QtGumboNodeRef scope) const;
+
+	// Matched descendants of the scope, in the document order
+	QtGumboNodeRefs select(QtGumboNodeRef scope) const;
+	QtGumboNodeRef selectFirst(QtGumboNodeRef scope) const;
+
+private:
+	enum class Combinator { Descendant, Child };
+
+	struct Condition {
+		enum class Type { Class, Id, AttributeExists, AttributeEquals, AttributePrefix, NthChild };
+
+		Type m_type;
+		QByteArray m_name;
+		QByteArray m_value;
+		int m_index = 0;
+	};
+
+	// Compound selector, e.g. "td.forum-cell-post"
+	struct Step {
+		// Relation to the previous step (or to the scope for the first one)
+		Combinator m_combinator = Combinator::Descendant;
+		bool m_anyTag = true;
+		HtmlTag m_tag = HtmlTag::UNKNOWN;
+		std::vector<Condition> m_conditions;
+	};
+
+	std::vector<Step> m_steps;
+	// Maximal depth of the match below the scope, when the chain consists of child combinators only
+	int m_maxDepth = -1;
+	QString m_errorString;
+
+	bool compile(std::string_view selector);
+	bool matchesStep(const Step &step, QtGumboNodeRef node) const;
+	bool matchesChain(QtGumboNodeRef node, int stepIndex, QtGumboNodeRef scope) const;
+	void traverse(QtGumboNodeRef scope, QtGumboNodeRefs *result, QtGumboNodeRef *firstResult) const;
+};
+
+#endif // __BFR_QTGUMBOSELECTOR_H__
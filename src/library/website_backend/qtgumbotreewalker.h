@@ -0,0 +1,129 @@
+/*
+ * This file is part of Bitrix Forum Reader.
+ *
+ * Copyright (C) 2016-2020 Alexander Kamyshnikov <axill777@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+#ifndef __BFR_QTGUMBOTREEWALKER_H__
+#define __BFR_QTGUMBOTREEWALKER_H__
+
+#include <vector>
+
+#include "qtgumbonode.h"
+
+// Visitor result: go on, do not enter the node children (pre-order only) or stop the whole walk
+enum class QtGumboWalkAction { Continue, SkipChildren, Stop };
+
+// Iterative DOM walker: explicit stack instead of C++ recursion, so deeply nested quotes/spoilers
+// are walked in linear time without stack overflow risk.
+// The stack is kept between walks, so reuse the walker object for repeated traversals.
+// Visitor signature: QtGumboWalkAction (QtGumboNodeRef node, int depth); root is visited with depth 0,
+// descendants are visited only if matched the filter (elements are entered anyway)
+class QtGumboTreeWalker {
+public:
+	explicit QtGumboTreeWalker(const QtGumboNodeFilter filter = QtGumboNodeFilter::Elements) : m_filter(filter) {}
+
+	// Return false if the walk was stopped by the visitor
+	template <typename Visitor> bool walkPreOrder(QtGumboNodeRef root, Visitor &&visitor);
+	template <typename Visitor> bool walkPostOrder(QtGumboNodeRef root, Visitor &&visitor);
+
+private:
+	struct Entry {
+		const QtGumboNode *m_node;
+		int m_depth;
+		bool m_expanded;
+	};
+
+	QtGumboNodeFilter m_filter;
+	std::vector<Entry> m_stack;
+
+	bool isVisited(const Entry &entry) const { return (entry.m_depth == 0) || entry.m_node->matches(m_filter); }
+	void pushChildren(const Entry &entry);
+};
+
+inline void QtGumboTreeWalker::pushChildren(const Entry &entry) {
+
+	if (!entry.m_node->isElement() && !entry.m_node->isDocument())
+		return;
+
+	// NOTE: reverse order, so the first child is popped first
+	const QtGumboNodeRange children = entry.m_node->getChildren(QtGumboNodeFilter::All);
+	for (int i = children.size() - 1; i >= 0; --i) {
+		const QtGumboNode *child = children[i].get();
+		if (child->isElement() || child->matches(m_filter))
+			m_stack.push_back({ child, entry.m_depth + 1, false });
+	}
+}
+
+template <typename Visitor> bool QtGumboTreeWalker::walkPreOrder(QtGumboNodeRef root, Visitor &&visitor) {
+
+	Q_ASSERT(root);
+	if (!root)
+		return true;
+
+	m_stack.clear();
+	m_stack.push_back({ root.get(), 0, false });
+	while (!m_stack.empty()) {
+		const Entry entry = m_stack.back();
+		m_stack.pop_back();
+
+		QtGumboWalkAction action = QtGumboWalkAction::Continue;
+		if (isVisited(entry))
+			action = visitor(QtGumboNodeRef(entry.m_node), entry.m_depth);
+
+		if (action == QtGumboWalkAction::Stop) {
+			m_stack.clear();
+			return false;
+		}
+		if (action == QtGumboWalkAction::Continue)
+			pushChildren(entry);
+	}
+	return true;
+}
+
+template <typename Visitor> bool QtGumboTreeWalker::walkPostOrder(QtGumboNodeRef root, Visitor &&visitor) {
+
+	Q_ASSERT(root);
+	if (!root)
+		return true;
+
+	m_stack.clear();
+	m_stack.push_back({ root.get(), 0, false });
+	while (!m_stack.empty()) {
+		Entry &top = m_stack.back();
+		if (!top.m_expanded) {
+			top.m_expanded = true;
+			// NOTE: copy, the reference is invalidated by the push
+			const Entry entry = top;
+			pushChildren(entry);
+			continue;
+		}
+
+		const Entry entry = top;
+		m_stack.pop_back();
+		if (isVisited(entry) && (visitor(QtGumboNodeRef(entry.m_node), entry.m_depth) == QtGumboWalkAction::Stop)) {
+			m_stack.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif // __BFR_QTGUMBOTREEWALKER_H__
@@ -357,6 +357,8 @@ public:
 public:
 	virtual result_code::Type getPageCount(const QByteArray &rawData, int &pageCount) = 0;
 	virtual result_code::Type getPagePosts(const QByteArray &rawData, PostList &userPosts) = 0;
+	// Same as getPagePosts, but page contents were already converted to UTF-8 (e.g. while being downloaded)
+	virtual result_code::Type getPagePostsUtf8(const QByteArray &utf8Data, PostList &userPosts) = 0;
 };
 
 } // namespace bfr
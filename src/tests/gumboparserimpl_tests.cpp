@@ -33,8 +33,15 @@
 #endif
 #include "catch.hpp"
 
+#include <common/crawlthrottle.h>
+#include <common/downloadscheduler.h>
+#include <common/downloadsession.h>
 #include <common/filedownloader.h>
+#include <common/httpcache.h>
+#include <common/downloadtransport.h>
 #include <website_backend/gumboparserimpl.h>
+#include <website_backend/qtgumbodocument.h>
+#include <website_backend/qtgumbotreewalker.h>
 
 namespace {
 const QLatin1String g_forumFirstPageUrl { "https://www.banki.ru/forum/?PAGE_NAME=read&FID=22&TID=358149" };
@@ -109,6 +116,507 @@ TEST_CASE("Get forum page count", "[FileDownloader][ForumPageParser]") {
 	}
 }
 
+TEST_CASE("Probe forum page count", "[FileDownloader][ForumPageParser]") {
+	bfr::ForumPageParser fpp;
+
+	SECTION("Page count expression split between chunks") {
+		const QByteArray htmlRawData = "<script>var nav = { current: 1, pages: 42, size: 20 };</script>";
+		int pageCount = -1;
+		REQUIRE(!fpp.probePageCount(htmlRawData.left(38), 0, pageCount));
+		REQUIRE(fpp.probePageCount(htmlRawData, 38, pageCount));
+		REQUIRE(pageCount == 42);
+	}
+
+	SECTION("Probing forum first page contents") {
+		HtmlPageStream page;
+		bool pageComplete = true;
+		int pageCount = -1;
+		REQUIRE(FileDownloader::probeUrl(g_forumFirstPageUrl, page,
+			[&](const QByteArray &rawData, int chunkOffset) { return fpp.probePageCount(rawData, chunkOffset, pageCount); },
+			pageComplete));
+		REQUIRE(pageCount > 0);
+		INFO("Forum page count: " << pageCount << ", bytes received: " << page.size());
+	}
+}
+
+TEST_CASE("Replay recorded forum page", "[FileDownloader]") {
+	DownloadTransport &transport = DownloadTransport::globalInstance();
+	const DownloadTransport::Mode oldMode = transport.mode();
+	const QString oldFixtureDirectory = transport.fixtureDirectory();
+
+	// NOTE: transport is global, so its state must be restored even if the test fails
+	struct TransportStateGuard {
+		DownloadTransport &m_transport;
+		const DownloadTransport::Mode m_mode;
+		const QString &m_fixtureDirectory;
+
+		~TransportStateGuard() {
+			m_transport.setMode(m_mode);
+			m_transport.setFixtureDirectory(m_fixtureDirectory);
+		}
+	} transportStateGuard { transport, oldMode, oldFixtureDirectory };
+
+	QTemporaryDir fixtureDirectory;
+	REQUIRE(fixtureDirectory.isValid());
+	transport.setFixtureDirectory(fixtureDirectory.path());
+
+	DownloadTransport::Fixture fixture;
+	fixture.m_url = g_forumFirstPageUrl;
+	fixture.m_httpCode = 200;
+	fixture.m_body = "<script>var nav = { current: 1, pages: 42, size: 20 };</script>";
+	fixture.m_body += QByteArray(3 * DownloadTransport::ReplayChunkSize, ' ');
+	REQUIRE(transport.store(fixture));
+	transport.setMode(DownloadTransport::Mode::Replay);
+
+	SECTION("Downloading the recorded page") {
+		QByteArray htmlRawData;
+		REQUIRE(FileDownloader::downloadUrl(g_forumFirstPageUrl, htmlRawData));
+		REQUIRE(htmlRawData == fixture.m_body);
+	}
+
+	SECTION("Downloading the recorded page asynchronously") {
+		FileDownloader fd;
+		QEventLoop loop;
+		QObject::connect(&fd, &FileDownloader::downloadFinished, &loop, &QEventLoop::quit);
+		QObject::connect(&fd, &FileDownloader::downloadFailed, &loop, &QEventLoop::quit);
+		QTimer::singleShot(5000, &loop, &QEventLoop::quit);
+
+		fd.startDownloadAsync(QUrl(g_forumFirstPageUrl));
+		// NOTE: the result is reported from the event loop only
+		REQUIRE(fd.lastError() == result_code::Type::Invalid);
+		loop.exec();
+
+		REQUIRE(fd.lastError() == result_code::Type::Ok);
+		REQUIRE(fd.downloadedData() == fixture.m_body);
+	}
+
+	SECTION("Probing the recorded page") {
+		bfr::ForumPageParser fpp;
+		HtmlPageStream page;
+		bool pageComplete = true;
+		int pageCount = -1;
+		REQUIRE(FileDownloader::probeUrl(g_forumFirstPageUrl, page,
+			[&](const QByteArray &rawData, int chunkOffset) { return fpp.probePageCount(rawData, chunkOffset, pageCount); },
+			pageComplete));
+		REQUIRE(!pageComplete);
+		REQUIRE(pageCount == 42);
+	}
+
+	SECTION("Downloading the page without fixture") {
+		QByteArray htmlRawData;
+		REQUIRE(!FileDownloader::downloadUrl(QString(g_forumFirstPageUrl) + "&PAGEN_1=2", htmlRawData));
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Revalidate pages with HTTP cache", "[HttpCache]") {
+	HttpCache &cache = HttpCache::globalInstance();
+
+	// NOTE: cache is global, so its state must be restored even if the test fails
+	struct CacheStateGuard {
+		HttpCache &m_cache;
+		const QString m_cacheDirectory;
+		const qint64 m_maximumSize;
+		const bool m_enabled;
+
+		~CacheStateGuard() {
+			m_cache.setCacheDirectory(m_cacheDirectory);
+			m_cache.setMaximumSize(m_maximumSize);
+			m_cache.setEnabled(m_enabled);
+		}
+	} cacheStateGuard { cache, cache.cacheDirectory(), cache.maximumSize(), cache.isEnabled() };
+
+	QTemporaryDir cacheDirectory;
+	REQUIRE(cacheDirectory.isValid());
+	cache.setCacheDirectory(cacheDirectory.path());
+	cache.setEnabled(true);
+
+	const QString urlStr = QString(g_forumFirstPageUrl) + "&PAGEN_1=1";
+	const QByteArray body(100 * 1000, 'x');
+	HttpCache::Validators validators;
+	validators.m_etag = "\"bfr-etag\"";
+	validators.m_lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+
+	SECTION("Storing the page and serving the 304 response") {
+		// NOTE: response without validators can't be revalidated
+		REQUIRE(!cache.store(urlStr, body, HttpCache::Validators()));
+		REQUIRE(cache.validators(urlStr).isEmpty());
+
+		REQUIRE(cache.store(urlStr, body, validators));
+
+		// Conditional request headers
+		const HttpCache::Validators storedValidators = cache.validators(urlStr);
+		REQUIRE(storedValidators.m_etag == validators.m_etag);
+		REQUIRE(storedValidators.m_lastModified == validators.m_lastModified);
+
+		// 304 response body
+		const quint64 revalidatedCount = cache.revalidatedCount();
+		QByteArray cachedBody;
+		REQUIRE(cache.load(urlStr, cachedBody));
+		REQUIRE(cachedBody == body);
+		REQUIRE(cache.revalidatedCount() == revalidatedCount + 1);
+
+		cache.remove(urlStr);
+		REQUIRE(cache.validators(urlStr).isEmpty());
+		REQUIRE(cache.cacheSize() == 0);
+	}
+
+	SECTION("Evicting the least recently used pages") {
+		// NOTE: room for two entries only
+		cache.setMaximumSize(250 * 1000);
+		const QString urlStr2 = QString(g_forumFirstPageUrl) + "&PAGEN_1=2";
+		const QString urlStr3 = QString(g_forumFirstPageUrl) + "&PAGEN_1=3";
+
+		// NOTE: file modification time is the usage time, so the steps must be distinguishable
+		REQUIRE(cache.store(urlStr, body, validators));
+		QThread::msleep(20);
+		REQUIRE(cache.store(urlStr2, body, validators));
+		QThread::msleep(20);
+		QByteArray cachedBody;
+		REQUIRE(cache.load(urlStr, cachedBody));
+		QThread::msleep(20);
+		REQUIRE(cache.store(urlStr3, body, validators));
+
+		REQUIRE(!cache.validators(urlStr).isEmpty());
+		REQUIRE(cache.validators(urlStr2).isEmpty());
+		REQUIRE(!cache.validators(urlStr3).isEmpty());
+		REQUIRE(cache.cacheSize() <= cache.maximumSize());
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Back off retries of transient failures", "[RetryPolicy]") {
+	const RetryPolicy policy = RetryPolicy();
+	REQUIRE(policy.m_maxAttempts == 4);
+	REQUIRE(policy.m_baseDelayMs == 250);
+	REQUIRE(policy.m_maxDelayMs == 8000);
+
+	// NOTE: full jitter, i.e. any delay from zero up to the exponential bound
+	for (int i = 0; i < 100; ++i) {
+		const qint64 firstDelayMs = policy.backoffDelayMs(1);
+		REQUIRE((firstDelayMs >= 0 && firstDelayMs <= 250));
+		const qint64 thirdDelayMs = policy.backoffDelayMs(3);
+		REQUIRE((thirdDelayMs >= 0 && thirdDelayMs <= 1000));
+		const qint64 lastDelayMs = policy.backoffDelayMs(100);
+		REQUIRE((lastDelayMs >= 0 && lastDelayMs <= 8000));
+	}
+
+	REQUIRE(RetryPolicy::isTransientHttpCode(408));
+	REQUIRE(RetryPolicy::isTransientHttpCode(429));
+	REQUIRE(RetryPolicy::isTransientHttpCode(500));
+	REQUIRE(RetryPolicy::isTransientHttpCode(502));
+	REQUIRE(RetryPolicy::isTransientHttpCode(503));
+	REQUIRE(RetryPolicy::isTransientHttpCode(504));
+	REQUIRE(!RetryPolicy::isTransientHttpCode(404));
+	REQUIRE(!RetryPolicy::isTransientHttpCode(200));
+}
+
+TEST_CASE("Estimate tail latency", "[RetryPolicy]") {
+	LatencyTracker tracker;
+	for (int i = 1; i < LatencyTracker::MinSampleCount; ++i)
+		tracker.addSample(i);
+	REQUIRE(tracker.percentile(95) == -1);
+
+	tracker.addSample(LatencyTracker::MinSampleCount);
+	REQUIRE(tracker.percentile(95) == 19);
+	REQUIRE(tracker.percentile(100) == 20);
+}
+
+TEST_CASE("Schedule batch download requests", "[DownloadScheduler]") {
+	DownloadSession &session = DownloadSession::globalInstance();
+	CrawlThrottle &throttle = CrawlThrottle::globalInstance();
+
+	// NOTE: session and throttle are global, so their state must be restored even if the test fails
+	struct SchedulerStateGuard {
+		DownloadSession &m_session;
+		CrawlThrottle &m_throttle;
+		const RetryPolicy m_retryPolicy;
+		const bool m_hedgingEnabled;
+		const bool m_throttleEnabled;
+
+		~SchedulerStateGuard() {
+			m_session.setRetryPolicy(m_retryPolicy);
+			m_session.setHedgingEnabled(m_hedgingEnabled);
+			m_throttle.setEnabled(m_throttleEnabled);
+		}
+	} schedulerStateGuard { session, throttle, session.retryPolicy(), session.hedgingEnabled(), throttle.isEnabled() };
+
+	// Retry immediately, and hedge any request still running
+	RetryPolicy retryPolicy;
+	retryPolicy.m_baseDelayMs = 0;
+	session.setRetryPolicy(retryPolicy);
+	session.setHedgingEnabled(true);
+	for (int i = 0; i < LatencyTracker::WindowSize; ++i)
+		session.addLatencySample(0);
+	throttle.setEnabled(false);
+
+	DownloadScheduler scheduler(QStringList() << "https://scheduler.test/1" << "https://scheduler.test/2", 4);
+	DownloadScheduler::Request request;
+	qint64 waitMs = 0;
+
+	REQUIRE(scheduler.nextRequest(request, waitMs));
+	REQUIRE(request.m_index == 0);
+	REQUIRE(scheduler.onFinished(request, false, true) == DownloadScheduler::Outcome::Retry);
+
+	// Retries go first, then the new requests, then the hedges of the running ones
+	REQUIRE(scheduler.nextRequest(request, waitMs));
+	REQUIRE(request.m_index == 0);
+	REQUIRE(request.m_attempt == 2);
+	REQUIRE(!request.m_hedge);
+	const DownloadScheduler::Request retryRequest = request;
+
+	REQUIRE(scheduler.nextRequest(request, waitMs));
+	REQUIRE(request.m_index == 1);
+	REQUIRE(request.m_attempt == 1);
+	REQUIRE(!request.m_hedge);
+	const DownloadScheduler::Request newRequest = request;
+
+	REQUIRE(scheduler.nextRequest(request, waitMs));
+	REQUIRE(request.m_index == 0);
+	REQUIRE(request.m_hedge);
+	const DownloadScheduler::Request hedgeRequest = request;
+
+	// The first response wins, and the other copy is discarded
+	REQUIRE(scheduler.onFinished(hedgeRequest, true, false) == DownloadScheduler::Outcome::Succeeded);
+	REQUIRE(scheduler.isDone(0));
+	REQUIRE(scheduler.onFinished(retryRequest, true, false) == DownloadScheduler::Outcome::Discarded);
+
+	// Non-transient failure is not retried
+	REQUIRE(scheduler.onFinished(newRequest, false, false) == DownloadScheduler::Outcome::Failed);
+	REQUIRE(scheduler.isFinished());
+	REQUIRE(!scheduler.allSucceeded());
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Limit request rate with token bucket", "[CrawlThrottle]") {
+	TokenBucket bucket(2.0, 2.0);
+
+	// Burst is available at once, then the next token comes in 1 / rate seconds
+	REQUIRE(bucket.tryAcquire(0) == 0);
+	REQUIRE(bucket.tryAcquire(0) == 0);
+	REQUIRE(bucket.tryAcquire(0) == 500);
+	REQUIRE(bucket.tryAcquire(250) == 250);
+	REQUIRE(bucket.tryAcquire(500) == 0);
+
+	// Bucket is refilled up to the burst only
+	REQUIRE(bucket.tryAcquire(10000) == 0);
+	REQUIRE(bucket.tryAcquire(10000) == 0);
+	REQUIRE(bucket.tryAcquire(10000) > 0);
+
+	bucket.drain(20000);
+	REQUIRE(bucket.tryAcquire(20000) == 500);
+}
+
+TEST_CASE("Control parallel requests with AIMD", "[CrawlThrottle]") {
+	// NOTE: Catch takes the operands by reference, so the static class constants are copied
+	const int initialWindow = AimdController::InitialWindow;
+	const int minWindow = AimdController::MinWindow;
+	const int maxWindow = AimdController::MaxWindow;
+
+	SECTION("Window grows on success") {
+		AimdController controller;
+		REQUIRE(controller.window() == initialWindow);
+		for (int i = 0; i < 20; ++i)
+			controller.onSuccess(100);
+		REQUIRE(controller.window() > initialWindow);
+
+		for (int i = 0; i < 1000; ++i)
+			controller.onSuccess(100);
+		REQUIRE(controller.window() == maxWindow);
+	}
+
+	SECTION("Window is halved once per window on congestion") {
+		AimdController controller;
+		controller.onCongestion();
+		REQUIRE(controller.window() == initialWindow / 2);
+		// NOTE: the requests of the same window report the same congestion
+		controller.onCongestion();
+		REQUIRE(controller.window() == initialWindow / 2);
+		controller.onCongestion();
+		REQUIRE(controller.window() == initialWindow / 4);
+		controller.onCongestion();
+		REQUIRE(controller.window() == minWindow);
+	}
+
+	SECTION("Window is halved on latency rise") {
+		AimdController controller;
+		for (int i = 0; i < 4; ++i)
+			controller.onSuccess(100);
+		REQUIRE(controller.window() == initialWindow);
+
+		// Moving average: 100 * 0.8 + 2000 * 0.2 = 480 ms, i.e. more than 3 times of the baseline
+		controller.onSuccess(2000);
+		REQUIRE(controller.window() == initialWindow / 2);
+	}
+}
+
+TEST_CASE("Cancel waiting for crawl slot", "[CrawlThrottle]") {
+	const QUrl url("https://throttle.test/");
+	CrawlThrottle &throttle = CrawlThrottle::globalInstance();
+	throttle.setHostRate(url.host(), 0.001, 1.0);
+
+	CancellationToken token = CancellationToken::create();
+	REQUIRE(throttle.waitForSlot(url, token));
+
+	// NOTE: bucket is empty now, so the wait would last for ~1000 seconds without cancellation
+	token.cancel();
+	REQUIRE(!throttle.waitForSlot(url, token));
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Navigate document node arena", "[QtGumboDocument]") {
+	QtGumboNodePtr listNode;
+	{
+		QtGumboDocument document(QStringLiteral("<html><body><div class=\"a\">text</div><ul><li>1</li><li>2</li></ul></body></html>"));
+		QtGumboNodeRef bodyNode = document.rootNode()->getElementByTag({ HtmlTag::BODY, 0 });
+		REQUIRE(bodyNode);
+		REQUIRE(bodyNode->getParent() == document.rootNode());
+		REQUIRE(bodyNode->getChildElementCount() == 2);
+		REQUIRE(bodyNode->getElementByClass("a")->getChildrenInnerText() == "text");
+		REQUIRE(bodyNode->getElementByClass("a")->getTextChildrenCount() == 1);
+
+		listNode = bodyNode->getElementByTag({ HtmlTag::UL, 0 }).toSharedPtr();
+		REQUIRE(listNode);
+	}
+
+	// NOTE: node pointer keeps the whole parse tree alive after the document is destroyed
+	QtGumboNodeRange items = listNode->getChildren();
+	REQUIRE(items.size() == 2);
+	REQUIRE(items.mid(1).size() == 1);
+	REQUIRE(items[1]->getParent() == listNode);
+	REQUIRE(items[1]->getChildrenInnerText() == "2");
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Look up indexed document elements", "[QtGumboDocument]") {
+	QtGumboIndexOptions indexOptions;
+	indexOptions.m_idPrefixes << "msdiv";
+	QtGumboDocument document(QStringLiteral("<html><body><div id=\"msdiv1\" class=\"post first\">"
+											"<div id=\"msdiv2\" class=\"post\"></div></div><p id=\"note\" class=\"Post\"></p></body></html>"),
+		indexOptions);
+
+	QtGumboNodeRefs postNodes = document.elementsByIdPrefix("msdiv");
+	REQUIRE(postNodes.size() == 2);
+	REQUIRE(postNodes[0]->getIdAttribute() == "msdiv1");
+	REQUIRE(postNodes[1]->getIdAttribute() == "msdiv2");
+	REQUIRE(document.elementById("msdiv2") == postNodes[1]);
+	// NOTE: id prefixes limit the id index
+	REQUIRE(!document.elementById("note"));
+
+	REQUIRE(document.elementsByClass("post").size() == 3);
+	REQUIRE(document.elementsByClass("first").size() == 1);
+	REQUIRE(postNodes[0]->getElementsByClassRecursive("post").size() == 1);
+	REQUIRE(postNodes[1]->getElementsByClassRecursive("post").size() == 0);
+	// NOTE: whole class attribute value is matched, so "post first" is not the "post" one
+	REQUIRE(postNodes[0]->getParent()->getElementsByClassRecursive("post").size() == 1);
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Skip post divs with malformed id", "[ForumPageParser]") {
+	QtGumboIndexOptions indexOptions;
+	indexOptions.m_idPrefixes << "msdiv";
+	QtGumboDocument document(QStringLiteral("<html><body><div id=\"msdivX\"></div>"
+											"<div id=\"msdiv1\"></div><div id=\"msdiv2\"></div></body></html>"),
+		indexOptions);
+
+	bfr::ForumPageParser fpp;
+	QtGumboNodeRefs msdivNodes;
+	fpp.findMsdivNodes(document, msdivNodes);
+	REQUIRE(msdivNodes.size() == 2);
+	REQUIRE(msdivNodes[0]->getIdAttribute() == "msdiv1");
+	REQUIRE(msdivNodes[1]->getIdAttribute() == "msdiv2");
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Query document with compiled selectors", "[QtGumboDocument]") {
+	QtGumboDocument document(QStringLiteral("<html><body><div id=\"msdiv1\"><table><tbody>"
+											"<tr><td class=\"forum-cell-post wide\"><span>1</span></td></tr>"
+											"<tr><td><span>2</span></td></tr></tbody></table></div></body></html>"));
+
+	QtGumboSelector postSelector("div[id^=msdiv] > table > tbody > tr:nth-child(2)");
+	REQUIRE(postSelector.isValid());
+	QtGumboNodeRef rowNode = document.selectFirst(postSelector);
+	REQUIRE(rowNode);
+	REQUIRE(rowNode->getTag() == HtmlTag::TR);
+
+	REQUIRE(document.select(QtGumboSelector("tr span")).size() == 2);
+	REQUIRE(document.select(QtGumboSelector("td.forum-cell-post > span")).size() == 1);
+	REQUIRE(QtGumboSelector("> span").select(rowNode).size() == 0);
+	REQUIRE(QtGumboSelector("span").select(rowNode).size() == 1);
+
+	REQUIRE(!QtGumboSelector("div:first-child").isValid());
+	REQUIRE(!QtGumboSelector("div >").isValid());
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Walk document tree iteratively", "[QtGumboDocument]") {
+	QtGumboDocument document(
+		QStringLiteral("<html><body><div id=\"a\"><p id=\"b\"><i id=\"c\"></i></p><p id=\"d\"></p></div></body></html>"));
+	QtGumboNodeRef bodyNode = document.selectFirst(QtGumboSelector("> html > body"));
+	REQUIRE(bodyNode);
+
+	QtGumboTreeWalker walker;
+	QString ids;
+	auto appendId = [&ids](QtGumboNodeRef node, int) {
+		ids += node->getIdAttribute();
+		return (node->getIdAttributeView() == "b") ? QtGumboWalkAction::SkipChildren : QtGumboWalkAction::Continue;
+	};
+	REQUIRE(walker.walkPreOrder(bodyNode, appendId));
+	REQUIRE(ids == "abd");
+
+	ids.clear();
+	REQUIRE(walker.walkPostOrder(bodyNode, appendId));
+	REQUIRE(ids == "cbda");
+
+	ids.clear();
+	REQUIRE(!walker.walkPreOrder(bodyNode, [&ids](QtGumboNodeRef node, int depth) {
+		ids += node->getIdAttribute();
+		return (depth == 2) ? QtGumboWalkAction::Stop : QtGumboWalkAction::Continue;
+	}));
+	REQUIRE(ids == "ab");
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Parse UTF-8 document without conversion", "[QtGumboDocument]") {
+	// NOTE: external buffer is not copied, so it must outlive the document
+	static const char html[] = "<html><body><p id=\"text\">\xd0\xa2\xd0\xb5\xd0\xba\xd1\x81\xd1\x82</p></body></html>";
+	QtGumboDocument document(QByteArray::fromRawData(html, static_cast<int>(sizeof(html) - 1)));
+
+	QtGumboNodeRef textNode = document.elementById("text");
+	REQUIRE(textNode);
+	REQUIRE(textNode->getChildrenInnerText() == QString::fromUtf8("\xd0\xa2\xd0\xb5\xd0\xba\xd1\x81\xd1\x82"));
+}
+
+#ifdef QT_GUMBO_METADATA
+//---------------------------------------------------------------------------------------------------------------------------------------
+
+TEST_CASE("Get node metadata on demand", "[QtGumboDocument]") {
+	QtGumboDocument document(QStringLiteral("<html><body><p id=\"text\" class=\"note\">a<b>b</b></p></body></html>"));
+	QtGumboNodeRef textNode = document.elementById("text");
+	REQUIRE(textNode);
+
+	const QtGumboNodeProps &props = textNode->metadata();
+	REQUIRE(&props == &textNode->metadata());
+	REQUIRE(props.id() == "text");
+	REQUIRE(props.className() == "note");
+	REQUIRE(props.attributes().size() == 2);
+	REQUIRE(props.children().size() == 2);
+	REQUIRE(props.elementChildren().size() == 1);
+	REQUIRE(props.childrenText() == "a");
+	// NOTE: the field is computed once, and the same cached value is returned then
+	REQUIRE(&props.html() == &props.html());
+}
+#endif
+
 //---------------------------------------------------------------------------------------------------------------------------------------
 
 TEST_CASE("Get forum page posts", "[FileDownloader][ForumPageParser]") {